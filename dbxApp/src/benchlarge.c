@@ -0,0 +1,145 @@
+/* Cost of a dbxLocker over all refs of a synthetic database.
+ *
+ * For 1k, 10k and 100k refs (see dbxtopo.h), w/ and w/o DBXLOCKER_LARGE,
+ * times dbxLockerAlloc(), dbxLockMany()+dbxUnlockMany() when nothing has
+ * changed, the same after one link is split and re-joined, and dbxLockerFree().
+ * "relock" excludes the time of the split and join.
+ *
+ * The number of relock iterations may be set with $DBXBENCH_LOOPS (default 100),
+ * and the largest size with $DBXBENCH_MAXREFS (default 100000).
+ */
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbxtopo.h"
+
+static
+epicsUInt64 nowns(void)
+{
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret==0);
+    return ts.tv_sec*(epicsUInt64)1000000000u + ts.tv_nsec;
+}
+
+static
+size_t envSize(const char *name, size_t def)
+{
+    const char *env = getenv(name);
+    if(env && atol(env)>0)
+        return (size_t)atol(env);
+    return def;
+}
+
+/* split then re-join link i */
+static
+void rejoin(dbxTopo *topo, size_t i)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = &topo->refs[topo->linkA[i]];
+    refs[1] = &topo->refs[topo->linkB[i]];
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, topo->links[i]);
+    dbxUnlockMany(locker);
+    dbxLockMany(locker, 0);
+    topo->links[i] = dbxLockRefJoin(locker, refs[0], refs[1]);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static
+void runPoint(dbxTopo *topo, unsigned int flags, size_t nloops)
+{
+    dbxLockRef **prefs;
+    dbxLocker *L;
+    size_t i, nrefs = topo->nrefs;
+    unsigned int seed = 1;
+    epicsUInt64 T0, T1, Talloc, Tlock, Trejoin, Trelock, Tfree;
+
+    prefs = malloc(nrefs*sizeof(*prefs));
+    assert(prefs);
+    for(i=0; i<nrefs; i++)
+        prefs[i] = &topo->refs[i];
+    /* not in lock order */
+    for(i=nrefs-1; i>0; i--) {
+        size_t j = rand_r(&seed)%(i+1);
+        dbxLockRef *tmp = prefs[i];
+        prefs[i] = prefs[j];
+        prefs[j] = tmp;
+    }
+
+    T0 = nowns();
+    L = dbxLockerAlloc(prefs, nrefs, flags);
+    T1 = nowns();
+    assert(L);
+    Talloc = T1-T0;
+
+    T0 = nowns();
+    for(i=0; i<nloops; i++) {
+        dbxLockMany(L, 0);
+        dbxUnlockMany(L);
+    }
+    T1 = nowns();
+    Tlock = (T1-T0)/nloops;
+
+    seed = 2;
+    T0 = nowns();
+    for(i=0; i<nloops && topo->nlinks; i++)
+        rejoin(topo, rand_r(&seed)%topo->nlinks);
+    T1 = nowns();
+    Trejoin = T1-T0;
+
+    seed = 2;
+    T0 = nowns();
+    for(i=0; i<nloops; i++) {
+        if(topo->nlinks)
+            rejoin(topo, rand_r(&seed)%topo->nlinks);
+        dbxLockMany(L, 0);
+        dbxUnlockMany(L);
+    }
+    T1 = nowns();
+    Trelock = (T1-T0) > Trejoin ? (T1-T0-Trejoin)/nloops : 0;
+
+    T0 = nowns();
+    dbxLockerFree(L);
+    T1 = nowns();
+    Tfree = T1-T0;
+
+    printf("%-7s %8lu %10.3f %10.1f %10.1f %10.3f\n",
+           (flags&DBXLOCKER_LARGE) ? "large" : "default", (unsigned long)nrefs,
+           Talloc*1e-6, Tlock*1e-3, Trelock*1e-3, Tfree*1e-6);
+    fflush(stdout);
+    free(prefs);
+}
+
+MAIN(benchlarge)
+{
+    size_t n, nloops = envSize("DBXBENCH_LOOPS", 100),
+           maxrefs = envSize("DBXBENCH_MAXREFS", 100000);
+
+    printf("# alloc and free in ms, lock and relock in us\n");
+    printf("%-7s %8s %10s %10s %10s %10s\n",
+           "# mode", "refs", "alloc", "lock", "relock", "free");
+
+    for(n=1000; n<=maxrefs; n*=10) {
+        dbxTopoConfig conf;
+        dbxTopo *topo;
+
+        dbxTopoDefaults(&conf, n);
+        topo = dbxTopoCreate(&conf);
+        assert(topo);
+        runPoint(topo, 0, nloops);
+        runPoint(topo, DBXLOCKER_LARGE, nloops);
+        dbxTopoFree(topo);
+    }
+    return 0;
+}
@@ -0,0 +1,413 @@
+/* Thread scaling benchmark.
+ *
+ * Sweeps the number of locking threads (1, 2, 4, ... up to the number of CPUs)
+ * and reports throughput and latency percentiles for a few reference
+ * topologies.
+ *
+ * disjoint - Each thread works on its own private set of refs.
+ *            Ideally this scales linearly.
+ * hot      - All threads contend for a single shared lockset.
+ * mixed    - Threads lock, join, and split random refs from a synthetic
+ *            database topology (see dbxtopo.h).
+ *
+ * Also times building and tearing down synthetic topologies of increasing size.
+ *
+ * The run time of each point may be set with $DBXBENCH_TIME (seconds).
+ * The number of refs in the mixed case with $DBXBENCH_REFS (default 10000),
+ * and the largest topology built with $DBXBENCH_MAXREFS (default 100000).
+ */
+#ifdef __linux__
+#  define _GNU_SOURCE
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbxtopo.h"
+
+/* latency histogram with 16 linear sub-buckets per power of 2 */
+#define NSUB 16
+#define NBUCKET (64*NSUB)
+
+typedef struct benchdata benchdata;
+typedef struct benchthread benchthread;
+
+typedef enum {
+    scenarioDisjoint,
+    scenarioHot,
+    scenarioMixed,
+} scenario;
+
+static const char* scenarioNames[] = {"disjoint", "hot", "mixed"};
+
+#define NPRIVATE 16
+#define NLOCKMAX 8
+
+struct benchthread {
+    int id;
+    benchdata *central;
+    epicsEventId ready, done;
+    unsigned int seed;
+
+    dbxLockRef *mine; /* NPRIVATE refs owned by this thread */
+    dbxLockLink *link;
+
+    size_t nops;
+    size_t hist[NBUCKET];
+};
+
+struct benchdata {
+    scenario kind;
+
+    dbxLockRef hot;
+    dbxTopo *topo;
+
+    size_t nthreads;
+    benchthread *threads;
+
+    epicsEventId start;
+    int stop;
+};
+
+static
+epicsUInt64 nowns(void)
+{
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret==0);
+    return ts.tv_sec*(epicsUInt64)1000000000u + ts.tv_nsec;
+}
+
+static
+size_t bucketOf(epicsUInt64 ns)
+{
+    unsigned msb = 0;
+    epicsUInt64 v = ns;
+
+    if(ns<NSUB)
+        return (size_t)ns;
+    while(v>>=1)
+        msb++;
+    /* msb>=4 */
+    return (msb-3)*NSUB + (size_t)((ns>>(msb-4))&(NSUB-1));
+}
+
+/* lower bound (in ns) of a histogram bucket */
+static
+epicsUInt64 bucketValue(size_t b)
+{
+    size_t msb = b/NSUB+3, sub = b%NSUB;
+    if(b<NSUB)
+        return b;
+    return ((epicsUInt64)(NSUB+sub))<<(msb-4);
+}
+
+static
+void pinSelf(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "Unable to pin to CPU %d\n", cpu);
+#endif
+}
+
+static
+dbxLockRef* pickRef(benchthread *self)
+{
+    benchdata *central = self->central;
+    int r = rand_r(&self->seed);
+
+    switch(central->kind) {
+    case scenarioDisjoint:
+        return &self->mine[r%NPRIVATE];
+    case scenarioHot:
+        return &central->hot;
+    case scenarioMixed:
+    default:
+        return &central->topo->refs[r%central->topo->nrefs];
+    }
+}
+
+static
+void doLockOne(benchthread *self)
+{
+    dbxLock *lock = dbxLockOne(pickRef(self), 0);
+    assert(lock);
+    dbxUnlockOne(lock);
+}
+
+static
+void doLockMany(benchthread *self)
+{
+    dbxLockRef *refs[NLOCKMAX];
+    dbxLocker *locker;
+    size_t i, nlock = 2 + rand_r(&self->seed)%(NLOCKMAX-1);
+
+    for(i=0; i<nlock; i++)
+        refs[i] = pickRef(self);
+
+    locker = dbxLockerAlloc(refs, nlock, 0);
+    assert(locker);
+    dbxLockMany(locker, 0);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+/* alternate between joining two refs, and splitting the previous join */
+static
+void doJoinSplit(benchthread *self)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    if(self->link) {
+        refs[0] = self->link->A;
+        refs[1] = self->link->B;
+    } else {
+        refs[0] = pickRef(self);
+        refs[1] = pickRef(self);
+        if(refs[0]==refs[1])
+            return;
+    }
+
+    locker = dbxLockerAlloc(refs, 2, 0);
+    assert(locker);
+    dbxLockMany(locker, 0);
+    if(self->link) {
+        dbxLockRefSplit(locker, self->link);
+        self->link = NULL;
+    } else {
+        self->link = dbxLockRefJoin(locker, refs[0], refs[1]);
+    }
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static
+void benchTask(void *raw)
+{
+    benchthread *self = raw;
+    benchdata *central = self->central;
+
+    pinSelf(self->id%epicsThreadGetCPUs());
+
+    epicsEventSignal(self->ready);
+    epicsEventMustWait(central->start);
+    epicsEventSignal(central->start); /* wake the next waiter */
+
+    while(!epicsAtomicGetIntT(&central->stop)) {
+        int r = rand_r(&self->seed)%64;
+        epicsUInt64 T0, T1;
+
+        T0 = nowns();
+        if(r<48)
+            doLockOne(self);
+        else if(r<62 || central->kind==scenarioHot)
+            doLockMany(self);
+        else
+            doJoinSplit(self);
+        T1 = nowns();
+
+        self->hist[bucketOf(T1-T0)]++;
+        self->nops++;
+    }
+
+    epicsEventSignal(self->done);
+}
+
+static
+epicsUInt64 percentile(const size_t *hist, size_t total, double frac)
+{
+    size_t b, sum = 0, want = (size_t)(total*frac);
+
+    for(b=0; b<NBUCKET; b++) {
+        sum += hist[b];
+        if(sum>want)
+            return bucketValue(b);
+    }
+    return bucketValue(NBUCKET-1);
+}
+
+static
+void runPoint(scenario kind, size_t nthreads, double runtime, size_t nrefs)
+{
+    benchdata data;
+    size_t i, total = 0;
+    size_t *hist;
+    epicsUInt64 T0, T1, maxb = 0;
+
+    memset(&data, 0, sizeof(data));
+    data.kind = kind;
+    data.nthreads = nthreads;
+    data.threads = calloc(nthreads, sizeof(*data.threads));
+    hist = calloc(NBUCKET, sizeof(*hist));
+    data.start = epicsEventMustCreate(epicsEventEmpty);
+    assert(data.threads && hist);
+
+    dbxLockRefInit(&data.hot, 0);
+
+    if(kind==scenarioMixed) {
+        dbxTopoConfig conf;
+        dbxTopoDefaults(&conf, nrefs);
+        data.topo = dbxTopoCreate(&conf);
+        assert(data.topo);
+    }
+
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &data.threads[i];
+        size_t j;
+
+        td->id = i;
+        td->central = &data;
+        td->seed = 42+i;
+        td->ready = epicsEventMustCreate(epicsEventEmpty);
+        td->done = epicsEventMustCreate(epicsEventEmpty);
+        td->mine = calloc(NPRIVATE, sizeof(*td->mine));
+        assert(td->mine);
+        for(j=0; j<NPRIVATE; j++)
+            dbxLockRefInit(&td->mine[j], 0);
+
+        epicsThreadMustCreate("benchTask",
+                              epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &benchTask, td);
+        epicsEventMustWait(td->ready);
+    }
+
+    T0 = nowns();
+    epicsEventSignal(data.start);
+    epicsThreadSleep(runtime);
+    epicsAtomicSetIntT(&data.stop, 1);
+
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &data.threads[i];
+        size_t b;
+
+        epicsEventMustWait(td->done);
+        total += td->nops;
+        for(b=0; b<NBUCKET; b++) {
+            hist[b] += td->hist[b];
+            if(td->hist[b] && b>maxb)
+                maxb = b;
+        }
+    }
+    T1 = nowns();
+
+    printf("%-9s %4u %12.0f %9llu %9llu %9llu %9llu\n",
+           scenarioNames[kind], (unsigned)nthreads,
+           total/((T1-T0)*1e-9),
+           (unsigned long long)percentile(hist, total, 0.5),
+           (unsigned long long)percentile(hist, total, 0.99),
+           (unsigned long long)percentile(hist, total, 0.999),
+           (unsigned long long)bucketValue(maxb));
+    fflush(stdout);
+
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &data.threads[i];
+        size_t j;
+
+        for(j=0; j<NPRIVATE; j++)
+            dbxLockRefClean(&td->mine[j]);
+    }
+    dbxLockRefClean(&data.hot);
+    dbxTopoFree(data.topo);
+
+    /* free links orphaned by dbxLockRefClean() */
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &data.threads[i];
+
+        if(td->link)
+            dbxLockRefSplit(NULL, td->link);
+        free(td->mine);
+        epicsEventDestroy(td->ready);
+        epicsEventDestroy(td->done);
+    }
+
+    epicsEventDestroy(data.start);
+    free(hist);
+    free(data.threads);
+}
+
+/* time creation (by dbxLockRefJoin()) and destruction of a topology */
+static
+void runBuild(size_t nrefs)
+{
+    dbxTopoConfig conf;
+    dbxTopo *topo;
+    size_t nsets, largest, nlinks;
+    epicsUInt64 T0, T1, T2;
+
+    dbxTopoDefaults(&conf, nrefs);
+
+    T0 = nowns();
+    topo = dbxTopoCreate(&conf);
+    T1 = nowns();
+    assert(topo);
+    dbxTopoCount(topo, &nsets, &largest);
+    nlinks = topo->nlinks;
+    T2 = nowns();
+    dbxTopoFree(topo);
+    T2 = nowns() - (T2-T1);
+
+    printf("%-9s %8lu %8lu %8lu %8lu %10.3f %10.3f\n", "build",
+           (unsigned long)nrefs, (unsigned long)nlinks,
+           (unsigned long)nsets, (unsigned long)largest,
+           (T1-T0)*1e-6, (T2-T1)*1e-6);
+    fflush(stdout);
+}
+
+static
+size_t envSize(const char *name, size_t def)
+{
+    const char *env = getenv(name);
+    if(env && atol(env)>0)
+        return (size_t)atol(env);
+    return def;
+}
+
+MAIN(benchlock)
+{
+    int ncpu = epicsThreadGetCPUs();
+    double runtime = 1.0;
+    const char *env = getenv("DBXBENCH_TIME");
+    size_t n, nrefs = envSize("DBXBENCH_REFS", 10000),
+           maxrefs = envSize("DBXBENCH_MAXREFS", 100000);
+    int kind;
+
+    if(env && atof(env)>0)
+        runtime = atof(env);
+
+    printf("# times in ms\n");
+    printf("%-9s %8s %8s %8s %8s %10s %10s\n",
+           "# case", "refs", "links", "sets", "largest", "create", "free");
+    for(n=1000; n<=maxrefs; n*=10)
+        runBuild(n);
+
+    printf("# %d CPUs, %.1f sec. per point, latency in ns\n", ncpu, runtime);
+    printf("%-9s %4s %12s %9s %9s %9s %9s\n",
+           "# case", "thr", "ops/s", "p50", "p99", "p99.9", "max");
+
+    for(kind=scenarioDisjoint; kind<=scenarioMixed; kind++) {
+        for(n=1; ; n*=2) {
+            if(n>(size_t)ncpu)
+                n = ncpu;
+            runPoint((scenario)kind, n, runtime, nrefs);
+            if(n==(size_t)ncpu)
+                break;
+        }
+    }
+    return 0;
+}
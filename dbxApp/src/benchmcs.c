@@ -0,0 +1,259 @@
+/* Fairness and tail latency of a contended lock.
+ *
+ * N threads repeatedly lock a single shared lock, hold it briefly,
+ * unlock, and do some work outside of the lock.
+ * Compares epicsMutex with the MCS queue lock (see dbxmcs.c),
+ * both spinning and parking immediately.
+ *
+ * Reports throughput, percentiles of the time to acquire,
+ * and the spread of acquisitions between threads.
+ * "jain" is Jain's fairness index of the per-thread counts.
+ * 1.0 when all threads lock equally often, 1/N when one thread starves the rest.
+ *
+ * The run time of each point may be set with $DBXBENCH_TIME (seconds).
+ */
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+/* latency histogram with 16 linear sub-buckets per power of 2 */
+#define NSUB 16
+#define NBUCKET (64*NSUB)
+
+typedef enum {
+    kindMutex,
+    kindMCS,
+    kindMCSPark,
+} lockkind;
+
+static const char* kindNames[] = {"mutex", "mcs", "mcs-park"};
+
+typedef struct benchdata benchdata;
+
+typedef struct {
+    benchdata *central;
+    epicsEventId ready, done;
+
+    size_t nops;
+    size_t hist[NBUCKET];
+} benchthread;
+
+struct benchdata {
+    lockkind kind;
+    epicsMutexId mutex;
+    dbxmcs mcs;
+    volatile size_t shared; /* guarded by the lock */
+
+    epicsEventId start;
+    int stop;
+};
+
+static
+epicsUInt64 nowns(void)
+{
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret==0);
+    return ts.tv_sec*(epicsUInt64)1000000000u + ts.tv_nsec;
+}
+
+static
+size_t bucketOf(epicsUInt64 ns)
+{
+    unsigned msb = 0;
+    epicsUInt64 v = ns;
+
+    if(ns<NSUB)
+        return (size_t)ns;
+    while(v>>=1)
+        msb++;
+    return (msb-3)*NSUB + (size_t)((ns>>(msb-4))&(NSUB-1));
+}
+
+static
+epicsUInt64 bucketValue(size_t b)
+{
+    size_t msb = b/NSUB+3, sub = b%NSUB;
+    if(b<NSUB)
+        return b;
+    return ((epicsUInt64)(NSUB+sub))<<(msb-4);
+}
+
+static
+epicsUInt64 percentile(const size_t *hist, size_t total, double frac)
+{
+    size_t b, sum = 0, want = (size_t)(total*frac);
+
+    for(b=0; b<NBUCKET; b++) {
+        sum += hist[b];
+        if(sum>want)
+            return bucketValue(b);
+    }
+    return bucketValue(NBUCKET-1);
+}
+
+static
+void spinWork(benchdata *central, unsigned n)
+{
+    unsigned i;
+    for(i=0; i<n; i++)
+        central->shared++;
+}
+
+static
+void benchTask(void *raw)
+{
+    benchthread *self = raw;
+    benchdata *central = self->central;
+    volatile size_t outside = 0;
+
+    epicsEventSignal(self->ready);
+    epicsEventMustWait(central->start);
+    epicsEventSignal(central->start); /* wake the next waiter */
+
+    while(!epicsAtomicGetIntT(&central->stop)) {
+        epicsUInt64 T0, T1;
+        unsigned i;
+
+        T0 = nowns();
+        if(central->kind==kindMutex)
+            epicsMutexMustLock(central->mutex);
+        else
+            dbxmcslock(&central->mcs);
+        T1 = nowns();
+
+        spinWork(central, 16);
+
+        if(central->kind==kindMutex)
+            epicsMutexUnlock(central->mutex);
+        else
+            dbxmcsunlock(&central->mcs);
+
+        for(i=0; i<64; i++)
+            outside++;
+
+        self->hist[bucketOf(T1-T0)]++;
+        self->nops++;
+    }
+
+    epicsEventSignal(self->done);
+}
+
+static
+void runPoint(lockkind kind, size_t nthreads, double runtime)
+{
+    benchdata data;
+    benchthread *threads;
+    size_t i, b, total = 0, minops = (size_t)-1, maxops = 0;
+    size_t *hist;
+    double sumsq = 0.0;
+    epicsUInt64 T0, T1, maxb = 0;
+    int prevspin = dbxMCSSpin;
+
+    memset(&data, 0, sizeof(data));
+    data.kind = kind;
+    data.mutex = epicsMutexMustCreate();
+    dbxmcsinit(&data.mcs);
+    data.start = epicsEventMustCreate(epicsEventEmpty);
+    threads = calloc(nthreads, sizeof(*threads));
+    hist = calloc(NBUCKET, sizeof(*hist));
+    assert(threads && hist);
+
+    if(kind==kindMCSPark)
+        dbxMCSSpin = 0;
+
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &threads[i];
+
+        td->central = &data;
+        td->ready = epicsEventMustCreate(epicsEventEmpty);
+        td->done = epicsEventMustCreate(epicsEventEmpty);
+
+        epicsThreadMustCreate("benchTask",
+                              epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &benchTask, td);
+        epicsEventMustWait(td->ready);
+    }
+
+    T0 = nowns();
+    epicsEventSignal(data.start);
+    epicsThreadSleep(runtime);
+    epicsAtomicSetIntT(&data.stop, 1);
+
+    for(i=0; i<nthreads; i++) {
+        benchthread *td = &threads[i];
+
+        epicsEventMustWait(td->done);
+        total += td->nops;
+        sumsq += (double)td->nops*td->nops;
+        if(td->nops<minops)
+            minops = td->nops;
+        if(td->nops>maxops)
+            maxops = td->nops;
+        for(b=0; b<NBUCKET; b++) {
+            hist[b] += td->hist[b];
+            if(td->hist[b] && b>maxb)
+                maxb = b;
+        }
+        epicsEventDestroy(td->ready);
+        epicsEventDestroy(td->done);
+    }
+    T1 = nowns();
+
+    dbxMCSSpin = prevspin;
+
+    printf("%-9s %4u %12.0f %9llu %9llu %9llu %9llu %6.3f %10lu %10lu\n",
+           kindNames[kind], (unsigned)nthreads,
+           total/((T1-T0)*1e-9),
+           (unsigned long long)percentile(hist, total, 0.5),
+           (unsigned long long)percentile(hist, total, 0.99),
+           (unsigned long long)percentile(hist, total, 0.999),
+           (unsigned long long)bucketValue(maxb),
+           sumsq>0.0 ? (double)total*total/(nthreads*sumsq) : 0.0,
+           (unsigned long)minops, (unsigned long)maxops);
+    fflush(stdout);
+
+    dbxmcsclean(&data.mcs);
+    epicsMutexDestroy(data.mutex);
+    epicsEventDestroy(data.start);
+    free(hist);
+    free(threads);
+}
+
+MAIN(benchmcs)
+{
+    int ncpu = epicsThreadGetCPUs();
+    double runtime = 1.0;
+    const char *env = getenv("DBXBENCH_TIME");
+    size_t n, nmax = 2*ncpu;
+    int kind;
+
+    if(env && atof(env)>0)
+        runtime = atof(env);
+
+    printf("# %d CPUs, %.1f sec. per point, latency in ns\n", ncpu, runtime);
+    printf("%-9s %4s %12s %9s %9s %9s %9s %6s %10s %10s\n",
+           "# lock", "thr", "ops/s", "p50", "p99", "p99.9", "max",
+           "jain", "min", "max");
+
+    /* include over-subscribed */
+    for(kind=kindMutex; kind<=kindMCSPark; kind++) {
+        for(n=2; ; n*=2) {
+            if(n>nmax)
+                n = nmax;
+            runPoint((lockkind)kind, n, runtime);
+            if(n==nmax)
+                break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+/* NUMA placement of locks.  See dbxLockNuma()
+ *
+ * $DBXBENCH_THREADS (default 2) threads are pinned to the CPUs of each
+ * node, and lock and unlock $DBXBENCH_SETS (default 4) locksets of that
+ * node in turn.  All locks are first allocated by a thread on node 0.
+ * Each lockset is then joined with, and split from, another ref, which
+ * with NUMA placement moves it to the node of its threads.
+ *
+ * Throughput before and after, w/ and w/o NUMA placement.
+ * Each point runs for $DBXBENCH_TIME (default 1) sec.
+ * Skipped with only one node.
+ */
+#ifdef __linux__
+#  define _GNU_SOURCE
+#  include <sched.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#ifdef __linux__
+
+typedef struct {
+    int node;
+    dbxLockRef *refs;
+    size_t nsets;
+    size_t nops;
+    epicsEventId done;
+} benchthread;
+
+static int stop;
+static cpu_set_t nodecpus[DBXNUMA_MAXNODES];
+
+static
+size_t envSize(const char *name, size_t def)
+{
+    const char *env = getenv(name);
+    if(env && atol(env)>0)
+        return (size_t)atol(env);
+    return def;
+}
+
+/* parse eg. "0-3,8-11".  Returns non-zero if no CPUs */
+static
+int readCPUs(int node, cpu_set_t *set)
+{
+    char fname[64], buf[256], *pos;
+    FILE *fp;
+
+    CPU_ZERO(set);
+    sprintf(fname, "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(fname, "r");
+    if(!fp)
+        return 1;
+    if(!fgets(buf, sizeof(buf), fp))
+        buf[0] = '\0';
+    fclose(fp);
+
+    for(pos=buf; *pos && *pos!='\n'; ) {
+        long first = strtol(pos, &pos, 10), last = first;
+        if(*pos=='-')
+            last = strtol(pos+1, &pos, 10);
+        for(; first<=last; first++)
+            CPU_SET(first, set);
+        if(*pos==',')
+            pos++;
+        else
+            break;
+    }
+    return CPU_COUNT(set)==0;
+}
+
+static
+void pin(int node)
+{
+    if(pthread_setaffinity_np(pthread_self(), sizeof(nodecpus[node]), &nodecpus[node]))
+        fprintf(stderr, "# can't pin to node %d\n", node);
+}
+
+static
+void benchTask(void *raw)
+{
+    benchthread *T = raw;
+    size_t n;
+
+    pin(T->node);
+    for(n=0; !epicsAtomicGetIntT(&stop); n++) {
+        dbxLock *L = dbxLockOne(&T->refs[n%T->nsets], 0);
+        dbxUnlockOne(L);
+    }
+    T->nops = n;
+    epicsEventSignal(T->done);
+}
+
+/* Returns ops/sec. of each node in rate[] */
+static
+void runPhase(dbxLockRef *refs, size_t nsets, size_t nthreads,
+              double runtime, double *rate)
+{
+    benchthread *T = calloc(dbxnumanodes*nthreads, sizeof(*T));
+    size_t i;
+    int node;
+
+    assert(T);
+    epicsAtomicSetIntT(&stop, 0);
+    for(i=0; i<dbxnumanodes*nthreads; i++) {
+        T[i].node = i/nthreads;
+        T[i].refs = &refs[T[i].node*nsets];
+        T[i].nsets = nsets;
+        T[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("bench", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &benchTask, &T[i]);
+    }
+    epicsThreadSleep(runtime);
+    epicsAtomicSetIntT(&stop, 1);
+
+    for(node=0; node<dbxnumanodes; node++)
+        rate[node] = 0.0;
+    for(i=0; i<dbxnumanodes*nthreads; i++) {
+        epicsEventMustWait(T[i].done);
+        epicsEventDestroy(T[i].done);
+        rate[T[i].node] += T[i].nops/runtime;
+    }
+    free(T);
+}
+
+/* join and split each with a spare ref */
+static
+void rejoin(dbxLockRef *refs, size_t nrefs)
+{
+    dbxLockRef spare, *pair[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+    size_t i;
+
+    memset(&spare, 0, sizeof(spare));
+    dbxLockRefInit(&spare, 0);
+    pair[1] = &spare;
+    for(i=0; i<nrefs; i++) {
+        pair[0] = &refs[i];
+        locker = dbxLockerAlloc(pair, 2, 0);
+        dbxLockMany(locker, 0);
+        link = dbxLockRefJoin(locker, &refs[i], &spare);
+        dbxUnlockMany(locker);
+        dbxLockMany(locker, 0);
+        dbxLockRefSplit(locker, link);
+        dbxUnlockMany(locker);
+        dbxLockerFree(locker);
+    }
+    dbxLockRefClean(&spare);
+}
+
+static
+void printPoint(const char *mode, const char *phase, dbxLockRef *refs,
+                size_t nsets, const double *rate)
+{
+    size_t i, nlocal = 0;
+    int node;
+
+    for(i=0; i<dbxnumanodes*nsets; i++)
+        nlocal += refs[i].lock->numanode==(int)(i/nsets);
+
+    printf("%-7s %-7s %6lu/%-6lu", mode, phase, (unsigned long)nlocal,
+           (unsigned long)(dbxnumanodes*nsets));
+    for(node=0; node<dbxnumanodes; node++)
+        printf(" %10.2f", rate[node]*1e-6);
+    printf("\n");
+    fflush(stdout);
+}
+
+MAIN(benchnuma)
+{
+    size_t i, nthreads = envSize("DBXBENCH_THREADS", 2),
+           nsets = envSize("DBXBENCH_SETS", 4);
+    double runtime = 1.0, rate[DBXNUMA_MAXNODES];
+    const char *env = getenv("DBXBENCH_TIME");
+    int mode, node;
+
+    if(env && atof(env)>0)
+        runtime = atof(env);
+
+    if(dbxLockNuma(1)) {
+        printf("# NUMA placement not supported.  Skipping\n");
+        return 0;
+    }
+    if(dbxnumanodes<2) {
+        printf("# Only one NUMA node.  Skipping\n");
+        return 0;
+    }
+    for(node=0; node<dbxnumanodes; node++) {
+        if(readCPUs(node, &nodecpus[node])) {
+            printf("# No CPUs on node %d.  Skipping\n", node);
+            return 0;
+        }
+    }
+    pin(0);
+
+    printf("# %d nodes, %lu threads per node, %.1f sec. per point\n",
+           dbxnumanodes, (unsigned long)nthreads, runtime);
+    printf("# placed is locksets on the node of their threads.  Mops/sec. by node\n");
+    printf("%-7s %-7s %13s", "# mode", "phase", "placed");
+    for(node=0; node<dbxnumanodes; node++)
+        printf(" %9s%d", "node", node);
+    printf("\n");
+
+    for(mode=0; mode<2; mode++) {
+        const char *name = mode ? "numa" : "default";
+        dbxLockRef *refs = calloc(dbxnumanodes*nsets, sizeof(*refs));
+
+        assert(refs);
+        dbxLockNuma(mode);
+        for(i=0; i<dbxnumanodes*nsets; i++)
+            dbxLockRefInit(&refs[i], 0);
+
+        runPhase(refs, nsets, nthreads, runtime, rate);
+        printPoint(name, "before", refs, nsets, rate);
+
+        rejoin(refs, dbxnumanodes*nsets);
+
+        runPhase(refs, nsets, nthreads, runtime, rate);
+        printPoint(name, "after", refs, nsets, rate);
+
+        for(i=0; i<dbxnumanodes*nsets; i++)
+            dbxLockRefClean(&refs[i]);
+        free(refs);
+    }
+    dbxLockNuma(0);
+    return 0;
+}
+
+#else /* __linux__ */
+
+MAIN(benchnuma)
+{
+    printf("# NUMA placement not supported.  Skipping\n");
+    return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,331 @@
+/* Priority inversion benchmark.
+ *
+ * Three SCHED_FIFO threads pinned to one CPU.
+ *
+ * low    - Locks, then busy for $DBXBENCH_HOLD (default 1) ms.
+ * high   - Locks while low holds the lock.  Times how long this takes.
+ * medium - Becomes runnable at the same time as high, and is busy
+ *          for $DBXBENCH_HOG (default 20) ms w/o locking.
+ *
+ * Without priority inheritance, medium preempts low, so high waits
+ * for hold+hog.  With it, low is boosted above medium, and high
+ * waits only for hold.
+ *
+ * Compares epicsMutex with the priority inheriting mutex (see dbxpi.c).
+ * Recent versions of Base may enable priority inheritance in epicsMutex
+ * as well, in which case both should show no inversion.
+ * Needs permission to use SCHED_FIFO (eg. CAP_SYS_NICE).  Skipped otherwise.
+ * The number of trials may be set with $DBXBENCH_TRIALS (default 50).
+ */
+#ifdef __linux__
+#  define _GNU_SOURCE
+#  include <sched.h>
+#endif
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#ifdef DBXLOCK_HAVE_PI
+
+#define NSUB 16
+#define NBUCKET (64*NSUB)
+
+typedef enum {
+    kindMutex,
+    kindPI,
+} lockkind;
+
+static const char* kindNames[] = {"mutex", "pi"};
+
+typedef struct benchdata benchdata;
+
+typedef struct {
+    benchdata *central;
+    int prio;
+    void (*fn)(benchdata *);
+    epicsEventId go, done;
+    int ok;
+} benchthread;
+
+struct benchdata {
+    lockkind kind;
+    epicsMutexId mutex;
+    dbxpi pi;
+
+    epicsUInt64 hold, hog; /* ns */
+    epicsUInt64 waited;
+    int stop;
+
+    benchthread low, medium, high;
+};
+
+static
+epicsUInt64 nowns(void)
+{
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret==0);
+    return ts.tv_sec*(epicsUInt64)1000000000u + ts.tv_nsec;
+}
+
+static
+size_t bucketOf(epicsUInt64 ns)
+{
+    unsigned msb = 0;
+    epicsUInt64 v = ns;
+
+    if(ns<NSUB)
+        return (size_t)ns;
+    while(v>>=1)
+        msb++;
+    return (msb-3)*NSUB + (size_t)((ns>>(msb-4))&(NSUB-1));
+}
+
+static
+epicsUInt64 bucketValue(size_t b)
+{
+    size_t msb = b/NSUB+3, sub = b%NSUB;
+    if(b<NSUB)
+        return b;
+    return ((epicsUInt64)(NSUB+sub))<<(msb-4);
+}
+
+static
+epicsUInt64 percentile(const size_t *hist, size_t total, double frac)
+{
+    size_t b, sum = 0, want = (size_t)(total*frac);
+
+    for(b=0; b<NBUCKET; b++) {
+        sum += hist[b];
+        if(sum>want)
+            return bucketValue(b);
+    }
+    return bucketValue(NBUCKET-1);
+}
+
+/* SCHED_FIFO on CPU 0.  Returns non-zero on failure */
+static
+int makeRT(int prio)
+{
+    struct sched_param param;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        return 1;
+#endif
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = prio;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)!=0;
+}
+
+static
+void busy(epicsUInt64 ns)
+{
+    epicsUInt64 T0 = nowns();
+    while(nowns()-T0 < ns) {}
+}
+
+static
+void benchLock(benchdata *central)
+{
+    if(central->kind==kindMutex)
+        epicsMutexMustLock(central->mutex);
+    else
+        dbxpilock(&central->pi);
+}
+
+static
+void benchUnlock(benchdata *central)
+{
+    if(central->kind==kindMutex)
+        epicsMutexUnlock(central->mutex);
+    else
+        dbxpiunlock(&central->pi);
+}
+
+static
+void lowFn(benchdata *central)
+{
+    benchLock(central);
+    /* release high and medium while holding the lock */
+    epicsEventSignal(central->low.done);
+    busy(central->hold);
+    benchUnlock(central);
+}
+
+static
+void mediumFn(benchdata *central)
+{
+    busy(central->hog);
+}
+
+static
+void highFn(benchdata *central)
+{
+    epicsUInt64 T0 = nowns();
+    benchLock(central);
+    central->waited = nowns()-T0;
+    benchUnlock(central);
+}
+
+static
+void benchTask(void *raw)
+{
+    benchthread *self = raw;
+    benchdata *central = self->central;
+
+    self->ok = makeRT(self->prio)==0;
+    epicsEventSignal(self->done);
+    if(!self->ok)
+        return;
+
+    while(1) {
+        epicsEventMustWait(self->go);
+        if(epicsAtomicGetIntT(&central->stop))
+            break;
+        (*self->fn)(central);
+        if(self!=&central->low)
+            epicsEventSignal(self->done);
+    }
+    epicsEventSignal(self->done);
+}
+
+static
+int startThread(benchdata *central, benchthread *td, int prio,
+                void (*fn)(benchdata *))
+{
+    td->central = central;
+    td->prio = prio;
+    td->fn = fn;
+    td->go = epicsEventMustCreate(epicsEventEmpty);
+    td->done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("benchpi", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &benchTask, td);
+    epicsEventMustWait(td->done);
+    return td->ok;
+}
+
+static
+void stopThread(benchdata *central, benchthread *td)
+{
+    if(!td->go)
+        return; /* not started */
+    if(td->ok) {
+        epicsEventSignal(td->go);
+        epicsEventMustWait(td->done);
+    }
+    epicsEventDestroy(td->go);
+    epicsEventDestroy(td->done);
+}
+
+static
+size_t envSize(const char *name, size_t def)
+{
+    const char *env = getenv(name);
+    if(env && atol(env)>0)
+        return (size_t)atol(env);
+    return def;
+}
+
+/* returns non-zero if SCHED_FIFO is not permitted */
+static
+int runPoint(lockkind kind, size_t ntrials)
+{
+    benchdata data;
+    size_t i, *hist;
+    epicsUInt64 maxw = 0;
+    int ok;
+
+    memset(&data, 0, sizeof(data));
+    data.kind = kind;
+    data.mutex = epicsMutexMustCreate();
+    ok = dbxpiinit(&data.pi)==0;
+    assert(ok);
+    data.hold = envSize("DBXBENCH_HOLD", 1)*1000000u;
+    data.hog = envSize("DBXBENCH_HOG", 20)*1000000u;
+    hist = calloc(NBUCKET, sizeof(*hist));
+    assert(hist);
+
+    /* the driving thread (this one) is highest */
+    ok = makeRT(40)==0;
+    ok = ok && startThread(&data, &data.low, 10, &lowFn);
+    ok = ok && startThread(&data, &data.medium, 20, &mediumFn);
+    ok = ok && startThread(&data, &data.high, 30, &highFn);
+
+    for(i=0; ok && i<ntrials; i++) {
+        epicsEventSignal(data.low.go);
+        epicsEventMustWait(data.low.done); /* low holds lock */
+
+        /* neither runs until we wait */
+        epicsEventSignal(data.high.go);
+        epicsEventSignal(data.medium.go);
+
+        epicsEventMustWait(data.high.done);
+        epicsEventMustWait(data.medium.done);
+
+        hist[bucketOf(data.waited)]++;
+        if(data.waited>maxw)
+            maxw = data.waited;
+    }
+
+    if(ok) {
+        printf("%-6s %6u %9llu %9llu %9llu %9llu\n",
+               kindNames[kind], (unsigned)ntrials,
+               (unsigned long long)percentile(hist, ntrials, 0.5),
+               (unsigned long long)percentile(hist, ntrials, 0.99),
+               (unsigned long long)maxw,
+               (unsigned long long)(data.hold+data.hog));
+        fflush(stdout);
+    }
+
+    epicsAtomicSetIntT(&data.stop, 1);
+    stopThread(&data, &data.high);
+    stopThread(&data, &data.medium);
+    stopThread(&data, &data.low);
+
+    dbxpiclean(&data.pi);
+    epicsMutexDestroy(data.mutex);
+    free(hist);
+    return !ok;
+}
+
+MAIN(benchpi)
+{
+    size_t ntrials = envSize("DBXBENCH_TRIALS", 50);
+    int kind;
+
+    printf("# latency of high priority lock in ns.  inversion when max >= hold+hog\n");
+    printf("%-6s %6s %9s %9s %9s %9s\n",
+           "# lock", "trials", "p50", "p99", "max", "hold+hog");
+
+    for(kind=kindMutex; kind<=kindPI; kind++) {
+        if(runPoint((lockkind)kind, ntrials)) {
+            printf("# SCHED_FIFO not permitted.  Skipping\n");
+            break;
+        }
+    }
+    return 0;
+}
+
+#else /* DBXLOCK_HAVE_PI */
+
+MAIN(benchpi)
+{
+    printf("# Priority inheritance not supported.  Skipping\n");
+    return 0;
+}
+
+#endif /* DBXLOCK_HAVE_PI */
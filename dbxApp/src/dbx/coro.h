@@ -0,0 +1,136 @@
+#ifndef DBX_CORO_H
+#define DBX_CORO_H
+
+/* C++20 coroutine interface to dbxLockManyAsync()
+ *
+ *   dbx::guard G = co_await dbx::lock(A, B);
+ *
+ * The coroutine is suspended w/o blocking a thread until all locks
+ * are available, then resumed on a pool worker with the locks held.
+ * On the shared pool, or that given as dbx::lock(pool, A, B).
+ *
+ * epicsMutex must be unlocked by the thread which locked it.
+ * So the guard must be released (destroyed or unlock()'d) before
+ * the coroutine next suspends.  Otherwise the pool worker asserts once
+ * the coroutine suspends, as it still holds the locks.
+ */
+
+/* <coroutine> may exist while the compiler has coroutines off */
+#if defined(__has_include)
+#  if __has_include(<version>)
+#    include <version>
+#  endif
+#endif
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L \
+    && defined(__cpp_lib_coroutine) && __cpp_lib_coroutine >= 201902L
+#  define DBX_HAVE_CORO
+#endif
+
+#ifdef DBX_HAVE_CORO
+
+#include <coroutine>
+#include <new>
+#include <stdexcept>
+
+#include "dbx/lock.h"
+
+namespace dbx {
+
+/* Holds the locks of a dbxLocker, which is free'd on unlock */
+class guard {
+    dbxLocker *locker;
+public:
+    guard() noexcept :locker(nullptr) {}
+    explicit guard(dbxLocker *locker) noexcept :locker(locker) {}
+    guard(guard&& o) noexcept :locker(o.locker) { o.locker = nullptr; }
+    guard& operator=(guard&& o) noexcept {
+        if(this!=&o) {
+            unlock();
+            locker = o.locker;
+            o.locker = nullptr;
+        }
+        return *this;
+    }
+    guard(const guard&) = delete;
+    guard& operator=(const guard&) = delete;
+    ~guard() { unlock(); }
+
+    void unlock() noexcept {
+        if(locker) {
+            dbxUnlockMany(locker);
+            dbxLockerFree(locker);
+            locker = nullptr;
+        }
+    }
+
+    dbxLocker* get() const noexcept { return locker; }
+    explicit operator bool() const noexcept { return locker; }
+};
+
+class lock_awaiter {
+    dbxLocker *locker;
+    epicsThreadPool *pool;
+
+    static void done(dbxLocker *, void *raw) {
+        /* the awaiter may be destroyed during resume() */
+        std::coroutine_handle<>::from_address(raw).resume();
+    }
+public:
+    lock_awaiter(dbxLocker *locker, epicsThreadPool *pool) noexcept
+        :locker(locker), pool(pool) {}
+    lock_awaiter(lock_awaiter&& o) noexcept :locker(o.locker), pool(o.pool) { o.locker = nullptr; }
+    lock_awaiter(const lock_awaiter&) = delete;
+    lock_awaiter& operator=(const lock_awaiter&) = delete;
+    ~lock_awaiter() {
+        if(locker)
+            dbxLockerFree(locker);
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        /* may resume on another thread before returning */
+        if(dbxLockManyAsync(locker, pool, &done, h.address()))
+            throw std::runtime_error("dbxLockManyAsync() fails");
+    }
+    guard await_resume() noexcept {
+        dbxLocker *L = locker;
+        locker = nullptr;
+        return guard(L);
+    }
+};
+
+inline
+lock_awaiter lockMany(dbxLockRef **refs, size_t nrefs, epicsThreadPool *pool = nullptr)
+{
+    dbxLocker *L = dbxLockerAlloc(refs, nrefs, 0);
+    if(!L)
+        throw std::bad_alloc();
+    return lock_awaiter(L, pool);
+}
+
+template<typename... Refs>
+lock_awaiter lock(epicsThreadPool *pool, dbxLockRef& ref, Refs&... refs)
+{
+    dbxLockRef *arr[] = {&ref, &refs...};
+    return lockMany(arr, sizeof(arr)/sizeof(arr[0]), pool);
+}
+
+/* pool==NULL, the shared pool */
+template<typename... Refs>
+lock_awaiter lock(dbxLockRef& ref, Refs&... refs)
+{
+    return lock(nullptr, ref, refs...);
+}
+
+inline
+lock_awaiter lockOne(dbxLockRef& ref, epicsThreadPool *pool = nullptr)
+{
+    dbxLockRef *arr[] = {&ref};
+    return lockMany(arr, 1, pool);
+}
+
+} // namespace dbx
+
+#endif /* DBX_HAVE_CORO */
+
+#endif /* DBX_CORO_H */
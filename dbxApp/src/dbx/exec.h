@@ -0,0 +1,64 @@
+#ifndef DBX_EXEC_H
+#define DBX_EXEC_H
+
+#include <stddef.h>
+
+#include <ellLib.h>
+
+#include "dbx/lock.h"
+
+/* Lockset affine executor.
+ *
+ * Each task is routed to a worker according to the dbxLock currently
+ * associated with its first ref.  A worker runs the queued tasks for
+ * one lockset as a batch, locking once.  Tasks whose first ref has
+ * moved to another lockset (dbxLockRefJoin()/dbxLockRefSplit())
+ * are routed again.  Idle workers steal batches from busy workers.
+ */
+
+typedef struct dbxExecutor dbxExecutor;
+typedef struct dbxTask dbxTask;
+
+/* Called from a worker with all refs locked */
+typedef void (*dbxTaskFn)(dbxTask *task);
+
+struct dbxTask {
+    /* set by caller before dbxExecutorSubmit() */
+    dbxLockRef **refs;
+    size_t nrefs; /* >=1 */
+    dbxTaskFn fn;
+
+    /* private */
+    ELLNODE node;
+    void *key;
+};
+
+typedef struct {
+    size_t tasks;    /* tasks run */
+    size_t batches;  /* batches run */
+    size_t steals;   /* batches run by a worker other than the routed one */
+    size_t reroutes; /* tasks routed again after a lockset change */
+    size_t slow;     /* tasks whose refs span locksets */
+} dbxExecutorStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* nworkers==0 for one per CPU */
+dbxExecutor* dbxExecutorCreate(unsigned int nworkers, unsigned int flags);
+/* Run all queued tasks, then stop workers */
+void dbxExecutorDestroy(dbxExecutor *ex);
+
+/* Queue a task.  The task must not be modified until it has run */
+int dbxExecutorSubmit(dbxExecutor *ex, dbxTask *task);
+/* Wait until all queued tasks have run */
+void dbxExecutorFlush(dbxExecutor *ex);
+
+void dbxExecutorGetStats(dbxExecutor *ex, dbxExecutorStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBX_EXEC_H */
@@ -2,6 +2,7 @@
 #define DBX_LOCK_H
 
 #include <ellLib.h>
+#include <epicsThreadPool.h>
 
 #if 0
 # include <epicsMutex.h>
@@ -43,18 +44,150 @@ typedef struct dbxLockRef dbxLockRef;
 int dbxLockRefInit(dbxLockRef* pref, unsigned int flags);
 int dbxLockRefClean(dbxLockRef *pref);
 
+/* As dbxLockRefInit() of each.  Cheaper as locks are allocated at once. */
+int dbxLockRefInitMany(dbxLockRef **prefs, size_t nrefs, unsigned int flags);
+/* As dbxLockRefClean() of each, but w/o locking.  Only when no other thread
+ * may lock any of these refs, or any sharing a lockset.  eg. at exit.
+ * Links of these refs are orphaned, as by dbxLockRefClean().
+ */
+int dbxLockRefCleanMany(dbxLockRef **prefs, size_t nrefs);
+
+/* dbxLockerAlloc() flag.  Use, or save, the cached plan for this set of refs.
+ * A plan is the ordered locks of the refs, valid until one of those
+ * locks loses a ref by dbxLockRefJoin(), dbxLockRefSplit() or
+ * dbxLockRefClean().  Then it is re-computed and saved on next use.
+ * For sets of refs locked again and again.  Otherwise only costs.
+ */
+#define DBXLOCKER_PLAN 1
+/* dbxLockerAlloc() flag.  For thousands of refs.  Hold one ref to each
+ * distinct lock instead of one per ref, and after a join or split only
+ * re-read the refs of locks which lost refs.  Uses twice the memory.
+ * DBXLOCKER_PLAN is ignored.
+ */
+#define DBXLOCKER_LARGE 2
+
+/* Free a dbxLocker before cleaning any of its refs */
 dbxLocker * dbxLockerAlloc(dbxLockRef** pref, size_t nlock, unsigned int flags);
 int dbxLockerFree(dbxLocker *ptr);
+/* Discard all cached plans */
+void dbxLockPlanFlush(void);
 
+/* May be nested, or called while a dbxLockMany() of this thread holds R.
+ * Re-entry only increments a count.  Unlock in any order.
+ */
 dbxLock* dbxLockOne(dbxLockRef *R, unsigned int flags);
 int dbxUnlockOne(dbxLock* L);
 
+/* Retries if refs are moved meanwhile by a join or split.
+ * After $DBX_RETRY_ESCALATE (default 4) retries, locks held are kept,
+ * which blocks join and split of those locksets.
+ */
 int dbxLockMany(dbxLocker *ptr, unsigned int flags);
 int dbxUnlockMany(dbxLocker *ptr);
 
+/* While dbxLockMany() holds ptr, add and lock nref more refs.
+ * Locks already held stay held, except for those ordered after a busy
+ * new lock which must be released and re-locked.
+ * Such re-locks are counted as dbxMetricExtendRelock.
+ * Returns non-zero on allocation failure, when nothing is added.
+ */
+int dbxLockerExtend(dbxLocker *ptr, dbxLockRef **pref, size_t nref, unsigned int flags);
+
+/* Called from a pool worker with all locks held.
+ * Must call dbxUnlockMany() before returning.
+ * The dbxLocker may then be re-submitted or free'd.
+ */
+typedef void (*dbxLockCallback)(dbxLocker *ptr, void *arg);
+
+/* Queue a request to lock all refs of ptr, then call cb.
+ * Waits for locks without blocking a thread.  pool==NULL uses the shared pool.
+ */
+int dbxLockManyAsync(dbxLocker *ptr, epicsThreadPool *pool,
+                     dbxLockCallback cb, void *arg);
+
+/* Run fn with the lock of ref held.  Either by this thread, or by
+ * whichever thread holds the lock when it next unlocks.
+ * Returns after fn has run.
+ * fn may be called from within any unlock of the lock.
+ */
+typedef void (*dbxDelegateFn)(dbxLockRef *ref, void *arg);
+int dbxLockDelegate(dbxLockRef *ref, dbxDelegateFn fn, void *arg);
+
+/* Enable (or disable) biased locking.
+ * A lock may then be re-locked by the last thread to call dbxLockOne()
+ * w/o atomic operations, until another thread locks it.
+ * Returns non-zero if not supported.  Also enabled by $DBX_BIAS=1
+ */
+int dbxLockBias(int enable);
+
+/* Enable (or disable) NUMA placement of locks.
+ * New locks are placed on the node of the allocating thread.
+ * Join and split then move a lock to the node whose threads mostly
+ * hold it, found by sampling.  Counted as dbxMetricNumaMigrate.
+ * Returns non-zero if not supported.  Also enabled by $DBX_NUMA=1
+ */
+int dbxLockNuma(int enable);
+
+/* Optimistic reads w/o locking.
+ *
+ * With the lock of R held, call dbxLockMarkWrite() before changing data
+ * which is read this way.  The write ends when the lock is released,
+ * by the last dbxUnlockOne() or by dbxUnlockMany().
+ *
+ * A reader copies the data between dbxLockReadBegin() and
+ * dbxLockReadValidate(), and must copy again, or lock, if validate
+ * returns non-zero.  This happens if a write was in progress, or since
+ * begin, or if R moved to another lockset.  Readers write no shared state.
+ * Copies may be torn, so must not be used until validated.
+ */
+struct dbxLockSeq {
+    /* the fields of dbxLockSeq are not considered a public API */
+    dbxLock *lock;
+    size_t seq, gen;
+};
+typedef struct dbxLockSeq dbxLockSeq;
+
+void dbxLockMarkWrite(dbxLockRef *R);
+void dbxLockReadBegin(dbxLockRef *R, dbxLockSeq *S);
+int dbxLockReadValidate(dbxLockRef *R, const dbxLockSeq *S);
+
+/* Condition variable for state guarded by the lock of ref.
+ * Waiters follow ref if its lockset is joined or split meanwhile.
+ */
+struct dbxLockCond {
+    /* the fields of dbxLockCond are not considered a public API */
+    dbxLockRef *ref;
+    ELLLIST waiters; /* guarded by the lock of ref */
+};
+typedef struct dbxLockCond dbxLockCond;
+
+int dbxLockCondInit(dbxLockCond *C, dbxLockRef *ref);
+/* Must have no waiters */
+int dbxLockCondClean(dbxLockCond *C);
+/* *pL is the lock of C->ref, held once through dbxLockOne().
+ * Unlock and wait until signaled, or for timeout seconds if >=0.
+ * Then lock C->ref again, and store the lock, which may differ, in *pL.
+ * Returns 0 if signaled, or 1 on timeout.  Check the condition either way.
+ */
+int dbxLockCondWait(dbxLockCond *C, dbxLock **pL, double timeout);
+/* With the lock of C->ref held.  Move one, or all, waiters to the wait
+ * queue of the lock, to be woken one at a time as it is unlocked.
+ * Returns the number moved.
+ */
+int dbxLockCondSignal(dbxLockCond *C);
+int dbxLockCondBroadcast(dbxLockCond *C);
+
 dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B);
 int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R);
 
+/* Update the refs[] cache of each dbxLocker not in use, releasing
+ * locks emptied by dbxLockRefJoin() or dbxLockRefClean() which it
+ * would otherwise keep until next locked, or free'd.
+ * Returns the number of entries updated.
+ * Call periodically, or set $DBX_SWEEP to a period in seconds.
+ */
+size_t dbxLockSweep(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+#ifndef DBX_METRICS_H
+#define DBX_METRICS_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+/* Lock statistics published in a memory mapped file.
+ *
+ * The file is a dbxMetricsHeader followed by nslots slots starting at
+ * offset headsize, and slotsize bytes apart.  Each slot is ncounters
+ * counters followed by nhist histogram buckets, each wordsize bytes.
+ * Writers update the slot of the CPU they run on w/o locking.
+ * A reader sums each counter over all slots, modulo 2^(8*wordsize).
+ * Gauges are stored as increments and decrements, so only the sum
+ * is meaningful.
+ *
+ * New counters are only appended.  Readers must use ncounters from
+ * the header, and treat unknown counters as zero.
+ */
+
+#define DBXMETRICS_MAGIC "DBXMETRC"
+#define DBXMETRICS_VERSION 1
+
+typedef struct {
+    char magic[8];
+    epicsUInt32 version;
+    epicsUInt32 wordsize;
+    epicsUInt32 nslots;
+    epicsUInt32 slotsize;
+    epicsUInt32 headsize;
+    epicsUInt32 ncounters;
+    epicsUInt32 nhist;
+    epicsUInt32 pad;
+} dbxMetricsHeader;
+
+typedef enum {
+    dbxMetricAcquire,    /* dbxLock acquisitions */
+    dbxMetricContended,  /* ... which had to wait */
+    dbxMetricRetry,      /* dbxLockOne()/dbxLockMany() collided with recompute */
+    dbxMetricJoin,       /* dbxLockRefJoin() calls */
+    dbxMetricSplit,      /* dbxLockRefSplit() calls */
+    dbxMetricMerge,      /* joins which merged two locksets */
+    dbxMetricDivide,     /* splits which divided a lockset */
+    dbxMetricLocks,      /* gauge, live dbxLock */
+    dbxMetricRefs,       /* gauge, live dbxLockRef */
+    dbxMetricLinks,      /* gauge, live dbxLockLink */
+    dbxMetricDelegate,   /* dbxLockDelegate() closures run by another thread */
+    dbxMetricCombine,    /* passes over pending closures */
+    dbxMetricBiasHit,    /* dbxLockOne() w/o mutex.  See dbxLockBias() */
+    dbxMetricBiasRevoke, /* biased locks taken by another thread */
+    dbxMetricExtendBackoff, /* dbxLockerExtend() out of order try-locks which failed */
+    dbxMetricExtendRelock,  /* ... then released locks ordered after, and re-locked */
+    dbxMetricInflate,    /* dbxLock mutexes created on first contention */
+    dbxMetricStale,      /* gauge, dbxLock w/o refs, but not yet free'd */
+    dbxMetricSweep,      /* dbxLocker cache entries updated by dbxLockSweep() */
+    dbxMetricPlanHit,    /* dbxLockerAlloc() w/ a valid plan.  See DBXLOCKER_PLAN */
+    dbxMetricPlanMiss,   /* ... w/o */
+    dbxMetricRetryBackoff, /* dbxLockMany() retries which yielded first */
+    dbxMetricEscalate,   /* dbxLockMany() which then kept held locks.  See dbxRetryEscalate */
+    dbxMetricCondMorph,  /* waiters moved to a lock wait queue by dbxLockCondSignal() */
+    dbxMetricNumaMigrate, /* locks moved to the node which mostly holds them.  See dbxLockNuma() */
+    dbxMetricMax
+} dbxMetric;
+
+/* Histogram bucket i is the number of locksets with [2^i, 2^(i+1)) refs */
+#define DBXMETRICS_NHIST 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Begin publishing to the named file.  Replaces any existing file.
+ * May only be called once.  Gauges and the histogram only count
+ * changes made after this call, so call before any dbxLockRefInit().
+ * Also started on first use of the library if $DBX_METRICS names a file.
+ */
+int dbxLockMetricsOpen(const char *fname);
+
+/* Sum slots of a metrics file mapped at base.
+ * counters[dbxMetricMax] and hist[DBXMETRICS_NHIST] are filled in.
+ * Returns non-zero if base does not look like a metrics file.
+ */
+int dbxLockMetricsSum(const void *base, size_t len,
+                      epicsUInt64 *counters, epicsUInt64 *hist);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBX_METRICS_H */
@@ -0,0 +1,64 @@
+#ifndef DBX_SNAPSHOT_H
+#define DBX_SNAPSHOT_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+#include "dbx/lock.h"
+
+/* Lockset partition snapshot.
+ *
+ * The partition of a set of refs computed by dbxLockRefJoin() of a list
+ * of links is the same each time.  It may be saved once, then loaded
+ * in place of the joins while the refs and links are unchanged.
+ *
+ * Refs are identified by index.  Each link is a pair of ref indices.
+ * A snapshot file is a dbxSnapshotHeader, followed by nrefs component
+ * numbers, followed by nlinks pairs of ref indices.  Components are
+ * numbered in order of their lowest ref index.
+ * All fields are epicsUInt32 in host byte order, except as noted.
+ */
+
+#define DBXSNAPSHOT_MAGIC "DBXSNAPS"
+#define DBXSNAPSHOT_VERSION 1
+
+typedef struct {
+    char magic[8];
+    epicsUInt32 version;
+    epicsUInt32 nrefs;
+    epicsUInt32 nlinks;
+    epicsUInt32 ncomps;
+    epicsUInt64 hash; /* dbxLockSnapshotHash(), then each component number */
+} dbxSnapshotHeader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* FNV-1a of nrefs and each link */
+epicsUInt64 dbxLockSnapshotHash(size_t nrefs, const size_t *linkA,
+                                const size_t *linkB, size_t nlinks);
+
+/* Save the partition of refs[nrefs], after dbxLockRefJoin() of each link.
+ * Returns non-zero if the file can't be written, or if the refs
+ * do not match the links.
+ */
+int dbxLockSnapshotSave(const char *fname, dbxLockRef **refs, size_t nrefs,
+                        const size_t *linkA, const size_t *linkB, size_t nlinks);
+
+/* In place of dbxLockRefInit() of each of refs[nrefs], then dbxLockRefJoin()
+ * of each link.  Sets links[nlinks] as dbxLockRefJoin() would, so NULL
+ * if allocation fails.
+ * Returns non-zero, w/o touching refs, if the file can't be read, or was
+ * saved with other refs or links.  The caller should then init and join.
+ */
+int dbxLockSnapshotLoad(const char *fname, dbxLockRef **refs, size_t nrefs,
+                        const size_t *linkA, const size_t *linkB, size_t nlinks,
+                        dbxLockLink **links);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBX_SNAPSHOT_H */
@@ -0,0 +1,56 @@
+#ifndef DBX_TRACE_H
+#define DBX_TRACE_H
+
+#include <epicsTypes.h>
+
+/* Binary lock event trace.
+ *
+ * A trace file is a dbxTraceHeader followed by any number of dbxTraceRecord.
+ * Records from different threads are interleaved in no particular order.
+ * All fields are in host byte order.
+ */
+
+#define DBXTRACE_MAGIC "DBXTRACE"
+#define DBXTRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    epicsUInt32 version;
+    epicsUInt32 recsize; /* sizeof(dbxTraceRecord) */
+} dbxTraceHeader;
+
+typedef enum {
+    dbxTraceLockOne = 1,  /* dbxLockOne() until dbxUnlockOne() */
+    dbxTraceLockMany = 2, /* dbxLockMany() until dbxUnlockMany().  One record per ref */
+    dbxTraceJoin = 3,     /* dbxLockRefJoin() of ref and ref2 */
+    dbxTraceSplit = 4,    /* dbxLockRefSplit() of the link between ref and ref2 */
+} dbxTraceOp;
+
+typedef struct {
+    epicsUInt16 op;     /* dbxTraceOp */
+    epicsUInt16 thread; /* from 0 in each trace, in order of the first event from each thread */
+    epicsUInt32 index;  /* [0, count) */
+    epicsUInt32 count;  /* # of locker entries in this operation.  Unused (NULL) entries are not recorded */
+    epicsUInt32 pad;
+    epicsUInt64 ref;    /* dbxLockRef id (address) */
+    epicsUInt64 ref2;
+    epicsUInt64 lock;   /* dbxLock id (address) */
+    epicsUInt64 time;   /* start of operation.  ns from arbitrary epoch */
+    epicsUInt64 wait;   /* ns spent waiting for locks */
+    epicsUInt64 hold;   /* ns locks were held, or duration of join/split */
+} dbxTraceRecord;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Begin recording to the named file.  Replaces any existing file. */
+int dbxLockTraceStart(const char *fname);
+/* Stop recording, flush, and close the trace file */
+int dbxLockTraceStop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBX_TRACE_H */
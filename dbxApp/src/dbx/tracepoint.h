@@ -0,0 +1,51 @@
+#ifndef DBX_TRACEPOINT_H
+#define DBX_TRACEPOINT_H
+
+#include <stddef.h>
+
+/* Tracepoints on the lock hot paths.
+ *
+ * These are compiled out unless dbxlock.c is built with -DDBXLOCK_TRACEPOINTS.
+ * Then each tracepoint increments a counter and calls the callback
+ * registered for it, if any.
+ * With -DDBXLOCK_TRACEPOINTS -DDBXLOCK_USDT they are instead
+ * USDT probes (provider "dbxlock", named as below w/o the dbxTP prefix)
+ * which require <sys/sdt.h>.
+ *
+ * Tracepoint arguments (A, B)
+ */
+typedef enum {
+    dbxTPLockOneContended,   /* (dbxLockRef*, dbxLock*) dbxLockOne() must wait */
+    dbxTPLockOneRetry,       /* (dbxLockRef*, dbxLock*) dbxLockOne() collided with recompute */
+    dbxTPLockManyContended,  /* (dbxLocker*, dbxLock*) dbxLockMany() must wait */
+    dbxTPLockManyRetry,      /* (dbxLocker*, NULL) dbxLockMany() collided with recompute */
+    dbxTPUnlockMany,         /* (dbxLocker*, NULL) */
+    dbxTPJoin,               /* (dbxLockRef*, dbxLockRef*) */
+    dbxTPJoinMerge,          /* (dbxLock*, dbxLock*) Join merges second lock into first */
+    dbxTPSplit,              /* (dbxLockRef*, dbxLockRef*) */
+    dbxTPSplitNew,           /* (dbxLock*, dbxLock*) Split moves refs from first into new second */
+    dbxTPUpdateRecompute,    /* (dbxLocker*, NULL) dbxLocker cache must be checked */
+    dbxTPUpdateChanged,      /* (dbxLocker*, NULL) dbxLocker cache was stale */
+    dbxTPExtendRelock,       /* (dbxLocker*, dbxLock*) dbxLockerExtend() must release locks after */
+    dbxTPLockManyEscalate,   /* (dbxLocker*, NULL) dbxLockMany() keeps held locks on retry */
+    dbxTPMax
+} dbxTracePoint;
+
+typedef void (*dbxTracePointFn)(dbxTracePoint point, const void *A, const void *B);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set (or clear w/ NULL) the callback for a tracepoint.
+ * Returns non-zero if tracepoint callbacks were not compiled in.
+ */
+int dbxLockTracePointSet(dbxTracePoint point, dbxTracePointFn fn);
+/* Number of times a tracepoint has been hit.  Always zero if not compiled in. */
+size_t dbxLockTracePointCount(dbxTracePoint point);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBX_TRACEPOINT_H */
@@ -0,0 +1,367 @@
+
+#include <stdlib.h>
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsThreadPool.h>
+#include <epicsAssert.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+
+/* dbxLock wait queues are guarded by one of a fixed set of mutexes
+ * chosen by lock address.  These are never held while locking a dbxLock.
+ */
+#define NWAITLOCKS 64
+
+static epicsMutexId waitlocks[NWAITLOCKS];
+
+static epicsThreadOnceId asynconce = EPICS_THREAD_ONCE_INIT;
+
+static epicsThreadPool *sharedpool;
+
+static void dbxasynconce(void *x)
+{
+    size_t i;
+    for(i=0; i<NELEMENTS(waitlocks); i++)
+        waitlocks[i] = epicsMutexMustCreate();
+}
+
+static
+epicsMutexId dbxlockwaitlock(dbxLock *L)
+{
+    size_t idx = (size_t)L/sizeof(*L);
+    return waitlocks[idx%NWAITLOCKS];
+}
+
+/* with wlock of L held */
+static
+void dbxlockqueue(dbxLock *L, dbxlockwaiter *W)
+{
+    dbxlockext *X;
+
+    assert(!W->queued);
+    /* queued waiters hold a ref, so L outlives its wait queue */
+    dbxlockref(L);
+    X = dbxlockextget(L);
+    if(W->woken)
+        ellInsert(&X->waiters, NULL, &W->node); /* lost a race after a wake */
+    else
+        ellAdd(&X->waiters, &W->node);
+    epicsAtomicSetPtrT((EpicsAtomicPtrT*)&W->queued, L);
+    epicsAtomicIncrIntT(&X->nwaiters);
+}
+
+/* with wlock of W->queued held */
+static
+dbxLock* dbxlockunqueue(dbxlockwaiter *W)
+{
+    dbxLock *L = W->queued;
+    dbxlockext *X = DBXLOCK_EXT(L);
+
+    ellDelete(&X->waiters, &W->node);
+    epicsAtomicSetPtrT((EpicsAtomicPtrT*)&W->queued, NULL);
+    epicsAtomicDecrIntT(&X->nwaiters);
+    return L;
+}
+
+int dbxlockwait(dbxLock *L, dbxlockwaiter *W)
+{
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+
+    dbxlockenqueue(L, W);
+
+    /* The holder may have unlocked before seeing us in the queue.
+     * So try again now that we are visible.
+     */
+    if(!dbxlocktrylock(L))
+        return 1;
+
+    dbxlockdequeue(W);
+    return 0;
+}
+
+void dbxlockenqueue(dbxLock *L, dbxlockwaiter *W)
+{
+    epicsMutexId wlock;
+
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+    wlock = dbxlockwaitlock(L);
+
+    epicsMutexMustLock(wlock);
+    dbxlockqueue(L, W);
+    epicsMutexUnlock(wlock);
+}
+
+int dbxlockdequeue(dbxlockwaiter *W)
+{
+    dbxLock *L;
+
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+
+    /* W->queued changes only with the wlock of the old lock held */
+    while((L = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&W->queued))!=NULL) {
+        epicsMutexId wlock = dbxlockwaitlock(L);
+        int found;
+
+        epicsMutexMustLock(wlock);
+        found = W->queued==L;
+        if(found)
+            dbxlockunqueue(W);
+        epicsMutexUnlock(wlock);
+
+        if(found) {
+            /* not the last ref.  The caller holds, or refs, the lock of W */
+            dbxlockunref(L);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* wake the first waiter, or all */
+static
+void dbxlockwake(dbxLock *L, int all)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+    epicsMutexId wlock;
+    ELLNODE *cur;
+    int n = 0;
+
+    if(!X)
+        return; /* never had waiters */
+
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+    wlock = dbxlockwaitlock(L);
+
+    epicsMutexMustLock(wlock);
+    while((cur = ellFirst(&X->waiters))!=NULL) {
+        dbxlockwaiter *W = CONTAINER(cur, dbxlockwaiter, node);
+        dbxlockunqueue(W);
+        W->woken = 1;
+        (*W->wake)(W);
+        n++;
+        if(!all)
+            break;
+    }
+    epicsMutexUnlock(wlock);
+
+    /* refs of the waiters.  L is not held, so may be free'd */
+    while(n--)
+        dbxlockunref(L);
+}
+
+void dbxlockwakeone(dbxLock *L)
+{
+    dbxlockwake(L, 0);
+}
+
+void dbxlockwakeall(dbxLock *L)
+{
+    dbxlockwake(L, 1);
+}
+
+void dbxlockmovewaiters(dbxLock *dst, dbxLock *src)
+{
+    dbxlockext *Xdst, *Xsrc = DBXLOCK_EXT(src);
+    epicsMutexId wdst, wsrc;
+    ELLNODE *cur;
+    int n;
+
+    if(!Xsrc)
+        return; /* never had waiters */
+    Xdst = dbxlockextget(dst);
+
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+    wdst = dbxlockwaitlock(dst);
+    wsrc = dbxlockwaitlock(src);
+
+    /* in a fixed order, as the waitlocks of other pairs may be taken */
+    if(wdst < wsrc) {
+        epicsMutexMustLock(wdst);
+        epicsMutexMustLock(wsrc);
+    } else {
+        epicsMutexMustLock(wsrc);
+        if(wsrc!=wdst)
+            epicsMutexMustLock(wdst);
+    }
+
+    n = ellCount(&Xsrc->waiters);
+    ELL_FOREACH(&Xsrc->waiters, cur) {
+        dbxlockwaiter *W = CONTAINER(cur, dbxlockwaiter, node);
+        epicsAtomicSetPtrT((EpicsAtomicPtrT*)&W->queued, dst);
+    }
+    ellConcat(&Xdst->waiters, &Xsrc->waiters);
+    epicsAtomicAddIntT(&Xdst->nwaiters, n);
+    epicsAtomicAddIntT(&Xsrc->nwaiters, -n);
+    /* the refs of the waiters move too.  The caller still refs src */
+    epicsAtomicAddIntT(&dst->refcnt, n);
+    epicsAtomicAddIntT(&src->refcnt, -n);
+    assert(epicsAtomicGetIntT(&src->refcnt)>0);
+
+    if(wsrc!=wdst)
+        epicsMutexUnlock(wsrc);
+    epicsMutexUnlock(wdst);
+}
+
+static
+void dbxasyncqueue(dbxLocker *ptr)
+{
+    if(epicsAtomicIncrIntT(&ptr->apending)==1) {
+        int err = epicsJobQueue(ptr->ajob);
+        assert(!err);
+    }
+}
+
+static
+void dbxasyncwake(dbxlockwaiter *W)
+{
+    dbxasyncqueue(CONTAINER(W, dbxLocker, await));
+}
+
+static
+void dbxasynctake(dbxLocker *ptr, dbxLock *L)
+{
+    assert(L->owner==NULL);
+    L->owner = ptr;
+    ellAdd(&ptr->locked, &L->lockedNode);
+    DBXMETRIC_ADD(Acquire, 1);
+}
+
+/* Try to lock all.  Returns 0 if locked,
+ * or 1 if nothing is locked and ptr->await is queued.
+ */
+static
+int dbxasynctry(dbxLocker *ptr)
+{
+    size_t i, nlock = ptr->maxrefs;
+    dbxLock *plock;
+
+    dbxlockerenter(ptr);
+retry:
+    dbxupdaterefs(ptr, 1);
+
+    for(i=0, plock=NULL; i<nlock; i++) {
+        dbx_locker_ref *ref = &ptr->refs[i];
+
+        /* skip NULLs and duplicates */
+        if(!ref->lock || (i!=0 && ref->lock==plock))
+            continue;
+        plock = ref->lock;
+
+        /* already locked after waiting */
+        if(plock->owner==ptr)
+            continue;
+
+        if(dbxlocktrylock(plock)) {
+            dbxasynctake(ptr, plock);
+            continue;
+        }
+
+        /* Never wait while holding locks, so order doesn't matter */
+        DBXTP(LockManyContended, ptr, plock);
+        DBXMETRIC_ADD(Contended, 1);
+        dbxunlockmany(ptr);
+
+        if(dbxlockwait(plock, &ptr->await)) {
+            dbxlockerexit(ptr);
+            return 1;
+        }
+
+        /* plock is locked out of order.  Try the others again */
+        dbxasynctake(ptr, plock);
+        i = (size_t)-1;
+        plock = NULL;
+    }
+
+    if(dbxupdaterefs(ptr,0)) {
+        /* oops, collided with recompute */
+        DBXTP(LockManyRetry, ptr, NULL);
+        DBXMETRIC_ADD(Retry, 1);
+        dbxunlockmany(ptr);
+        goto retry;
+    }
+    ptr->await.woken = 0;
+    dbxlockerexit(ptr);
+    return 0;
+}
+
+/* # of locks checked after a callback */
+#define DBXASYNC_NCHECK 16
+
+static
+void dbxasyncrun(void *arg, epicsJobMode mode)
+{
+    dbxLocker *ptr = arg;
+
+    if(mode==epicsJobModeCleanup)
+        return;
+
+    do {
+        if(dbxasynctry(ptr)==0) {
+            dbxLock *held[DBXASYNC_NCHECK];
+            epicsThreadId self = epicsThreadGetIdSelf();
+            ELLNODE *cur;
+            size_t i, n = 0;
+
+            for(cur = ellFirst(&ptr->locked); cur && n<DBXASYNC_NCHECK; cur = ellNext(cur))
+                held[n++] = CONTAINER(cur, dbxLock, lockedNode);
+
+            /* no longer queued, so no more wakeups */
+            epicsAtomicSetIntT(&ptr->apending, 0);
+            (*ptr->acb)(ptr, ptr->aarg);
+            /* ptr may have been free'd, but lock memory never is.
+             * A lock still held by this worker would be silently
+             * re-entered by the next job it runs.  eg. a dbx::guard
+             * kept across a co_await.
+             */
+            for(i=0; i<n; i++)
+                assert(held[i]->holder!=self);
+            return;
+        }
+        /* waiting.  Try again if woken meanwhile */
+    } while(epicsAtomicDecrIntT(&ptr->apending)>0);
+}
+
+/************ public api ***********/
+
+int dbxLockManyAsync(dbxLocker *ptr, epicsThreadPool *pool,
+                     dbxLockCallback cb, void *arg)
+{
+    epicsThreadOnce(&asynconce, &dbxasynconce, NULL);
+    assert(ellCount(&ptr->locked)==0);
+    assert(epicsAtomicGetIntT(&ptr->apending)==0);
+
+    if(!pool) {
+        if(!epicsAtomicGetPtrT((EpicsAtomicPtrT*)&sharedpool)) {
+            epicsThreadPoolConfig conf;
+            epicsThreadPool *shared;
+
+            epicsThreadPoolConfigDefaults(&conf);
+            shared = epicsThreadPoolGetShared(&conf);
+            if(!shared)
+                return 1;
+            if(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&sharedpool, NULL, shared)!=NULL)
+                epicsThreadPoolReleaseShared(shared);
+        }
+        pool = sharedpool;
+    }
+
+    if(!ptr->ajob) {
+        ptr->ajob = epicsJobCreate(pool, &dbxasyncrun, ptr);
+        if(!ptr->ajob)
+            return 1;
+    } else if(ptr->apool!=pool && epicsJobMove(ptr->ajob, pool)) {
+        return 1;
+    }
+    ptr->apool = pool;
+
+    ptr->acb = cb;
+    ptr->aarg = arg;
+    ptr->await.wake = &dbxasyncwake;
+    ptr->await.woken = 0;
+
+    dbxasyncqueue(ptr);
+    return 0;
+}
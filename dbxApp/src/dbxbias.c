@@ -0,0 +1,214 @@
+#ifdef __linux__
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  include <linux/membarrier.h>
+#  ifdef __NR_membarrier
+#    define HAVE_MEMBARRIER
+#    include <pthread.h>
+#  endif
+#endif
+
+#include <stdlib.h>
+
+#include <errlog.h>
+#include <cantProceed.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+/* Biased locking.
+ *
+ * A dbxLock may be biased to the thread which last locked it with
+ * dbxLockOne().  That thread may then lock and unlock it w/o the mutex,
+ * ref spinlock, or refcnt, by listing the lock in its dbxbiasowner
+ * with plain stores, then checking that the bias has not been revoked.
+ *
+ * Any other thread must first revoke the bias.  It sets revoke,
+ * then issues a process wide memory barrier (membarrier()), which orders
+ * the owner's stores before its loads, then checks whether the owner
+ * lists L.  So either the owner sees the revocation, or the revoker sees
+ * that the owner holds L and waits for it to unlock.
+ *
+ * The mutex is never held while waiting, as the owner may itself be
+ * waiting for the mutex.  A mutex holder must re-check the bias as
+ * a lock is only re-biased with the mutex held.
+ *
+ * The bias state is kept in the ext of a lock (see dbxlockextget()).
+ * After DBXBIAS_MAXREVOKE revocations a lock is no longer biased.
+ * dbxLock memory is never free'd (see dbxlockalloc()), nor is the ext
+ * of a lock once biased, as the owner may read the bias of a stale lock.
+ */
+
+#define DBXBIAS_MAXREVOKE 4
+
+int dbxbiasactive;
+
+static epicsThreadOnceId biasonce = EPICS_THREAD_ONCE_INIT;
+/* per-thread dbxbiasowner.  Never free'd, as a revoker may still look
+ * at it.  Re-used by another thread once its thread exits.
+ */
+static epicsThreadPrivateId biaskey;
+static int biasok;
+
+static epicsMutexId biasfreelock;
+static dbxbiasowner *biasfree; /* Guarded by biasfreelock */
+
+#ifdef HAVE_MEMBARRIER
+/* epicsThreadPrivate has no cleanup, so only to be told of thread exit */
+static pthread_key_t biasexitkey;
+static int biasexitok;
+
+/* Locks still biased to B are then biased to the next thread to use B.
+ * Which others revoke as with any bias.
+ */
+static
+void dbxbiasthreadexit(void *raw)
+{
+    dbxbiasowner *B = raw;
+    size_t i;
+
+    for(i=0; i<DBXBIAS_NHELD; i++) {
+        if(B->held[i])
+            return; /* exited while holding.  Never re-used */
+    }
+    epicsMutexMustLock(biasfreelock);
+    B->next = biasfree;
+    biasfree = B;
+    epicsMutexUnlock(biasfreelock);
+}
+#endif
+
+static void dbxbiasonce(void *x)
+{
+    biaskey = epicsThreadPrivateCreate();
+    biasfreelock = epicsMutexMustCreate();
+#ifdef HAVE_MEMBARRIER
+    biasok = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)==0;
+    biasexitok = pthread_key_create(&biasexitkey, &dbxbiasthreadexit)==0;
+#endif
+}
+
+/* full barrier on all threads of this process */
+static
+void dbxbiasfence(void)
+{
+#ifdef HAVE_MEMBARRIER
+    long ret = syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    assert(ret==0);
+#endif
+}
+
+/* only after dbxLockBias() */
+dbxbiasowner* dbxbiasself(void)
+{
+    dbxbiasowner *B = epicsThreadPrivateGet(biaskey);
+    if(!B) {
+        epicsMutexMustLock(biasfreelock);
+        if((B = biasfree)!=NULL)
+            biasfree = B->next;
+        epicsMutexUnlock(biasfreelock);
+
+        if(B)
+            B->next = NULL;
+        else
+            B = callocMustSucceed(1, sizeof(*B), "dbxbiasself");
+        epicsThreadPrivateSet(biaskey, B);
+#ifdef HAVE_MEMBARRIER
+        if(biasexitok)
+            pthread_setspecific(biasexitkey, B);
+#endif
+    }
+    return B;
+}
+
+static
+int dbxbiasholds(dbxbiasowner *B, dbxLock *L)
+{
+    size_t i;
+    for(i=0; i<DBXBIAS_NHELD; i++) {
+        if(B->held[i]==L)
+            return 1;
+    }
+    return 0;
+}
+
+/* Returns 1 if L is not biased to another thread.
+ * Or 0 if the owner holds L.
+ */
+static
+int dbxbiastryrevoke(dbxLock *L, dbxbiasowner *self)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+
+    if(!X)
+        return 1; /* never biased */
+    while(1) {
+        dbxbiasowner *B = X->bias;
+
+        if(!B || B==self)
+            return 1;
+
+        epicsAtomicSetIntT((int*)&X->revoke, 1);
+        dbxbiasfence();
+
+        if(dbxbiasholds(B, L))
+            return 0;
+
+        if(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&X->bias, B, NULL)==B) {
+            epicsAtomicIncrIntT(&X->nrevoke);
+            DBXMETRIC_ADD(BiasRevoke, 1);
+            return 1;
+        }
+    }
+}
+
+void dbxbiaslocked(dbxLock *L)
+{
+    dbxbiasowner *self = dbxbiasself();
+    unsigned n = 0;
+
+    while(!dbxbiastryrevoke(L, self)) {
+        dbxthinunlock(L);
+        /* the owner is in a critical section.  Presumably short. */
+        while(!dbxbiastryrevoke(L, self))
+            epicsThreadSleep(n++<100 ? 0.0 : epicsThreadSleepQuantum());
+        dbxthinlock(L);
+    }
+}
+
+int dbxbiastrylocked(dbxLock *L)
+{
+    if(dbxbiastryrevoke(L, dbxbiasself()))
+        return 1;
+    dbxthinunlock(L);
+    return 0;
+}
+
+void dbxbiasclaim(dbxLock *L)
+{
+    dbxlockext *X = dbxlockextget(L);
+
+    if(X->bias || epicsAtomicGetIntT(&X->nrevoke)>=DBXBIAS_MAXREVOKE)
+        return;
+    X->revoke = 0;
+    /* X is now kept.  See dbxlockbias() */
+    epicsAtomicSetIntT(&L->biased, 1);
+    epicsAtomicWriteMemoryBarrier();
+    X->bias = dbxbiasself();
+}
+
+/************ public api ***********/
+
+int dbxLockBias(int enable)
+{
+    epicsThreadOnce(&biasonce, &dbxbiasonce, NULL);
+    if(enable && !biasok) {
+        errlogPrintf("dbxLockBias: not supported on this target\n");
+        return 1;
+    }
+    epicsAtomicSetIntT(&dbxbiasactive, !!enable);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAssert.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+
+/* Condition variables.  See dbxLockCond
+ *
+ * The waiter list of a dbxLockCond is guarded by whichever lock holds
+ * C->ref.  As ref only moves while both the old and new locks are held,
+ * this is always the lock a waiter re-acquires through C->ref.
+ *
+ * Signal does not wake a waiter, which would only block on the lock
+ * still held by the signaler.  It is instead moved to the wait queue
+ * of the lock (wait morphing), and woken by an unlock.  As each unlock
+ * wakes one, a broadcast wakes waiters one at a time as each in turn
+ * unlocks.
+ *
+ * A waiter takes the lock through C->ref, not the lock it was queued on,
+ * so follows a join or split made meanwhile.
+ */
+
+/* lives on the stack of dbxLockCondWait() */
+typedef struct dbxcondwaiter {
+    dbxlockwaiter W;
+    ELLNODE node;      /* in dbxLockCond::waiters */
+    int signaled;      /* W is, or was, in the wait queue of a lock */
+    epicsEventId wakeup;
+} dbxcondwaiter;
+
+static epicsThreadOnceId condonce = EPICS_THREAD_ONCE_INIT;
+/* per-thread epicsEventId.  Never free'd */
+static epicsThreadPrivateId condkey;
+
+static void dbxcondonce(void *x)
+{
+    condkey = epicsThreadPrivateCreate();
+}
+
+static
+epicsEventId dbxcondevent(void)
+{
+    epicsEventId evt = epicsThreadPrivateGet(condkey);
+    if(!evt) {
+        evt = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadPrivateSet(condkey, evt);
+    }
+    return evt;
+}
+
+static
+void dbxcondwake(dbxlockwaiter *W)
+{
+    epicsEventSignal(CONTAINER(W, dbxcondwaiter, W)->wakeup);
+}
+
+/* move the first waiter to the wait queue of L.  Returns 0 if none */
+static
+int dbxcondmorph(dbxLockCond *C, dbxLock *L)
+{
+    ELLNODE *cur = ellGet(&C->waiters);
+    dbxcondwaiter *cw;
+
+    if(!cur)
+        return 0;
+    cw = CONTAINER(cur, dbxcondwaiter, node);
+
+    cw->signaled = 1;
+    dbxlockenqueue(L, &cw->W);
+    DBXMETRIC_ADD(CondMorph, 1);
+    return 1;
+}
+
+/* # of times this thread holds L.  As mutex holder, or through bias slots */
+static
+int dbxconddepth(dbxLock *L)
+{
+    dbxbiasowner *B;
+    int i, n = 0;
+
+    if(L->holder==epicsThreadGetIdSelf())
+        return L->depth;
+    if(!dbxlockbias(L))
+        return 0;
+    B = dbxbiasself();
+    for(i=0; i<DBXBIAS_NHELD; i++)
+        n += B->held[i]==L;
+    return n;
+}
+
+/************ public api ***********/
+
+int dbxLockCondInit(dbxLockCond *C, dbxLockRef *ref)
+{
+    epicsThreadOnce(&condonce, &dbxcondonce, NULL);
+    assert(ref->lock);
+    C->ref = ref;
+    ellInit(&C->waiters);
+    return 0;
+}
+
+int dbxLockCondClean(dbxLockCond *C)
+{
+    assert(ellCount(&C->waiters)==0);
+    C->ref = NULL;
+    return 0;
+}
+
+int dbxLockCondWait(dbxLockCond *C, dbxLock **pL, double timeout)
+{
+    dbxcondwaiter cw;
+    int timedout = 0;
+
+    assert(*pL==C->ref->lock);
+    /* A re-entered lock would still be held while we sleep,
+     * so no signaler could get in.
+     */
+    assert(dbxconddepth(*pL)==1);
+
+    cw.W.queued = NULL;
+    cw.W.wake = &dbxcondwake;
+    cw.W.woken = 0;
+    cw.signaled = 0;
+    cw.wakeup = dbxcondevent();
+
+    ellAdd(&C->waiters, &cw.node);
+    dbxUnlockOne(*pL);
+
+    if(timeout<0.0)
+        epicsEventMustWait(cw.wakeup);
+    else
+        timedout = epicsEventWaitWithTimeout(cw.wakeup, timeout)==epicsEventWaitTimeout;
+
+    *pL = dbxLockOne(C->ref, 0);
+
+    if(cw.signaled) {
+        /* Once dequeued, or woken, no wake is in progress.
+         * W may since have moved to the wait queue of another lock by a join.
+         */
+        if(!dbxlockdequeue(&cw.W) && timedout)
+            epicsEventMustWait(cw.wakeup); /* consume the wake we missed */
+        return 0;
+    }
+
+    /* only a signal wakes us */
+    assert(timedout);
+    ellDelete(&C->waiters, &cw.node);
+    return 1;
+}
+
+int dbxLockCondSignal(dbxLockCond *C)
+{
+    dbxLock *L = C->ref->lock;
+
+    assert(L->holder==epicsThreadGetIdSelf() || dbxlockbias(L)==dbxbiasself());
+    return dbxcondmorph(C, L);
+}
+
+int dbxLockCondBroadcast(dbxLockCond *C)
+{
+    dbxLock *L = C->ref->lock;
+    int n = 0;
+
+    assert(L->holder==epicsThreadGetIdSelf() || dbxlockbias(L)==dbxbiasself());
+    while(dbxcondmorph(C, L))
+        n++;
+    return n;
+}
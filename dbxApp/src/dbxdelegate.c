@@ -0,0 +1,184 @@
+
+#include <stdlib.h>
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+/* Delegation (flat combining).
+ *
+ * A closure is pushed onto a lock-free stack in the dbxLock.
+ * The publisher then tries to lock.  If it succeeds, it runs all
+ * pending closures.  Otherwise every unlock runs pending closures
+ * before unlocking, and checks again afterward.  So a closure
+ * pushed while the lock is held is always run.
+ */
+
+typedef enum {
+    dbxDelegatePending,
+    dbxDelegateDone,
+    dbxDelegateMoved, /* ref changed lock.  Publisher must try again */
+} dbxdelegatestate;
+
+/* lives on the stack of dbxLockDelegate() */
+typedef struct dbxdelegate {
+    struct dbxdelegate *next;
+    dbxLockRef *ref;
+    dbxDelegateFn fn;
+    void *arg;
+    epicsThreadId publisher;
+    epicsEventId wakeup;
+    int state;
+} dbxdelegate;
+
+static epicsThreadOnceId delegateonce = EPICS_THREAD_ONCE_INIT;
+/* per-thread epicsEventId.  Never free'd */
+static epicsThreadPrivateId delegatekey;
+
+static void dbxdelegateonce(void *x)
+{
+    delegatekey = epicsThreadPrivateCreate();
+}
+
+static
+epicsEventId dbxdelegateevent(void)
+{
+    epicsEventId evt = epicsThreadPrivateGet(delegatekey);
+    if(!evt) {
+        evt = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadPrivateSet(delegatekey, evt);
+    }
+    return evt;
+}
+
+void dbxdelegatedrain(dbxLock *L)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+    dbxdelegate *head, *rev = NULL;
+    epicsThreadId self = epicsThreadGetIdSelf();
+
+    if(!X)
+        return;
+
+    /* take everything */
+    do {
+        head = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&X->delegates);
+    } while(head && epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&X->delegates, head, NULL)!=head);
+
+    if(!head)
+        return;
+    DBXMETRIC_ADD(Combine, 1);
+
+    /* run in the order published */
+    while(head) {
+        dbxdelegate *next = head->next;
+        head->next = rev;
+        rev = head;
+        head = next;
+    }
+
+    while(rev) {
+        dbxdelegate *op = rev;
+        epicsEventId wakeup = op->wakeup;
+        dbxLock *L2;
+        int state;
+
+        rev = op->next;
+
+        slock(op->ref);
+        L2 = op->ref->lock;
+        sunlock(op->ref);
+
+        if(L2==L) {
+            (*op->fn)(op->ref, op->arg);
+            state = dbxDelegateDone;
+            if(op->publisher!=self)
+                DBXMETRIC_ADD(Delegate, 1);
+        } else {
+            state = dbxDelegateMoved;
+        }
+
+        /* op may go out of scope as soon as state is set */
+        epicsAtomicSetIntT(&op->state, state);
+        epicsEventSignal(wakeup);
+    }
+}
+
+void dbxdelegateunlocked(dbxLock *L)
+{
+    /* closures pushed after we drained, but before we unlocked.
+     * If the lock is busy then the holder will run them.
+     */
+    while(dbxlockdelegates(L) && dbxlocktrylock(L))
+    {
+        /* not DBXLOCK_UNLOCK(), which would call us again.
+         * Our caller wakes a waiter.
+         */
+        if(L->depth>1) {
+            /* also held by us as holder, past a bias slot */
+            dbxdelegatedrain(L);
+            L->depth--;
+        } else {
+            DBXLOCK_DROP(L);
+            dbxlockunref(L);
+        }
+    }
+}
+
+/************ public api ***********/
+
+int dbxLockDelegate(dbxLockRef *ref, dbxDelegateFn fn, void *arg)
+{
+    dbxdelegate op;
+    dbxLock *L;
+    dbxlockext *X;
+
+    epicsThreadOnce(&delegateonce, &dbxdelegateonce, NULL);
+
+    op.ref = ref;
+    op.fn = fn;
+    op.arg = arg;
+    op.publisher = epicsThreadGetIdSelf();
+    op.wakeup = dbxdelegateevent();
+
+    do {
+        dbxdelegate *head;
+
+        slock(ref);
+        L = ref->lock;
+        if(L->holder==op.publisher) {
+            /* Already held, maybe re-entered.  No unlock will drain until
+             * ours, so run now.  ref can't move while we hold L.
+             */
+            sunlock(ref);
+            (*fn)(ref, arg);
+            return 0;
+        }
+        epicsAtomicIncrIntT(&L->refcnt);
+        sunlock(ref);
+
+        op.state = dbxDelegatePending;
+        X = dbxlockextget(L);
+        do {
+            head = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&X->delegates);
+            op.next = head;
+        } while(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&X->delegates, head, &op)!=head);
+
+        if(dbxlocktrylock(L)) {
+            /* combine.  Runs our closure, and any others */
+            DBXMETRIC_ADD(Acquire, 1);
+            DBXLOCK_UNLOCK(L);
+        }
+
+        while(epicsAtomicGetIntT(&op.state)==dbxDelegatePending)
+            epicsEventMustWait(op.wakeup);
+
+        dbxlockunref(L);
+    } while(op.state==dbxDelegateMoved);
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+
+#include <stdlib.h>
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsStdio.h>
+#include <epicsAssert.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+#include "dbx/exec.h"
+
+/* limit on the number of tasks run with a lock held */
+#define MAXBATCH 64
+
+typedef struct {
+    dbxExecutor *ex;
+    unsigned int idx;
+    epicsMutexId lock; /* guards tasks */
+    ELLLIST tasks;
+    int busy;
+    epicsEventId wakeup, exited;
+} dbxworker;
+
+struct dbxExecutor {
+    unsigned int nworkers;
+    dbxworker *workers;
+    int shutdown;
+    size_t nqueued; /* tasks queued or being run */
+    epicsEventId idle; /* signaled when nqueued reaches zero */
+    dbxExecutorStats stats;
+};
+
+static
+dbxLock* dbxexecreflock(dbxLockRef *R)
+{
+    dbxLock *L;
+    slock(R);
+    L = R->lock;
+    sunlock(R);
+    return L;
+}
+
+static
+void dbxexecroute(dbxExecutor *ex, dbxTask *task)
+{
+    dbxworker *W;
+    size_t hash;
+    unsigned int i;
+
+    task->key = dbxexecreflock(task->refs[0]);
+    hash = ((size_t)task->key/sizeof(dbxLock))*2654435761u;
+    W = &ex->workers[(hash>>8)%ex->nworkers];
+
+    epicsAtomicIncrSizeT(&ex->nqueued);
+
+    epicsMutexMustLock(W->lock);
+    ellAdd(&W->tasks, &task->node);
+    epicsMutexUnlock(W->lock);
+    epicsEventSignal(W->wakeup);
+
+    if(!epicsAtomicGetIntT(&W->busy))
+        return;
+    /* wake an idle worker to steal */
+    for(i=0; i<ex->nworkers; i++) {
+        if(!epicsAtomicGetIntT(&ex->workers[i].busy)) {
+            epicsEventSignal(ex->workers[i].wakeup);
+            break;
+        }
+    }
+}
+
+/* move the first task queued on W, and others with the same key, to batch */
+static
+int dbxexectake(dbxworker *W, ELLLIST *batch)
+{
+    ELLNODE *cur, *next;
+    void *key;
+
+    epicsMutexMustLock(W->lock);
+    if((cur = ellFirst(&W->tasks))!=NULL) {
+        key = CONTAINER(cur, dbxTask, node)->key;
+
+        ELL_FOREACH_SAFE(&W->tasks, cur, next) {
+            dbxTask *task = CONTAINER(cur, dbxTask, node);
+            if(task->key!=key)
+                continue;
+            ellDelete(&W->tasks, cur);
+            ellAdd(batch, cur);
+            if(ellCount(batch)==MAXBATCH)
+                break;
+        }
+    }
+    epicsMutexUnlock(W->lock);
+    return ellCount(batch);
+}
+
+static
+void dbxexecrun(dbxExecutor *ex, ELLLIST *batch)
+{
+    ELLLIST slow, moved;
+    ELLNODE *cur;
+    dbxLock *L;
+    size_t i, nbatch = ellCount(batch);
+
+    ellInit(&slow);
+    ellInit(&moved);
+
+    L = dbxLockOne(CONTAINER(ellFirst(batch), dbxTask, node)->refs[0], 0);
+
+    ELL_FOREACH_POP(batch, cur) {
+        dbxTask *task = CONTAINER(cur, dbxTask, node);
+
+        if(dbxexecreflock(task->refs[0])!=L) {
+            ellAdd(&moved, cur);
+            continue;
+        }
+        for(i=1; i<task->nrefs; i++) {
+            if(dbxexecreflock(task->refs[i])!=L)
+                break;
+        }
+        if(i<task->nrefs) {
+            ellAdd(&slow, cur);
+            continue;
+        }
+
+        (*task->fn)(task);
+        epicsAtomicIncrSizeT(&ex->stats.tasks);
+    }
+
+    dbxUnlockOne(L);
+    epicsAtomicIncrSizeT(&ex->stats.batches);
+
+    ELL_FOREACH_POP(&slow, cur) {
+        dbxTask *task = CONTAINER(cur, dbxTask, node);
+        dbxLocker *locker = dbxLockerAlloc(task->refs, task->nrefs, DBXLOCKER_PLAN);
+
+        if(!locker) {
+            errlogPrintf("dbxExecutor: Alloc fails.  Task not run!\n");
+            continue;
+        }
+        dbxLockMany(locker, 0);
+        (*task->fn)(task);
+        dbxUnlockMany(locker);
+        dbxLockerFree(locker);
+        epicsAtomicIncrSizeT(&ex->stats.tasks);
+        epicsAtomicIncrSizeT(&ex->stats.slow);
+    }
+
+    ELL_FOREACH_POP(&moved, cur) {
+        dbxexecroute(ex, CONTAINER(cur, dbxTask, node));
+        epicsAtomicIncrSizeT(&ex->stats.reroutes);
+    }
+
+    if(epicsAtomicAddSizeT(&ex->nqueued, -nbatch)==0) {
+        epicsEventSignal(ex->idle);
+        if(epicsAtomicGetIntT(&ex->shutdown)) {
+            for(i=0; i<ex->nworkers; i++)
+                epicsEventSignal(ex->workers[i].wakeup);
+        }
+    }
+}
+
+static
+void dbxexecworker(void *raw)
+{
+    dbxworker *W = raw;
+    dbxExecutor *ex = W->ex;
+
+    while(1) {
+        ELLLIST batch;
+        unsigned int i;
+
+        ellInit(&batch);
+        epicsAtomicSetIntT(&W->busy, 1);
+
+        if(dbxexectake(W, &batch)) {
+            dbxexecrun(ex, &batch);
+            continue;
+        }
+
+        for(i=1; i<ex->nworkers; i++) {
+            if(dbxexectake(&ex->workers[(W->idx+i)%ex->nworkers], &batch))
+                break;
+        }
+        if(ellCount(&batch)) {
+            epicsAtomicIncrSizeT(&ex->stats.steals);
+            dbxexecrun(ex, &batch);
+            continue;
+        }
+
+        epicsAtomicSetIntT(&W->busy, 0);
+        if(epicsAtomicGetIntT(&ex->shutdown) && epicsAtomicGetSizeT(&ex->nqueued)==0)
+            break;
+        epicsEventMustWait(W->wakeup);
+    }
+
+    epicsEventSignal(W->exited);
+}
+
+/************ public api ***********/
+
+dbxExecutor* dbxExecutorCreate(unsigned int nworkers, unsigned int flags)
+{
+    dbxExecutor *ex;
+    unsigned int i;
+
+    if(nworkers==0)
+        nworkers = epicsThreadGetCPUs();
+    if(nworkers==0)
+        nworkers = 1;
+
+    ex = calloc(1, sizeof(*ex)+nworkers*sizeof(*ex->workers));
+    if(!ex)
+        return NULL;
+    ex->workers = (dbxworker*)(ex+1);
+    ex->nworkers = nworkers;
+    ex->idle = epicsEventMustCreate(epicsEventEmpty);
+
+    for(i=0; i<nworkers; i++) {
+        dbxworker *W = &ex->workers[i];
+        W->ex = ex;
+        W->idx = i;
+        W->lock = epicsMutexMustCreate();
+        W->wakeup = epicsEventMustCreate(epicsEventEmpty);
+        W->exited = epicsEventMustCreate(epicsEventEmpty);
+    }
+
+    for(i=0; i<nworkers; i++) {
+        char name[20];
+        epicsSnprintf(name, sizeof(name), "dbxexec%u", i);
+        epicsThreadMustCreate(name, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &dbxexecworker, &ex->workers[i]);
+    }
+
+    return ex;
+}
+
+void dbxExecutorDestroy(dbxExecutor *ex)
+{
+    unsigned int i;
+
+    if(!ex)
+        return;
+
+    epicsAtomicSetIntT(&ex->shutdown, 1);
+    for(i=0; i<ex->nworkers; i++)
+        epicsEventSignal(ex->workers[i].wakeup);
+
+    /* a worker may signal others until it exits */
+    for(i=0; i<ex->nworkers; i++)
+        epicsEventMustWait(ex->workers[i].exited);
+
+    for(i=0; i<ex->nworkers; i++) {
+        dbxworker *W = &ex->workers[i];
+        assert(ellCount(&W->tasks)==0);
+        epicsEventDestroy(W->exited);
+        epicsEventDestroy(W->wakeup);
+        epicsMutexDestroy(W->lock);
+    }
+    epicsEventDestroy(ex->idle);
+    free(ex);
+}
+
+int dbxExecutorSubmit(dbxExecutor *ex, dbxTask *task)
+{
+    assert(task->nrefs>=1 && task->fn);
+
+    if(epicsAtomicGetIntT(&ex->shutdown))
+        return 1;
+
+    dbxexecroute(ex, task);
+    return 0;
+}
+
+void dbxExecutorFlush(dbxExecutor *ex)
+{
+    while(epicsAtomicGetSizeT(&ex->nqueued))
+        epicsEventMustWait(ex->idle);
+}
+
+void dbxExecutorGetStats(dbxExecutor *ex, dbxExecutorStats *stats)
+{
+    stats->tasks = epicsAtomicGetSizeT(&ex->stats.tasks);
+    stats->batches = epicsAtomicGetSizeT(&ex->stats.batches);
+    stats->steals = epicsAtomicGetSizeT(&ex->stats.steals);
+    stats->reroutes = epicsAtomicGetSizeT(&ex->stats.reroutes);
+    stats->slow = epicsAtomicGetSizeT(&ex->stats.slow);
+}
@@ -1,6 +1,9 @@
 
 
+#include <stdlib.h>
+
 #include <errlog.h>
+#include <cantProceed.h>
 #include <epicsAtomic.h>
 #include <epicsThread.h>
 #include <epicsAssert.h>
@@ -19,11 +22,52 @@ static epicsThreadOnceId dbxlockinit = EPICS_THREAD_ONCE_INIT;
 
 static double tickquantum;
 
+/* free'd dbxLock, for re-use.  Never returned to the heap, though
+ * their ext are unless biased.  See dbxbias.c
+ * By node+1.  See dbxnuma.c
+ */
+static ELLLIST lockpool[DBXNUMA_MAXNODES+1];
+static epicsMutexId lockpoollock;
+
+/* all dbxLocker.  See dbxLockSweep() */
+static ELLLIST lockers;
+static epicsMutexId lockerslock;
+static double sweepperiod;
+
+int dbxRetryEscalate = 4;
+
 /************ internal functions ***********/
 
+static void dbxsweeptask(void *x)
+{
+    while(1) {
+        epicsThreadSleep(sweepperiod);
+        dbxLockSweep();
+    }
+}
+
 static void dbxlockonce(void *x)
 {
+    const char *metrics = getenv("DBX_METRICS");
+    const char *bias = getenv("DBX_BIAS");
+    const char *sweep = getenv("DBX_SWEEP");
+    const char *escalate = getenv("DBX_RETRY_ESCALATE");
+    const char *numa = getenv("DBX_NUMA");
     tickquantum = epicsThreadSleepQuantum()*2;
+    lockpoollock = epicsMutexMustCreate();
+    lockerslock = epicsMutexMustCreate();
+    if(metrics && *metrics)
+        dbxLockMetricsOpen(metrics);
+    if(bias && atoi(bias))
+        dbxLockBias(1);
+    if(numa && atoi(numa))
+        dbxLockNuma(1);
+    if(escalate)
+        dbxRetryEscalate = atoi(escalate);
+    if(sweep && (sweepperiod = atof(sweep))>0.0)
+        epicsThreadMustCreate("dbxsweep", epicsThreadPriorityLow,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &dbxsweeptask, NULL);
 }
 
 static
@@ -45,27 +89,47 @@ int dbxlockcomp(const void *rawA, const void *rawB)
         return 0;
 }
 
-static
 dbxLock * dbxlockalloc(void)
 {
-    dbxLock *L = calloc(1, sizeof(*L));
-    if(L) {
-        epicsThreadOnce(&dbxlockinit, &dbxlockonce, NULL);
-        L->lock = epicsMutexCreate();
-        if(!L->lock) {
-            free(L);
-            L = NULL;
-        } else
-            L->refcnt = 1;
-    }
-    return L;
+    return dbxlockallocnode(dbxnumaactive ? dbxnumaself() : -1);
 }
 
-static inline
-void dbxlockref(dbxLock *ptr)
+dbxLock * dbxlockallocnode(int node)
 {
-    int cnt = epicsAtomicIncrIntT(&ptr->refcnt);
-    assert(cnt>1);
+    dbxLock *L;
+
+    epicsThreadOnce(&dbxlockinit, &dbxlockonce, NULL);
+
+    epicsMutexMustLock(lockpoollock);
+    L = (dbxLock*)ellGet(&lockpool[node+1]);
+    epicsMutexUnlock(lockpoollock);
+    if(L) {
+        /* a stale plan may still look at L.  See dbxplanget() */
+        size_t gen = L->gen;
+        /* only kept if biased.  See dbxlockunref() */
+        dbxlockext *X = L->ext;
+        int biased = L->biased;
+        memset(L, 0, sizeof(*L));
+        L->gen = gen;
+        L->numanode = node;
+        if(X) {
+            memset(X, 0, sizeof(*X));
+            L->ext = X;
+            L->biased = biased;
+        }
+        epicsAtomicWriteMemoryBarrier();
+    } else if(node>=0 && (L = dbxnumaalloc(sizeof(*L), node))!=NULL) {
+        L->numanode = node;
+    } else if((L = calloc(1, sizeof(*L)))!=NULL) {
+        L->numanode = -1;
+    }
+
+    if(L) {
+        /* thin.  The mutex is created by dbxthinlock() when needed */
+        L->refcnt = 1;
+        DBXMETRIC_ADD(Locks, 1);
+    }
+    return L;
 }
 
 /* Lock must NOT be held! */
@@ -82,27 +146,272 @@ void dbxlockunref(dbxLock *ptr)
     if(cnt>0)
         return;
 
-    epicsMutexMustLock(ptr->lock);
+    dbxthinlock(ptr);
     assert(ellCount(&ptr->refsets)==0);
-    assert(ptr->owner==NULL);
-    epicsMutexUnlock(ptr->lock);
+    assert(ptr->owner==NULL && ptr->holder==NULL);
+    assert(dbxlocknwaiters(ptr)==0);
+    dbxthinunlock(ptr);
+
+    if(ptr->inflated)
+        dbxmutexclean(&ptr->lock);
+    /* a bias owner may still look at the ext of a stale lock */
+    if(ptr->ext && !ptr->biased) {
+        free(ptr->ext);
+        ptr->ext = NULL;
+    }
+    if(ptr->stale)
+        DBXMETRIC_ADD(Stale, -1);
+    /* as if refsets changed */
+    epicsAtomicAddSizeT(&ptr->gen, 2);
+    epicsMutexMustLock(lockpoollock);
+    ellAdd(&lockpool[ptr->numanode+1], &ptr->lockedNode);
+    epicsMutexUnlock(lockpoollock);
+    DBXMETRIC_ADD(Locks, -1);
+}
 
-    epicsMutexDestroy(ptr->lock);
-    free(ptr);
+dbxlockext* dbxlockextget(dbxLock *L)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+
+    if(!X) {
+        X = callocMustSucceed(1, sizeof(*X), "dbxlockextget");
+        if(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&L->ext, NULL, X)!=NULL) {
+            /* lost the race */
+            free(X);
+            X = DBXLOCK_EXT(L);
+        }
+    }
+    return X;
+}
+
+void dbxlockstale(dbxLock *L)
+{
+    if(!L->stale && ellCount(&L->refsets)==0) {
+        L->stale = 1;
+        DBXMETRIC_ADD(Stale, 1);
+    }
+}
+
+/* Lock the word of L, and maybe the mutex.  See DBXLOCK_FREE.
+ * On contention, create the mutex if needed.  The first thread to hold
+ * the mutex then waits for the last thin holder to unlock.
+ */
+void dbxthinlock(dbxLock *L)
+{
+    unsigned n = 0;
+
+    if(dbxthintrylock(L))
+        return;
+
+    if(!epicsAtomicGetIntT(&L->inflated)) {
+        /* any global lock will do */
+        epicsMutexMustLock(lockpoollock);
+        if(!L->inflated) {
+            if(dbxmutexinit(&L->lock))
+                cantProceed("dbxLock: can't create mutex\n");
+            epicsAtomicWriteMemoryBarrier();
+            epicsAtomicSetIntT(&L->inflated, 1);
+            DBXMETRIC_ADD(Inflate, 1);
+        }
+        epicsMutexUnlock(lockpoollock);
+    }
+
+    dbxmutexlock(&L->lock);
+    while(epicsAtomicGetIntT(&L->word)!=DBXLOCK_FAT &&
+          epicsAtomicCmpAndSwapIntT(&L->word, DBXLOCK_FREE, DBXLOCK_FAT)!=DBXLOCK_FREE)
+    {
+        /* only once per lock.  As with dbxbiaslocked() */
+        epicsThreadSleep(n++<100 ? 0.0 : epicsThreadSleepQuantum());
+    }
+}
+
+/* remove all links involving this ref */
+static
+void dbxlockrefunlink(dbxLockRef *pref)
+{
+    ELLNODE *cur;
+
+    ELL_FOREACH_POP(&pref->linksA, cur) {
+        dbxLockLink *L = CONTAINER(cur, dbxLockLink, linksANode);
+
+        assert(epicsAtomicGetIntT(&L->refcnt)>0);
+        assert(L->A==pref);
+        assert(L->B->lock==L->A->lock);
+
+        ellDelete(&L->B->linksB, &L->linksBNode);
+        L->A = L->B = NULL;
+    }
+    ELL_FOREACH_POP(&pref->linksB, cur) {
+        dbxLockLink *L = CONTAINER(cur, dbxLockLink, linksBNode);
+
+        assert(epicsAtomicGetIntT(&L->refcnt)>0);
+        assert(L->B==pref);
+        assert(L->B->lock==L->A->lock);
+
+        ellDelete(&L->A->linksA, &L->linksANode);
+        L->A = L->B = NULL;
+    }
+}
+
+/* With each lock of refs[] held, so no ref can now leave its lock.
+ * One which left since found changed the gen of the lock it left.
+ * So compare gens, w/o spinlocks or loads through refs[i].ref.
+ * refs[] is sorted, so each lock is loaded once.  The compare is
+ * branch free over batches, which the compiler may vectorize.
+ */
+static
+int dbxvalidaterefs(dbxLocker *ptr)
+{
+    size_t i, j, nlock = ptr->maxrefs;
+    int changed = 0;
+
+    for(i=0; i<nlock; i+=DBXVALIDATE_BATCH) {
+        dbx_locker_ref *refs = &ptr->refs[i];
+        size_t cur[DBXVALIDATE_BATCH], diff = 0,
+               n = nlock-i < DBXVALIDATE_BATCH ? nlock-i : DBXVALIDATE_BATCH;
+
+        for(j=0; j<n; j++) {
+            dbxLock *L = refs[j].lock;
+            if(j!=0 && L==refs[j-1].lock)
+                cur[j] = cur[j-1];
+            else
+                cur[j] = L ? epicsAtomicGetSizeT(&L->gen) : refs[j].gen;
+        }
+        for(j=0; j<n; j++)
+            diff |= cur[j]^refs[j].gen;
+        if(!diff)
+            continue;
+        for(j=0; j<n; j++)
+            changed += cur[j]!=refs[j].gen;
+    }
+    return changed;
+}
+
+/* for bsearch() of a lock in refs[] */
+static
+int dbxlockfind(const void *rawKey, const void *rawRef)
+{
+    dbx_locker_ref key;
+    key.lock = (dbxLock*)rawKey;
+    return dbxlockcomp(&key, rawRef);
+}
+
+/* Update refs[] of a DBXLOCKER_LARGE locker.
+ * refs[] is sorted runs of entries w/ the same lock, and the locker
+ * holds one ref to the lock of each run.  A run is kept while the gen
+ * of its lock is even and unchanged, as then none of its refs has left.
+ * The entries of other runs are re-read into scratch[], sorted,
+ * and merged with the kept runs.  New locks are then ref'd once.
+ * No ref is taken while re-reading, so a new lock may since have been
+ * free'd.  Then its gen has changed, and its entries are re-read again.
+ */
+static
+int dbxupdateruns(dbxLocker *ptr)
+{
+    dbx_locker_ref *refs = ptr->refs, *scratch = ptr->scratch;
+    size_t i, s, k, nkeep, nread, nlock = ptr->maxrefs;
+    int changed = 0, again;
+
+    do {
+        nkeep = nread = 0;
+        for(s=0; s<nlock; s=i) {
+            dbxLock *X = refs[s].lock;
+            size_t gen = X ? epicsAtomicGetSizeT(&X->gen) : 0;
+            int keep = !(gen&1);
+
+            for(i=s; i<nlock && refs[i].lock==X; i++)
+                keep &= X ? refs[i].gen==gen : !refs[i].ref;
+
+            if(keep) {
+                memmove(&refs[nkeep], &refs[s], (i-s)*sizeof(*refs));
+                nkeep += i-s;
+                continue;
+            }
+
+            dbxlockunref(X);
+            for(; s<i; s++) {
+                dbx_locker_ref *ref = &scratch[nread++];
+
+                *ref = refs[s];
+                ref->lock = NULL;
+                ref->gen = 0;
+                if(!ref->ref)
+                    continue;
+                slock(ref->ref);
+                ref->lock = ref->ref->lock;
+                if(ref->lock)
+                    ref->gen = epicsAtomicGetSizeT(&ref->lock->gen);
+                sunlock(ref->ref);
+                changed += ref->lock!=X;
+            }
+        }
+
+        qsort(scratch, nread, sizeof(*scratch), &dbxlockcomp);
+
+        /* ref each new lock not also in a kept run */
+        again = 0;
+        for(s=0; s<nread && scratch[s].lock; s=i) {
+            dbxLock *X = scratch[s].lock;
+            int ok = 1;
+
+            for(i=s; i<nread && scratch[i].lock==X; i++) {}
+
+            if(bsearch(X, refs, nkeep, sizeof(*refs), &dbxlockfind))
+                continue;
+            if(dbxlocktryref(X)) {
+                size_t gen = epicsAtomicGetSizeT(&X->gen);
+                for(k=s; k<i; k++)
+                    ok &= scratch[k].gen==gen;
+                if(!ok)
+                    dbxlockunref(X);
+            } else {
+                ok = 0;
+            }
+            if(!ok) {
+                /* free'd meanwhile.  Read again */
+                for(k=s; k<i; k++)
+                    scratch[k].lock = NULL;
+                again = 1;
+            }
+        }
+        if(again)
+            qsort(scratch, nread, sizeof(*scratch), &dbxlockcomp);
+
+        /* merge from the end */
+        for(k=nlock, i=nkeep, s=nread; s; ) {
+            if(i && dbxlockcomp(&refs[i-1], &scratch[s-1])>0)
+                refs[--k] = refs[--i];
+            else
+                refs[--k] = scratch[--s];
+        }
+    } while(again);
+
+    return changed;
 }
 
 /* Call w/ update=1 before locking to update cached dbxLock entries.
  * Call w/ update=0 after locking to verify that dbxLockRefs weren't updated
  */
-static
 int dbxupdaterefs(dbxLocker *ptr, int update)
 {
     int changed = 0;
     size_t i, nlock = ptr->maxrefs,
            recomp = epicsAtomicGetSizeT(&recomputeCnt);
 
-    if(ptr->recomp!=recomp) {
+    if(ptr->recomp!=recomp && !update) {
+        changed = dbxvalidaterefs(ptr);
+        /* refs[] is current, and stays so while locked */
+        if(!changed)
+            ptr->recomp = recomp;
+
+    } else if(ptr->recomp!=recomp && ptr->large) {
+        DBXTP(UpdateRecompute, ptr, NULL);
+        changed = dbxupdateruns(ptr);
+        ptr->recomp = recomp;
+
+    } else if(ptr->recomp!=recomp) {
         /* some dbxLockRefs changed (somewhere) */
+        DBXTP(UpdateRecompute, ptr, NULL);
 
         for(i=0; i<nlock; i++) {
             dbx_locker_ref *ref = &ptr->refs[i];
@@ -113,33 +422,149 @@ int dbxupdaterefs(dbxLocker *ptr, int update)
 
             slock(ref->ref);
             if(ref->lock!=ref->ref->lock) {
-                changed = 1;
-                if(update) {
-                    dbxlockunref(ref->lock);
-                    if(ref->ref->lock)
-                        dbxlockref(ref->ref->lock);
-                    ref->lock = ref->ref->lock;
-                }
+                changed++;
+                dbxlockunref(ref->lock);
+                if(ref->ref->lock)
+                    dbxlockref(ref->ref->lock);
+                ref->lock = ref->ref->lock;
             }
+            /* any later move of ref changes this */
+            ref->gen = ref->lock ? epicsAtomicGetSizeT(&ref->lock->gen) : 0;
             sunlock(ref->ref);
         }
-        if(update)
-            ptr->recomp = recomp;
+        ptr->recomp = recomp;
     }
 
-    if(changed && update)
-        qsort(ptr->refs, ptr->maxrefs, sizeof(dbx_locker_ref), &dbxlockcomp);
+    if(changed)
+        DBXTP(UpdateChanged, ptr, NULL);
+    if(changed && update) {
+        if(!ptr->large)
+            qsort(ptr->refs, ptr->maxrefs, sizeof(dbx_locker_ref), &dbxlockcomp);
 #ifdef DBXLOCK_DEBUG
-    for(i=1; i<ptr->maxrefs; i++) {
-        if(!ptr->refs[i].lock)
-            continue;
-        assert(ptr->refs[i-1].lock <= ptr->refs[i].lock);
-        assert(dbxlockcomp(&ptr->refs[i-1], &ptr->refs[i])<1);
-    }
+        for(i=1; i<ptr->maxrefs; i++) {
+            if(!ptr->refs[i].lock)
+                continue;
+            assert(ptr->refs[i-1].lock <= ptr->refs[i].lock);
+            assert(dbxlockcomp(&ptr->refs[i-1], &ptr->refs[i])<1);
+        }
 #endif
+    }
     return changed;
 }
 
+/* lock through the bias of this thread.  See dbxbias.c */
+static inline
+int dbxbiasenter(dbxbiasowner *B, dbxLock *L, dbxLockRef *R)
+{
+    dbxlockext *X = DBXLOCK_EXT(L); /* kept, as biased to B */
+    size_t i;
+
+    for(i=0; i<DBXBIAS_NHELD; i++) {
+        if(!B->held[i])
+            break;
+    }
+    if(i==DBXBIAS_NHELD)
+        return 0;
+
+    B->held[i] = L;
+    /* a revoker orders our store before these loads */
+    if(!X->revoke && X->bias==B && *(dbxLock * volatile *)&R->lock==L)
+        return 1;
+    B->held[i] = NULL;
+    return 0;
+}
+
+static inline
+int dbxbiasexit(dbxLock *L)
+{
+    dbxbiasowner *B = dbxbiasself();
+    size_t i;
+
+    if(dbxlockbias(L)!=B)
+        return 0;
+    for(i=DBXBIAS_NHELD; i>0; i--) {
+        if(B->held[i-1]!=L)
+            continue;
+
+        if(dbxlockdelegates(L))
+            dbxdelegatedrain(L);
+        if(L->wseq&1) {
+            /* end the write once not held through another slot.
+             * Before the release below, after which another may write.
+             */
+            size_t j;
+            for(j=0; j<DBXBIAS_NHELD && (j==i-1 || B->held[j]!=L); j++) {}
+            if(j==DBXBIAS_NHELD)
+                epicsAtomicIncrSizeT(&L->wseq);
+        }
+        B->held[i-1] = NULL;
+        if(dbxlockdelegates(L))
+            dbxdelegateunlocked(L);
+        if(dbxlocknwaiters(L))
+            dbxlockwakeone(L);
+        return 1;
+    }
+    return 0;
+}
+
+/* re-enter L, which this thread holds.  No ref is needed. */
+static inline
+dbxLock* dbxlockagain(dbxLock *L)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+
+    L->depth++;
+    if(X && X->tracedepth)
+        X->tracedepth++;
+    return L;
+}
+
+static
+dbxLock* dbxlockone(dbxLockRef *R)
+{
+    dbxLock *L, *L2;
+    epicsUInt64 T0 = epicsAtomicGetIntT(&dbxtraceactive) ? dbxtracenow() : 0;
+
+retry:
+    slock(R);
+    L = R->lock;
+    if(L->holder==epicsThreadGetIdSelf()) {
+        sunlock(R);
+        return dbxlockagain(L);
+    }
+    /* given to DBXLOCK_CONTENDED */
+    dbxlockref(L);
+    sunlock(R);
+
+    DBXLOCK_CONTENDED(L, LockOneContended, R, 1);
+
+    slock(R);
+    L2 = R->lock;
+    sunlock(R);
+
+    if(L != L2) {
+        /* oops, collided with recompute */
+        DBXTP(LockOneRetry, R, L);
+        DBXMETRIC_ADD(Retry, 1);
+        DBXLOCK_UNLOCK(L);
+        goto retry;
+    }
+
+    if(T0) {
+        dbxlockext *X = dbxlockextget(L);
+        if(X->tracedepth++==0) {
+            X->traceref = R;
+            X->traceT0 = T0;
+            X->traceT1 = dbxtracenow();
+        }
+    }
+
+    if(dbxbiasactive && !dbxlockbias(L))
+        dbxbiasclaim(L);
+
+    return L;
+}
+
 /************ public api ***********/
 
 int dbxLockRefInit(dbxLockRef* pref, unsigned int flags)
@@ -152,6 +577,8 @@ int dbxLockRefInit(dbxLockRef* pref, unsigned int flags)
 
     if(pref->lock) {
         ellAdd(&pref->lock->refsets, &pref->refsetsNode);
+        DBXMETRIC_ADD(Refs, 1);
+        DBXMETRIC_HIST(0, 1);
     }
 
     return pref->lock==NULL;
@@ -159,7 +586,6 @@ int dbxLockRefInit(dbxLockRef* pref, unsigned int flags)
 
 int dbxLockRefClean(dbxLockRef *pref)
 {
-    ELLNODE *cur;
     dbxLock *lock;
 
     if(!pref)
@@ -167,61 +593,131 @@ int dbxLockRefClean(dbxLockRef *pref)
 
     assert(pref->lock && epicsAtomicGetIntT(&pref->lock->refcnt)>0);
 
-    /* we are taking an extra reference here */
-    lock = dbxLockOne(pref, 0);
+    /* we are taking an extra reference here, unless already locked */
+    lock = dbxlockone(pref);
     assert(lock);
-    /* give up the extra ref.  We still have the callers ref. */
+    /* give up the caller's ref.  The lock holder has another. */
     epicsAtomicDecrIntT(&lock->refcnt);
 
+    DBXMETRIC_ADD(Refs, -1);
+    DBXMETRIC_HIST(ellCount(&lock->refsets), ellCount(&lock->refsets)-1);
+    epicsAtomicIncrSizeT(&lock->gen);
     ellDelete(&lock->refsets, &pref->refsetsNode);
+    dbxlockstale(lock);
 
     /* Clean all links involving this reference */
-    ELL_FOREACH_POP(&pref->linksA, cur) {
-        dbxLockLink *L = CONTAINER(cur, dbxLockLink, linksANode);
+    dbxlockrefunlink(pref);
 
-        assert(epicsAtomicGetIntT(&L->refcnt)>0);
-        assert(L->A==pref);
-        assert(L->B->lock==L->A->lock);
+    freelock(pref);
+    memset(pref, 0, sizeof(*pref));
+    epicsAtomicIncrSizeT(&lock->gen);
 
-        ellDelete(&L->B->linksB, &L->linksBNode);
-        L->A = L->B = NULL;
-    }
-    ELL_FOREACH_POP(&pref->linksB, cur) {
-        dbxLockLink *L = CONTAINER(cur, dbxLockLink, linksBNode);
+    dbxUnlockOne(lock);
+    return 0;
+}
 
-        assert(epicsAtomicGetIntT(&L->refcnt)>0);
-        assert(L->B==pref);
-        assert(L->B->lock==L->A->lock);
+/* Locks are allocated together.
+ * Like any dbxLock, they are never returned to the heap.
+ */
+int dbxLockRefInitMany(dbxLockRef **prefs, size_t nrefs, unsigned int flags)
+{
+    dbxLock *arena;
+    size_t i;
 
-        ellDelete(&L->A->linksA, &L->linksANode);
-        L->A = L->B = NULL;
+    if(nrefs==0)
+        return 0;
+
+    epicsThreadOnce(&dbxlockinit, &dbxlockonce, NULL);
+
+    arena = calloc(nrefs, sizeof(*arena));
+    if(!arena)
+        return 1;
+
+    for(i=0; i<nrefs; i++) {
+        dbxLockRef *pref = prefs[i];
+        dbxLock *L = &arena[i];
+
+        assert(pref->lock==NULL && pref->spin==0);
+        memset(pref, 0, sizeof(*pref));
+        L->refcnt = 1;
+        /* not from a node slab.  Returned to the pool of no node */
+        L->numanode = -1;
+        pref->lock = L;
+        alloclock(pref);
+        ellAdd(&L->refsets, &pref->refsetsNode);
+        DBXMETRIC_HIST(0, 1);
     }
+    DBXMETRIC_ADD(Locks, nrefs);
+    DBXMETRIC_ADD(Refs, nrefs);
+    return 0;
+}
 
-    freelock(pref);
-    memset(pref, 0, sizeof(*pref));
+/* No locking.  So no other thread may use these refs */
+int dbxLockRefCleanMany(dbxLockRef **prefs, size_t nrefs)
+{
+    size_t i;
 
-    dbxUnlockOne(lock); /* release the caller's ref */
+    for(i=0; i<nrefs; i++) {
+        dbxLockRef *pref = prefs[i];
+        dbxLock *lock;
+
+        if(!pref)
+            continue;
+        lock = pref->lock;
+        assert(lock && lock->holder==NULL);
+
+        DBXMETRIC_ADD(Refs, -1);
+        DBXMETRIC_HIST(ellCount(&lock->refsets), ellCount(&lock->refsets)-1);
+        epicsAtomicIncrSizeT(&lock->gen);
+        ellDelete(&lock->refsets, &pref->refsetsNode);
+        dbxlockstale(lock);
+        dbxlockrefunlink(pref);
+
+        freelock(pref);
+        memset(pref, 0, sizeof(*pref));
+        epicsAtomicIncrSizeT(&lock->gen);
+        dbxlockunref(lock);
+    }
     return 0;
 }
 
 dbxLocker * dbxLockerAlloc(dbxLockRef** pref, size_t nlock, unsigned int flags)
 {
-    dbxLocker *ptr = calloc(1, sizeof(*ptr)+nlock*sizeof(*ptr->refs));
+    int large = !!(flags&DBXLOCKER_LARGE);
+    dbxLocker *ptr = calloc(1, sizeof(*ptr)+(large+1)*nlock*sizeof(*ptr->refs));
     if(ptr) {
         epicsThreadOnce(&dbxlockinit, &dbxlockonce, NULL);
-        size_t i;
+        size_t i, hash = 0,
+               recomp = epicsAtomicGetSizeT(&recomputeCnt);
 
         ptr->refs = (dbx_locker_ref*)(ptr+1);
         ptr->maxrefs = nlock;
-        /* intentionally spoil the recomp count to ensure that
-         * dbxupdaterefs() will run this first time
-         */
-        ptr->recomp = epicsAtomicGetSizeT(&recomputeCnt)-1;
+        ptr->large = large;
+        if(large) {
+            ptr->scratch = ptr->refs+nlock;
+            flags &= ~DBXLOCKER_PLAN;
+        }
 
         for(i=0; i<nlock; i++) {
             ptr->refs[i].ref = pref[i];
         }
-        dbxupdaterefs(ptr, 1);
+
+        if((flags&DBXLOCKER_PLAN) && !dbxplanget(ptr, &hash)) {
+            /* changes since recomp will be found by dbxLockMany() */
+            ptr->recomp = recomp;
+        } else {
+            /* intentionally spoil the recomp count to ensure that
+             * dbxupdaterefs() will run this first time
+             */
+            ptr->recomp = recomp-1;
+            dbxupdaterefs(ptr, 1);
+            if(flags&DBXLOCKER_PLAN)
+                dbxplanput(ptr, hash);
+        }
+
+        epicsMutexMustLock(lockerslock);
+        ellAdd(&lockers, &ptr->lockersNode);
+        epicsMutexUnlock(lockerslock);
     }
     return ptr;
 }
@@ -231,61 +727,221 @@ int dbxLockerFree(dbxLocker *ptr)
     int i;
     assert(ellCount(&ptr->locked)==0);
 
+    /* after which dbxLockSweep() can't find ptr */
+    epicsMutexMustLock(lockerslock);
+    ellDelete(&lockers, &ptr->lockersNode);
+    epicsMutexUnlock(lockerslock);
+
     for(i=0; i<ptr->maxrefs; i++) {
+        /* one ref for each run */
+        if(ptr->large && i!=0 && ptr->refs[i].lock==ptr->refs[i-1].lock)
+            continue;
         dbxlockunref(ptr->refs[i].lock);
     }
+    /* replaced by dbxLockerExtend() */
+    if(ptr->refs!=(dbx_locker_ref*)(ptr+1))
+        free(ptr->refs);
+    if(ptr->ajob)
+        epicsJobDestroy(ptr->ajob);
     free(ptr);
     return 0;
 }
 
 dbxLock* dbxLockOne(dbxLockRef *R, unsigned int flags)
 {
-    dbxLock *L, *L2;
+    dbxLock *L = *(dbxLock * volatile *)&R->lock;
 
-retry:
-    slock(R);
-    L = R->lock;
-    dbxlockref(L);
-    sunlock(R);
+    /* R->lock only changes while locked, so if we hold L it is current */
+    if(L->holder==epicsThreadGetIdSelf())
+        return dbxlockagain(L);
 
-    epicsMutexMustLock(L->lock);
+    if(dbxbiasactive && !epicsAtomicGetIntT(&dbxtraceactive)) {
+        dbxbiasowner *B = dbxbiasself();
 
-    slock(R);
-    L2 = R->lock;
-    sunlock(R);
+        if(dbxlockbias(L)==B && dbxbiasenter(B, L, R)) {
+            DBXMETRIC_ADD(BiasHit, 1);
+            return L;
+        }
+    }
+    return dbxlockone(R);
+}
 
-    if(L != L2) {
-        /* oops, collided with recompute */
-        epicsMutexUnlock(L->lock);
-        dbxlockunref(L);
-        goto retry;
+int dbxUnlockOne(dbxLock* L)
+{
+    dbxlockext *X;
+
+    if(dbxlockbias(L) && dbxbiasexit(L))
+        return 0;
+
+    X = DBXLOCK_EXT(L);
+    if(X && X->tracedepth && --X->tracedepth==0 && epicsAtomicGetIntT(&dbxtraceactive)) {
+        /* recorded after unlocking, as recording may wait */
+        dbxLockRef *R = X->traceref;
+        epicsUInt64 T0 = X->traceT0, T1 = X->traceT1, T2 = dbxtracenow();
+
+        DBXLOCK_UNLOCK(L);
+        dbxtraceemit(dbxTraceLockOne, R, NULL, L, 0, 1, T0, T1, T2);
+        return 0;
     }
 
-    return L;
+    DBXLOCK_UNLOCK(L);
+    return 0;
 }
 
-int dbxUnlockOne(dbxLock* L)
+void dbxLockMarkWrite(dbxLockRef *R)
 {
-    epicsMutexUnlock(L->lock);
-    dbxlockunref(L);
+    dbxLock *L = R->lock;
+
+    assert(L->holder==epicsThreadGetIdSelf() || dbxlockbias(L)==dbxbiasself());
+    /* a full barrier, so ordered before the writes which follow */
+    if(!(L->wseq&1))
+        epicsAtomicIncrSizeT(&L->wseq);
+}
+
+void dbxLockReadBegin(dbxLockRef *R, dbxLockSeq *S)
+{
+    dbxLock *L = *(dbxLock * volatile *)&R->lock;
+
+    S->lock = L;
+    if(L) {
+        /* lock memory is never free'd.  See dbxlockalloc() */
+        S->seq = *(volatile size_t*)&L->wseq;
+        S->gen = *(volatile size_t*)&L->gen;
+    }
+    epicsAtomicReadMemoryBarrier();
+}
+
+int dbxLockReadValidate(dbxLockRef *R, const dbxLockSeq *S)
+{
+    dbxLock *L = S->lock;
+
+    epicsAtomicReadMemoryBarrier();
+    /* a write in progress, or since begin.  Or R moved, which changes
+     * the gen of the lock it left, even if it since returned.
+     */
+    return !L || ((S->seq|S->gen)&1)
+            || *(volatile size_t*)&L->wseq!=S->seq
+            || *(volatile size_t*)&L->gen!=S->gen
+            || *(dbxLock * volatile *)&R->lock!=L;
+}
+
+/* try to lock L, out of order, w/ bounded backoff */
+static
+int dbxextendtry(dbxLock *L)
+{
+    unsigned n;
+
+    for(n=0; n<DBXEXTEND_NTRY; n++) {
+        if(dbxlocktrylock(L))
+            return 1;
+        DBXMETRIC_ADD(ExtendBackoff, 1);
+        epicsThreadSleep(0.0);
+    }
     return 0;
 }
 
+/* unlock the held locks ordered after L */
+static
+void dbxextendrelease(dbxLocker *ptr, dbxLock *L)
+{
+    ELLNODE *cur, *next;
+
+    for(cur=ellFirst(&ptr->locked); cur; cur=next) {
+        dbxLock *H = CONTAINER(cur, dbxLock, lockedNode);
+        next = ellNext(cur);
+
+        if(H < L)
+            continue;
+        assert(H->owner==ptr);
+        ellDelete(&ptr->locked, cur);
+        H->owner = NULL;
+        DBXLOCK_UNLOCK(H);
+    }
+}
+
+/* Lock each lock of refs[] not already held, keeping those held.
+ * Locks ordered after the highest held lock are locked in order.
+ * Blocking on any other could deadlock, so it is only tried.
+ * If still busy, then only the held locks ordered after it are
+ * released, and re-locked in order after it.
+ */
+static
+void dbxlockmore(dbxLocker *ptr)
+{
+    size_t i, nlock = ptr->maxrefs;
+    dbxLock *plock, *top = NULL;
+    ELLNODE *cur;
+
+    ELL_FOREACH(&ptr->locked, cur) {
+        dbxLock *H = CONTAINER(cur, dbxLock, lockedNode);
+        if(H > top)
+            top = H;
+    }
+
+    for(i=0, plock=NULL; i<nlock; i++) {
+        dbx_locker_ref *ref = &ptr->refs[i];
+
+        /* skip NULLs, duplicates, and already held */
+        if(!ref->lock || (i!=0 && ref->lock==plock))
+            continue;
+        plock = ref->lock;
+        if(plock->owner==ptr)
+            continue;
+
+        if(plock > top) {
+            DBXLOCK_CONTENDED(plock, LockManyContended, ptr, 0);
+            top = plock;
+
+        } else if(!dbxextendtry(plock)) {
+            DBXTP(ExtendRelock, ptr, plock);
+            DBXMETRIC_ADD(ExtendRelock, 1);
+            dbxextendrelease(ptr, plock);
+            DBXLOCK_CONTENDED(plock, LockManyContended, ptr, 0);
+            top = plock;
+        }
+
+        assert(plock->owner==NULL);
+        plock->owner = ptr;
+        ellAdd(&ptr->locked, &plock->lockedNode);
+    }
+}
+
+/* before retry n of dbxLockMany().  Yield 2^(n-1)-1 times, up to 31 */
+static
+void dbxretrybackoff(int n)
+{
+    unsigned i;
+
+    for(i=1; i<(1u<<(n<6 ? n-1 : 5)); i++)
+        epicsThreadSleep(0.0);
+    if(n>1)
+        DBXMETRIC_ADD(RetryBackoff, 1);
+}
+
 int dbxLockMany(dbxLocker *ptr, unsigned int flags)
 {
 #ifdef DBXLOCK_DEBUG
     dbxLock *prevlock;
 #endif
     size_t i, nlock = ptr->maxrefs;
+    int nretry = 0;
     dbxLock *plock;
+    epicsUInt64 T0 = epicsAtomicGetIntT(&dbxtraceactive) ? dbxtracenow() : 0;
     assert(ellCount(&ptr->locked)==0);
 
+    dbxlockerenter(ptr);
 retry:
 #ifdef DBXLOCK_DEBUG
     prevlock = NULL;
 #endif
     dbxupdaterefs(ptr, 1);
 
+    if(nretry>=dbxRetryEscalate) {
+        /* no ref can leave a held lock.  So keep them */
+        dbxlockmore(ptr);
+        goto check;
+    }
+
     for(i=0, plock=NULL; i<nlock; i++) {
         dbx_locker_ref *ref = &ptr->refs[i];
 
@@ -298,43 +954,191 @@ retry:
         prevlock = plock;
 #endif
 
-        epicsMutexMustLock(plock->lock);
+        DBXLOCK_CONTENDED(plock, LockManyContended, ptr, 0);
         assert(plock->owner==NULL);
         plock->owner = ptr;
+        // the ref taken on first acquisition keeps the locked list node
         ellAdd(&ptr->locked, &ref->lock->lockedNode);
-        // An extra ref for the locked list node
-        dbxlockref(plock);
     }
 
+check:
     if(dbxupdaterefs(ptr,0)) {
         /* oops, collided with recompute */
-        dbxUnlockMany(ptr);
+        DBXTP(LockManyRetry, ptr, NULL);
+        DBXMETRIC_ADD(Retry, 1);
+        nretry++;
+        if(nretry<dbxRetryEscalate) {
+            dbxunlockmany(ptr);
+            dbxretrybackoff(nretry);
+        } else if(nretry==dbxRetryEscalate) {
+            DBXTP(LockManyEscalate, ptr, NULL);
+            DBXMETRIC_ADD(Escalate, 1);
+        }
         goto retry;
     }
 
+    ptr->traceT0 = T0;
+    if(T0)
+        ptr->traceT1 = dbxtracenow();
+
+    dbxlockerexit(ptr);
     return 0;
 }
 
-int dbxUnlockMany(dbxLocker *ptr)
+void dbxunlockmany(dbxLocker *ptr)
 {
     ELLNODE *cur;
+    epicsUInt64 T2 = 0;
+
+    DBXTP(UnlockMany, ptr, NULL);
+
+    if(ptr->traceT0 && epicsAtomicGetIntT(&dbxtraceactive))
+        T2 = dbxtracenow();
 
     ELL_FOREACH_POP(&ptr->locked, cur) {
         dbxLock *L = CONTAINER(cur, dbxLock, lockedNode);
 
         assert(L->owner==ptr);
         L->owner = NULL;
-        epicsMutexUnlock(L->lock);
-        // Release the extra ref taken in dbxLockMany()
-        // and dbxLockRefSplit()
-        dbxlockunref(L);
+        DBXLOCK_UNLOCK(L);
+    }
+
+    /* recorded after unlocking, as recording may wait.
+     * ptr->refs is only changed by this thread.
+     */
+    if(T2) {
+        size_t i;
+
+        for(i=0; i<ptr->maxrefs; i++) {
+            if(!ptr->refs[i].ref)
+                continue; /* unused entry */
+            dbxtraceemit(dbxTraceLockMany, ptr->refs[i].ref, NULL, ptr->refs[i].lock,
+                         i, ptr->maxrefs, ptr->traceT0, ptr->traceT1, T2);
+        }
+    }
+    ptr->traceT0 = 0;
+}
+
+int dbxUnlockMany(dbxLocker *ptr)
+{
+    dbxlockerenter(ptr);
+    dbxunlockmany(ptr);
+    dbxlockerexit(ptr);
+    return 0;
+}
+
+/* See dbxlockmore() */
+int dbxLockerExtend(dbxLocker *ptr, dbxLockRef **pref, size_t nref, unsigned int flags)
+{
+    size_t i, nlock = ptr->maxrefs+nref;
+    dbx_locker_ref *refs;
+
+    refs = calloc((ptr->large+1)*nlock, sizeof(*refs));
+    if(!refs)
+        return 1;
+    dbxlockerenter(ptr);
+    memcpy(refs, ptr->refs, ptr->maxrefs*sizeof(*refs));
+    for(i=0; i<nref; i++)
+        refs[ptr->maxrefs+i].ref = pref[i];
+
+    if(ptr->refs!=(dbx_locker_ref*)(ptr+1))
+        free(ptr->refs);
+    ptr->refs = refs;
+    ptr->maxrefs = nlock;
+    if(ptr->large)
+        ptr->scratch = refs+nlock;
+    /* spoil, so dbxupdaterefs() fills in the new entries */
+    ptr->recomp = epicsAtomicGetSizeT(&recomputeCnt)-1;
+
+retry:
+    dbxupdaterefs(ptr, 1);
+    dbxlockmore(ptr);
+
+    if(dbxupdaterefs(ptr,0)) {
+        /* collided with recompute.  Keep what we hold, and try again */
+        DBXTP(LockManyRetry, ptr, NULL);
+        DBXMETRIC_ADD(Retry, 1);
+        goto retry;
     }
 
+    dbxlockerexit(ptr);
     return 0;
 }
 
+/* move all refs of src to dst.  Both locked.
+ * The empty src is then free'd when no longer referenced.
+ */
+static
+void dbxlockmoverefs(dbxLock *dst, dbxLock *src)
+{
+    ELLNODE *cur;
+
+    /* re-target lock-refs to dst */
+    epicsAtomicIncrSizeT(&src->gen);
+    ELL_FOREACH(&src->refsets, cur) {
+        dbxLockRef *refX = CONTAINER(cur, dbxLockRef, refsetsNode);
+
+        assert(refX->lock==src);
+        slock(refX);
+        refX->lock = dst;
+        epicsAtomicIncrSizeT(&recomputeCnt);
+        sunlock(refX);
+    }
+
+    /* update ref counters */
+    epicsAtomicAddIntT(&src->refcnt, -ellCount(&src->refsets));
+    epicsAtomicAddIntT(&dst->refcnt,  ellCount(&src->refsets));
+    /* should have at least the caller's ref remaining */
+    assert(epicsAtomicGetIntT(&src->refcnt)>0);
+
+    /* merge refs */
+    ellConcat(&dst->refsets, &src->refsets);
+    epicsAtomicIncrSizeT(&src->gen);
+
+    /* and waiters, which would otherwise wait for an unlock of src */
+    dbxlockmovewaiters(dst, src);
+
+    /* now empty src will be free'd when its refcnt reaches zero.
+     * which may happen as soon as dbxUnlockMany()
+     * or might take a long time if it lives
+     * in some dbxLocker::refs cache.  See dbxLockSweep()
+     */
+    dbxlockstale(src);
+}
+
+/* With L held by ptr after a join or split.  If L is not on the node
+ * which mostly holds it, move its refs to a new lock there, also held.
+ */
+static
+void dbxlockmigrate(dbxLocker *ptr, dbxLock *L)
+{
+    int node;
+    dbxLock *N;
+
+    if(!dbxnumaactive)
+        return;
+    node = dbxnumapreferred(L);
+    if(node<0 || node==L->numanode || ellCount(&L->refsets)==0)
+        return;
+
+    N = dbxlockallocnode(node); /* refcnt==1 */
+    if(!N)
+        return;
+    dbxthinlock(N);
+    N->holder = epicsThreadGetIdSelf();
+    N->depth = 1;
+    N->owner = ptr;
+    dbxnumamerge(N, L);
+
+    // use the initial ref for the locked node
+    ellAdd(&ptr->locked, &N->lockedNode);
+
+    DBXMETRIC_ADD(NumaMigrate, 1);
+    dbxlockmoverefs(N, L);
+}
+
 /* assumes that lock(s) referenced by A and B are locked */
-dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
+dbxLockLink* dbxlockrefjoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
 {
     dbxLock *lockA = A->lock, *lockB = B->lock;
 
@@ -378,10 +1182,10 @@ dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
         link->refcnt = 1;
         ellAdd(&A->linksA, &link->linksANode);
         ellAdd(&B->linksB, &link->linksBNode);
+        DBXMETRIC_ADD(Links, 1);
         return link;
 
     } else { /* create new link */
-        ELLNODE *cur;
         dbxLockLink *link = calloc(1, sizeof(*link));
         if(!link)
             return NULL;
@@ -391,34 +1195,25 @@ dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
         link->refcnt = 1;
         ellAdd(&A->linksA, &link->linksANode);
         ellAdd(&B->linksB, &link->linksBNode);
+        DBXMETRIC_ADD(Links, 1);
 
-        /* we will merge lockB into lockA */
-
-        /* re-target lock-refs to A */
-        ELL_FOREACH(&lockB->refsets, cur) {
-            dbxLockRef *refX = CONTAINER(cur, dbxLockRef, refsetsNode);
-
-            assert(refX->lock==lockB);
-            slock(refX);
-            refX->lock = lockA;
-            epicsAtomicIncrSizeT(&recomputeCnt);
-            sunlock(refX);
+        if(dbxnumaactive && dbxnumajoin(lockA, lockB)) {
+            /* lockB is placed on the node which mostly holds both */
+            dbxLock *tmp = lockA;
+            lockA = lockB;
+            lockB = tmp;
         }
 
-        /* update ref counters */
-        epicsAtomicAddIntT(&lockB->refcnt, -ellCount(&lockB->refsets));
-        epicsAtomicAddIntT(&lockA->refcnt,  ellCount(&lockB->refsets));
-        /* should have at least the caller's ref remaining */
-        assert(epicsAtomicGetIntT(&lockB->refcnt)>0);
-
-        /* merge refs */
-        ellConcat(&lockA->refsets, &lockB->refsets);
-
-        /* now empty lockB will be free'd when its refcnt reaches zero.
-         * which may happen as soon as dbxUnlockMany()
-         * or might take a long time if it lives
-         * in some dbxLocker::refs cache.
-         */
+        /* we will merge lockB into lockA */
+        DBXTP(JoinMerge, lockA, lockB);
+        DBXMETRIC_ADD(Merge, 1);
+        DBXMETRIC_HIST(ellCount(&lockA->refsets),
+                       ellCount(&lockA->refsets)+ellCount(&lockB->refsets));
+        DBXMETRIC_HIST(ellCount(&lockB->refsets), 0);
+
+        dbxnumamerge(lockA, lockB);
+        dbxlockmoverefs(lockA, lockB);
+        dbxlockmigrate(ptr, lockA);
         return link;
     }
 
@@ -426,12 +1221,13 @@ dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
 }
 
 /* assumes that lock referenced by A and B must be locked */
-int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
+static
+int dbxlockrefsplit(dbxLocker *ptr, dbxLockLink *R)
 {
     dbxLockRef *A = R->A, *B = R->B;
     dbxLock *L;
     ELLLIST visited, tovisit;
-    int cnt;
+    int cnt, node;
     int found = 0;
 
     cnt = epicsAtomicDecrIntT(&R->refcnt);
@@ -443,6 +1239,7 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
     if(!A && !B) {
         /* cleanup link orphaned by dbxLockRefClean() */
         free(R);
+        DBXMETRIC_ADD(Links, -1);
         return 0;
     }
     assert(ptr);
@@ -453,6 +1250,7 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
     ellDelete(&R->A->linksA, &R->linksANode);
     ellDelete(&R->B->linksB, &R->linksBNode);
     free(R);
+    DBXMETRIC_ADD(Links, -1);
 
     /* This was the last (direct) link between A and B.
      * Is there an indirect link?
@@ -548,11 +1346,17 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
 
         assert(ellCount(&tovisit)==0);
 
-        lockB = dbxlockalloc(); /* refcnt==1 */
+        /* on the node which mostly holds L, which B is likely to share */
+        node = dbxnumaactive ? dbxnumapreferred(L) : -1;
+        lockB = node>=0 ? dbxlockallocnode(node) : dbxlockalloc(); /* refcnt==1 */
         if(!lockB)
             return 1;
-        epicsMutexMustLock(lockB->lock);
+        dbxnumamerge(lockB, L);
+        dbxthinlock(lockB);
+        lockB->holder = epicsThreadGetIdSelf();
+        lockB->depth = 1;
         lockB->owner = ptr;
+        DBXTP(SplitNew, L, lockB);
 
         // use the initial ref for the locked node
         ellAdd(&ptr->locked, &lockB->lockedNode);
@@ -560,6 +1364,12 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
         ellConcat(&lockB->refsets, &L->refsets);
         ellConcat(&L->refsets, &visited);
 
+        DBXMETRIC_ADD(Divide, 1);
+        DBXMETRIC_HIST(ellCount(&L->refsets)+ellCount(&lockB->refsets),
+                       ellCount(&L->refsets));
+        DBXMETRIC_HIST(0, ellCount(&lockB->refsets));
+
+        epicsAtomicIncrSizeT(&L->gen);
         ELL_FOREACH(&lockB->refsets, curRef) {
             dbxLockRef *ref = CONTAINER(curRef, dbxLockRef, refsetsNode);
 
@@ -568,6 +1378,7 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
             epicsAtomicIncrSizeT(&recomputeCnt);
             sunlock(ref);
         }
+        epicsAtomicIncrSizeT(&L->gen);
 
         /* adjust ref counts */
         assert(epicsAtomicGetIntT(&L->refcnt) > ellCount(&lockB->refsets));
@@ -576,6 +1387,64 @@ int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
         /* should have at least the caller's ref remaining */
         assert(epicsAtomicGetIntT(&L->refcnt)>0);
 
+        /* waiters of L may now want lockB */
+        dbxlockwakeall(L);
+
+        dbxlockmigrate(ptr, L);
         return 0;
     }
 }
+
+dbxLockLink* dbxLockRefJoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockLink *link;
+    epicsUInt64 T0 = epicsAtomicGetIntT(&dbxtraceactive) ? dbxtracenow() : 0;
+
+    DBXTP(Join, A, B);
+    DBXMETRIC_ADD(Join, 1);
+    link = dbxlockrefjoin(ptr, A, B);
+
+    if(T0 && link && epicsAtomicGetIntT(&dbxtraceactive))
+        dbxtraceemit(dbxTraceJoin, A, B, A->lock, 0, 1, T0, T0, dbxtracenow());
+    return link;
+}
+
+int dbxLockRefSplit(dbxLocker *ptr, dbxLockLink *R)
+{
+    int ret;
+    dbxLockRef *A = R->A, *B = R->B;
+    dbxLock *L = A ? A->lock : NULL;
+    epicsUInt64 T0 = epicsAtomicGetIntT(&dbxtraceactive) && A ? dbxtracenow() : 0;
+
+    DBXTP(Split, A, B);
+    DBXMETRIC_ADD(Split, 1);
+    ret = dbxlockrefsplit(ptr, R);
+
+    if(T0 && !ret && epicsAtomicGetIntT(&dbxtraceactive))
+        dbxtraceemit(dbxTraceSplit, A, B, L, 0, 1, T0, T0, dbxtracenow());
+    return ret;
+}
+
+size_t dbxLockSweep(void)
+{
+    ELLNODE *cur;
+    size_t nswept = 0;
+
+    epicsThreadOnce(&dbxlockinit, &dbxlockonce, NULL);
+
+    epicsMutexMustLock(lockerslock);
+    ELL_FOREACH(&lockers, cur) {
+        dbxLocker *ptr = CONTAINER(cur, dbxLocker, lockersNode);
+
+        /* in use.  Will update itself */
+        if(epicsAtomicCmpAndSwapIntT(&ptr->busy, 0, 1)!=0)
+            continue;
+        if(ellCount(&ptr->locked)==0)
+            nswept += dbxupdaterefs(ptr, 1);
+        dbxlockerexit(ptr);
+    }
+    epicsMutexUnlock(lockerslock);
+
+    DBXMETRIC_ADD(Sweep, nswept);
+    return nswept;
+}
@@ -4,8 +4,16 @@
 #include <string.h>
 
 #include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsAtomic.h>
+#include <epicsAssert.h>
 
 #include "dbx/lock.h"
+#include "dbx/trace.h"
+#include "dbx/tracepoint.h"
+#include "dbx/metrics.h"
 
 #define DBXLOCK_DEBUG
 
@@ -19,12 +27,154 @@
 #define ELL_FOREACH_POP(LIST, A) \
     while( (A=ellGet(LIST))!=NULL )
 
+#if defined(__unix__) || defined(__APPLE__)
+#  include <pthread.h>
+#  define DBXLOCK_HAVE_PI
+#endif
+
+/* dbxLock mutex backend.
+ * Build with -DDBXLOCK_MCS to use the FIFO queue lock from dbxmcs.c,
+ * or -DDBXLOCK_PI to use a priority inheriting pthread mutex (dbxpi.c),
+ * instead of epicsMutex.  All are recursive.
+ * dbxmutextrylock() returns non-zero if locked.
+ */
+typedef struct dbxmcsnode dbxmcsnode;
+typedef struct {
+    dbxmcsnode *tail;   /* last waiter.  Atomic */
+    dbxmcsnode *holder; /* node of the owner */
+    epicsThreadId owner;
+    unsigned int depth;
+} dbxmcs;
+
+/* see dbxmcs.c */
+extern int dbxMCSSpin; /* # of polls before parking */
+int dbxmcsinit(dbxmcs *M);
+void dbxmcsclean(dbxmcs *M);
+void dbxmcslock(dbxmcs *M);
+int dbxmcstrylock(dbxmcs *M);
+void dbxmcsunlock(dbxmcs *M);
+
+#ifdef DBXLOCK_HAVE_PI
+/* see dbxpi.c */
+typedef pthread_mutex_t dbxpi;
+int dbxpiinit(dbxpi *M);
+void dbxpiclean(dbxpi *M);
+void dbxpilock(dbxpi *M);
+int dbxpitrylock(dbxpi *M);
+void dbxpiunlock(dbxpi *M);
+#endif
+
+#if defined(DBXLOCK_MCS) && defined(DBXLOCK_PI)
+#  error Select only one of DBXLOCK_MCS or DBXLOCK_PI
+#elif defined(DBXLOCK_PI) && !defined(DBXLOCK_HAVE_PI)
+#  error DBXLOCK_PI requires POSIX threads
+#endif
+
+#ifdef DBXLOCK_MCS
+typedef dbxmcs dbxmutex;
+#  define dbxmutexinit(M) dbxmcsinit(M)
+#  define dbxmutexclean(M) dbxmcsclean(M)
+#  define dbxmutexlock(M) dbxmcslock(M)
+#  define dbxmutextrylock(M) dbxmcstrylock(M)
+#  define dbxmutexunlock(M) dbxmcsunlock(M)
+#elif defined(DBXLOCK_PI)
+typedef dbxpi dbxmutex;
+#  define dbxmutexinit(M) dbxpiinit(M)
+#  define dbxmutexclean(M) dbxpiclean(M)
+#  define dbxmutexlock(M) dbxpilock(M)
+#  define dbxmutextrylock(M) dbxpitrylock(M)
+#  define dbxmutexunlock(M) dbxpiunlock(M)
+#else
+typedef epicsMutexId dbxmutex;
+#  define dbxmutexinit(M) ((*(M) = epicsMutexCreate())==NULL)
+#  define dbxmutexclean(M) epicsMutexDestroy(*(M))
+#  define dbxmutexlock(M) epicsMutexMustLock(*(M))
+#  define dbxmutextrylock(M) (epicsMutexTryLock(*(M))==epicsMutexLockOK)
+#  define dbxmutexunlock(M) epicsMutexUnlock(*(M))
+#endif
+
+/* An entry in a dbxLock wait queue.  See dbxasync.c */
+typedef struct dbxlockwaiter {
+    ELLNODE node;
+    /* lock whose wait queue has this, w/ a ref, or NULL.
+     * Changed w/ the wait queue of that lock locked.  Atomic
+     */
+    struct dbxLock *queued;
+    /* called with the wait queue locked, after removal */
+    void (*wake)(struct dbxlockwaiter *W);
+    /* set when woken.  Queued again at the head, not the tail, until
+     * cleared by the owner once it has its locks.
+     */
+    int woken;
+} dbxlockwaiter;
+
+/* Rarely used state of a dbxLock.  Allocated when first needed,
+ * and free'd with the lock unless it was ever biased.  See dbxlockextget()
+ */
+typedef struct dbxlockext {
+    /* wait queue of dbxlockwaiter.  Guarded by dbxlockwaitlock(), not lock */
+    ELLLIST waiters;
+    int nwaiters;
+
+    /* stack of closures from dbxLockDelegate().  Atomic */
+    struct dbxdelegate *delegates;
+
+    /* biased locking.  See dbxbias.c */
+    struct dbxbiasowner * volatile bias;
+    volatile int revoke;
+    int nrevoke;
+
+    /* numacand is the node which mostly holds the lock, by numavote.
+     * Guarded by lock.  See dbxnuma.c
+     */
+    int numacand, numavote;
+
+    /* dbxLockOne() trace state.  Guarded by lock */
+    int tracedepth;
+    dbxLockRef *traceref;
+    epicsUInt64 traceT0, traceT1;
+} dbxlockext;
+
 struct dbxLock {
     ELLNODE lockedNode;
-    epicsMutexId lock;
+    /* thin lock word.  DBXLOCK_FREE, _THIN or _FAT.  Atomic */
+    int word;
+    /* non-zero once lock is created.  See dbxthinlock() */
+    int inflated;
+    dbxmutex lock;
     int refcnt;
     ELLLIST refsets;
     dbxLocker *owner;
+
+    /* thread which holds lock, and how many times.
+     * Written with lock held.  Only equal to self if we hold it.
+     */
+    epicsThreadId holder;
+    int depth;
+
+    /* NULL until needed, then kept until L has no refs.  Atomic */
+    dbxlockext *ext;
+    /* ext was biased, so is kept with this memory.  Kept when re-used.
+     * Atomic.  See dbxlockbias()
+     */
+    int biased;
+
+    /* refsets emptied, but still referenced.  See dbxMetricStale */
+    int stale;
+    /* odd while refs are moved out of refsets, and +2 when free'd.
+     * Kept when re-used.  Atomic.  See dbxplan.c
+     */
+    size_t gen;
+    /* write sequence.  Odd from dbxLockMarkWrite() until released.
+     * Written by the holder.  Atomic.  See dbxLockReadBegin()
+     */
+    size_t wseq;
+
+    /* node of this memory, or -1 if not placed.  Kept when re-used.
+     * Guarded by lock.  See dbxnuma.c
+     */
+    int numanode;
+    unsigned numatick;
 };
 
 struct dbx_locker_ref {
@@ -34,6 +184,8 @@ struct dbx_locker_ref {
      * is locked.
      */
     dbxLock *lock;
+    /* lock->gen when lock was found.  See dbxvalidaterefs() */
+    size_t gen;
 };
 typedef struct dbx_locker_ref dbx_locker_ref;
 
@@ -42,6 +194,26 @@ struct dbxLocker {
     size_t recomp; /* snapshot of recomputeCnt when refs[] cache updated */
     size_t maxrefs;
     dbx_locker_ref *refs;
+    /* DBXLOCKER_LARGE.  refs[] holds one ref to each lock.
+     * scratch[maxrefs] is used by dbxupdateruns()
+     */
+    int large;
+    dbx_locker_ref *scratch;
+    /* dbxLockMany() trace state */
+    epicsUInt64 traceT0, traceT1;
+
+    /* dbxLockManyAsync() state */
+    epicsJob *ajob;
+    epicsThreadPool *apool;
+    dbxLockCallback acb;
+    void *aarg;
+    int apending; /* requests to run ajob.  Queued on 0 -> 1 */
+    dbxlockwaiter await;
+
+    /* all lockers.  See dbxLockSweep() */
+    ELLNODE lockersNode;
+    /* refs[] and locked in use.  Atomic.  See dbxlockerenter() */
+    int busy;
 };
 
 struct dbxLockLink {
@@ -50,7 +222,340 @@ struct dbxLockLink {
     int refcnt;
 };
 
+static inline
+void dbxlockref(dbxLock *ptr)
+{
+    int cnt = epicsAtomicIncrIntT(&ptr->refcnt);
+    assert(cnt>1);
+}
+/* for a dbxLock which may have been free'd.  Returns 0 if it was */
+static inline
+int dbxlocktryref(dbxLock *ptr)
+{
+    int cnt;
+    while((cnt = epicsAtomicGetIntT(&ptr->refcnt))>0) {
+        if(epicsAtomicCmpAndSwapIntT(&ptr->refcnt, cnt, cnt+1)==cnt)
+            return 1;
+    }
+    return 0;
+}
+/* refcnt==1 */
+dbxLock * dbxlockalloc(void);
+/* on node, or not placed if node<0 */
+dbxLock * dbxlockallocnode(int node);
 void dbxlockunref(dbxLock *ptr);
+/* returns the number of refs[] whose lock changed */
+int dbxupdaterefs(dbxLocker *ptr, int update);
+/* entries of refs[] compared at once by dbxvalidaterefs() */
+#define DBXVALIDATE_BATCH 16
+/* count L as stale once its refsets is empty */
+void dbxlockstale(dbxLock *L);
+
+#define DBXLOCK_EXT(L) ((dbxlockext*)epicsAtomicGetPtrT((EpicsAtomicPtrT*)&(L)->ext))
+/* ext of L, allocated if needed.  L must be held, or ref'd */
+dbxlockext* dbxlockextget(dbxLock *L);
+
+static inline
+int dbxlocknwaiters(dbxLock *L)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+    return X ? epicsAtomicGetIntT(&X->nwaiters) : 0;
+}
+
+static inline
+struct dbxdelegate* dbxlockdelegates(dbxLock *L)
+{
+    dbxlockext *X = DBXLOCK_EXT(L);
+    return X ? (struct dbxdelegate*)epicsAtomicGetPtrT((EpicsAtomicPtrT*)&X->delegates) : NULL;
+}
+
+/* bias of L, or NULL.  L may be stale */
+static inline
+struct dbxbiasowner* dbxlockbias(dbxLock *L)
+{
+    dbxlockext *X;
+    if(!epicsAtomicGetIntT(&L->biased))
+        return NULL;
+    /* once biased, ext is never free'd */
+    epicsAtomicReadMemoryBarrier();
+    X = DBXLOCK_EXT(L);
+    return X ? X->bias : NULL;
+}
+
+/* Exclude dbxLockSweep() while using the refs[] cache or locked list */
+static inline
+void dbxlockerenter(dbxLocker *ptr)
+{
+    while(epicsAtomicCmpAndSwapIntT(&ptr->busy, 0, 1)!=0)
+        epicsThreadSleep(0.0);
+}
+
+static inline
+void dbxlockerexit(dbxLocker *ptr)
+{
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicSetIntT(&ptr->busy, 0);
+}
+/* dbxUnlockMany() from within dbxlockerenter() */
+void dbxunlockmany(dbxLocker *ptr);
+/* A and B must be locked */
+dbxLockLink* dbxlockrefjoin(dbxLocker *ptr, dbxLockRef *A, dbxLockRef *B);
+
+/* Tracepoints.  See dbx/tracepoint.h */
+#if defined(DBXLOCK_TRACEPOINTS) && defined(DBXLOCK_USDT)
+#  include <sys/sdt.h>
+#  define DBXTP(NAME, A, B) DTRACE_PROBE2(dbxlock, NAME, A, B)
+
+#elif defined(DBXLOCK_TRACEPOINTS)
+extern size_t dbxtpcount[dbxTPMax];
+extern dbxTracePointFn dbxtpfn[dbxTPMax];
+
+static inline
+void dbxtracepoint(dbxTracePoint point, const void *A, const void *B)
+{
+    dbxTracePointFn fn = dbxtpfn[point];
+    epicsAtomicIncrSizeT(&dbxtpcount[point]);
+    if(fn)
+        (*fn)(point, A, B);
+}
+#  define DBXTP(NAME, A, B) dbxtracepoint(dbxTP##NAME, A, B)
+
+#else
+#  define DBXTP(NAME, A, B) do{}while(0)
+#endif
+
+/* see dbxmetrics.c.  dbxmetricsbase is NULL unless enabled */
+extern char *dbxmetricsbase;
+size_t* dbxmetricsslot(void);
+/* move one lockset from the oldsz to the newsz histogram bucket.  0 for none */
+void dbxmetricshist(size_t oldsz, size_t newsz);
+
+#define DBXMETRIC_ADD(NAME, N) do { \
+    if(dbxmetricsbase) epicsAtomicAddSizeT(&dbxmetricsslot()[dbxMetric##NAME], (size_t)(N)); \
+    } while(0)
+#define DBXMETRIC_HIST(OLD, NEW) do { \
+    if(dbxmetricsbase) dbxmetricshist(OLD, NEW); \
+    } while(0)
+
+/* A dbxLock starts thin, held by setting word from DBXLOCK_FREE to _THIN.
+ * The first dbxthinlock() which must wait inflates it, creating the mutex.
+ * Once inflated, the holder also has the mutex, and word stays _FAT.
+ * Not recursive.  See holder and depth.
+ */
+#define DBXLOCK_FREE 0
+#define DBXLOCK_THIN 1
+#define DBXLOCK_FAT 2
+
+/* returns non-zero if locked */
+static inline
+int dbxthintrylock(dbxLock *L)
+{
+    if(!epicsAtomicGetIntT(&L->inflated))
+        return epicsAtomicCmpAndSwapIntT(&L->word, DBXLOCK_FREE, DBXLOCK_THIN)==DBXLOCK_FREE;
+    if(!dbxmutextrylock(&L->lock))
+        return 0;
+    if(epicsAtomicGetIntT(&L->word)==DBXLOCK_FAT ||
+       epicsAtomicCmpAndSwapIntT(&L->word, DBXLOCK_FREE, DBXLOCK_FAT)==DBXLOCK_FREE)
+        return 1;
+    /* still held thin */
+    dbxmutexunlock(&L->lock);
+    return 0;
+}
+
+/* see dbxlock.c */
+void dbxthinlock(dbxLock *L);
+
+static inline
+void dbxthinunlock(dbxLock *L)
+{
+    if(epicsAtomicCmpAndSwapIntT(&L->word, DBXLOCK_THIN, DBXLOCK_FREE)!=DBXLOCK_THIN)
+        dbxmutexunlock(&L->lock);
+}
+
+/* lock a dbxLock.  Try first when we need to know if this would block */
+#ifdef DBXLOCK_TRACEPOINTS
+#  define DBXLOCK_TRYFIRST 1
+#else
+#  define DBXLOCK_TRYFIRST (dbxmetricsbase!=NULL)
+#endif
+
+/* Re-entry by the holder only increments depth.
+ * The first acquisition takes a ref to L, released by the last DBXLOCK_UNLOCK,
+ * unless HAVEREF when the caller already has one to give.
+ */
+#define DBXLOCK_CONTENDED(L, NAME, A, HAVEREF) do { \
+    epicsThreadId self_ = epicsThreadGetIdSelf(); \
+    if((L)->holder==self_) { \
+        (L)->depth++; \
+    } else { \
+        if(!HAVEREF) \
+            dbxlockref(L); \
+        if(!DBXLOCK_TRYFIRST) { \
+            dbxthinlock(L); \
+        } else if(!dbxthintrylock(L)) { \
+            DBXTP(NAME, A, L); \
+            DBXMETRIC_ADD(Contended, 1); \
+            dbxthinlock(L); \
+        } \
+        if(dbxlockbias(L)) \
+            dbxbiaslocked(L); \
+        (L)->holder = self_; \
+        (L)->depth = 1; \
+        DBXMETRIC_ADD(Acquire, 1); \
+    } \
+    } while(0)
+
+/* see dbxnuma.c */
+#define DBXNUMA_MAXNODES 64
+/* sample one in DBXNUMA_SAMPLE+1 releases */
+#define DBXNUMA_SAMPLE 63
+/* net samples for a node before moving a lock there, and the most kept */
+#define DBXNUMA_MINVOTE 8
+#define DBXNUMA_MAXVOTE 64
+
+extern int dbxnumaactive;
+extern int dbxnumanodes;
+/* node of the CPU of this thread */
+int dbxnumaself(void);
+/* zero'd memory on node.  Never free'd.  NULL on failure */
+void* dbxnumaalloc(size_t size, int node);
+/* with L held */
+void dbxnumasample(dbxLock *L);
+/* node which mostly holds L, or -1 if not yet known */
+int dbxnumapreferred(const dbxLock *L);
+void dbxnumamerge(dbxLock *dst, const dbxLock *src);
+/* Should join merge A into B, which is on the preferred node */
+int dbxnumajoin(const dbxLock *A, const dbxLock *B);
+
+/* see dbxbias.c */
+#define DBXBIAS_NHELD 8
+
+/* per-thread.  Locks held through the bias fast path.
+ * Only written by the owning thread.
+ */
+typedef struct dbxbiasowner {
+    dbxLock * volatile held[DBXBIAS_NHELD];
+    /* on the free list, after the thread exits.  See dbxbiasself() */
+    struct dbxbiasowner *next;
+} dbxbiasowner;
+
+extern int dbxbiasactive;
+dbxbiasowner* dbxbiasself(void);
+/* with L locked.  Wait until L is not biased to another thread.
+ * May unlock and re-lock.
+ */
+void dbxbiaslocked(dbxLock *L);
+/* with L locked.  Returns 1 if L is not biased to another thread,
+ * or 0 after unlocking.
+ */
+int dbxbiastrylocked(dbxLock *L);
+/* with L locked.  Bias an un-biased L to this thread */
+void dbxbiasclaim(dbxLock *L);
+
+/* try to lock L as any other thread would.  Caller must have a ref */
+static inline
+int dbxlocktrylock(dbxLock *L)
+{
+    epicsThreadId self = epicsThreadGetIdSelf();
+    if(L->holder==self) {
+        L->depth++;
+        return 1;
+    }
+    if(!dbxthintrylock(L))
+        return 0;
+    if(dbxlockbias(L) && !dbxbiastrylocked(L))
+        return 0;
+    dbxlockref(L);
+    L->holder = self;
+    L->depth = 1;
+    return 1;
+}
+
+/* see dbxplan.c */
+/* With refs[i].ref set.  Fill in refs[i].lock, taking refs, from a valid
+ * plan for the same refs.  Returns 0 on success.  Otherwise sets *hash
+ * for dbxplanput().
+ */
+int dbxplanget(dbxLocker *ptr, size_t *hash);
+/* After dbxupdaterefs().  Save refs[] as the plan for these refs */
+void dbxplanput(dbxLocker *ptr, size_t hash);
+
+/* see dbxLockerExtend().  Out of order try-locks before re-locking */
+#define DBXEXTEND_NTRY 8
+/* see dbxLockMany().  # of retries which release all locks, w/ backoff,
+ * before instead keeping those held.  Holding a lock blocks join and
+ * split of its lockset, so refs stop moving as more are held.
+ */
+extern int dbxRetryEscalate;
+
+/* see dbxasync.c */
+/* Add W to the wait queue of L, then try to lock.
+ * Returns 0 if L is now locked, and W is no longer queued.
+ * W may have been woken anyway.
+ */
+int dbxlockwait(dbxLock *L, dbxlockwaiter *W);
+/* L must not be held */
+void dbxlockwakeone(dbxLock *L);
+/* with L held.  For a split, after which waiters may want another lock */
+void dbxlockwakeall(dbxLock *L);
+/* Add W to the wait queue of L, w/o trying to lock.  It is woken by an unlock */
+void dbxlockenqueue(dbxLock *L, dbxlockwaiter *W);
+/* Remove W if still queued, on whichever lock.  Returns 0 if it was not,
+ * as W was woken.  The lock W was queued on must be held, or ref'd.
+ */
+int dbxlockdequeue(dbxlockwaiter *W);
+/* with both held.  Waiters of src, which a join emptied, wait for dst */
+void dbxlockmovewaiters(dbxLock *dst, dbxLock *src);
+
+/* see dbxdelegate.c */
+/* run pending closures.  L must be locked */
+void dbxdelegatedrain(dbxLock *L);
+/* after unlock, drain closures added meanwhile */
+void dbxdelegateunlocked(dbxLock *L);
+
+/* With depth==1.  Run pending closures, end a write, and unlock.
+ * Keeps the ref, and wakes no one.
+ */
+#define DBXLOCK_DROP(L) do { \
+    if(dbxlockdelegates(L)) \
+        dbxdelegatedrain(L); \
+    if((L)->wseq&1) \
+        epicsAtomicIncrSizeT(&(L)->wseq); \
+    if(dbxnumaactive && (++(L)->numatick&DBXNUMA_SAMPLE)==0) \
+        dbxnumasample(L); \
+    (L)->depth = 0; \
+    (L)->holder = NULL; \
+    dbxthinunlock(L); \
+    } while(0)
+
+/* With depth==1.  DBXLOCK_DROP, run closures added meanwhile, wake one
+ * waiter, then release the ref taken by DBXLOCK_CONTENDED or dbxlocktrylock().
+ */
+#define DBXLOCK_RELEASE(L) do { \
+    DBXLOCK_DROP(L); \
+    if(dbxlockdelegates(L)) \
+        dbxdelegateunlocked(L); \
+    if(dbxlocknwaiters(L)) \
+        dbxlockwakeone(L); \
+    dbxlockunref(L); \
+    } while(0)
+
+/* Undo one DBXLOCK_CONTENDED or dbxlocktrylock() */
+#define DBXLOCK_UNLOCK(L) do { \
+    assert((L)->depth>0); \
+    if((L)->depth>1) \
+        (L)->depth--; \
+    else \
+        DBXLOCK_RELEASE(L); \
+    } while(0)
+
+/* see dbxtrace.c */
+extern int dbxtraceactive; /* Atomic */
+epicsUInt64 dbxtracenow(void);
+/* T0 - start, T1 - acquired, T2 - released */
+void dbxtraceemit(dbxTraceOp op, dbxLockRef *ref, dbxLockRef *ref2, dbxLock *lock,
+                  size_t index, size_t count,
+                  epicsUInt64 T0, epicsUInt64 T1, epicsUInt64 T2);
 
 #ifdef DBXSPIN_ATOMIC
 #define alloclock(R) do{}while(0)
@@ -0,0 +1,219 @@
+
+#include <stdlib.h>
+
+#include <cantProceed.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+/* FIFO queue lock (MCS).
+ *
+ * Each thread waiting for, or holding, a lock has a queue node.
+ * The lock word points to the last node.  A waiter links itself
+ * behind its predecessor and polls a flag in its own node,
+ * which the predecessor clears on unlock.  So the lock is handed
+ * off in arrival order, and each waiter spins on a different cache line.
+ *
+ * After dbxMCSSpin polls a waiter parks on a per-thread epicsEvent.
+ *
+ * Nodes are kept on a per-thread free list and never free'd.
+ * A node may be touched by the predecessor after the waiter has
+ * returned (see dbxmcsgrant()) so must stay valid.
+ */
+
+enum {
+    dbxMCSGranted,
+    dbxMCSWaiting,
+    dbxMCSParked,
+};
+
+struct dbxmcsnode {
+    dbxmcsnode *next; /* successor.  Atomic */
+    int state;        /* Atomic */
+    epicsEventId wakeup; /* of the owning thread */
+    dbxmcsnode *freenext;
+    char pad[64-3*sizeof(void*)-2*sizeof(int)]; /* one per cache line */
+};
+
+typedef struct {
+    epicsEventId wakeup;
+    dbxmcsnode *free;
+} dbxmcsthread;
+
+int dbxMCSSpin = 1000;
+
+static epicsThreadOnceId mcsonce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId mcskey;
+
+static void dbxmcsonce(void *x)
+{
+    const char *env = getenv("DBX_MCS_SPIN");
+    mcskey = epicsThreadPrivateCreate();
+    if(env)
+        dbxMCSSpin = atoi(env);
+    else if(epicsThreadGetCPUs()<=1)
+        dbxMCSSpin = 0; /* the holder can't run while we spin */
+}
+
+static
+dbxmcsthread* dbxmcsself(void)
+{
+    dbxmcsthread *T = epicsThreadPrivateGet(mcskey);
+    if(!T) {
+        T = callocMustSucceed(1, sizeof(*T), "dbxmcsself");
+        T->wakeup = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadPrivateSet(mcskey, T);
+    }
+    return T;
+}
+
+static
+dbxmcsnode* dbxmcsget(void)
+{
+    dbxmcsthread *T = dbxmcsself();
+    dbxmcsnode *N = T->free;
+    if(N) {
+        T->free = N->freenext;
+    } else {
+        N = callocMustSucceed(1, sizeof(*N), "dbxmcsget");
+        N->wakeup = T->wakeup;
+    }
+    N->next = NULL;
+    N->state = dbxMCSWaiting;
+    return N;
+}
+
+/* must be called by the thread which dbxmcsget() the node */
+static
+void dbxmcsput(dbxmcsnode *N)
+{
+    dbxmcsthread *T = dbxmcsself();
+    N->freenext = T->free;
+    T->free = N;
+}
+
+static
+void dbxmcswait(dbxmcsnode *N)
+{
+    int i;
+
+    for(i=0; i<dbxMCSSpin; i++) {
+        if(epicsAtomicGetIntT(&N->state)==dbxMCSGranted)
+            return;
+    }
+
+    if(epicsAtomicCmpAndSwapIntT(&N->state, dbxMCSWaiting, dbxMCSParked)!=dbxMCSWaiting)
+        return; /* granted meanwhile */
+
+    /* the event may also have been left set by a previous grant */
+    while(epicsAtomicGetIntT(&N->state)!=dbxMCSGranted)
+        epicsEventMustWait(N->wakeup);
+}
+
+static
+void dbxmcsgrant(dbxmcsnode *N)
+{
+    epicsEventId wakeup = N->wakeup;
+
+    if(epicsAtomicCmpAndSwapIntT(&N->state, dbxMCSWaiting, dbxMCSGranted)!=dbxMCSWaiting) {
+        /* parked.  N may be re-used as soon as state is set */
+        epicsAtomicSetIntT(&N->state, dbxMCSGranted);
+        epicsEventSignal(wakeup);
+    }
+}
+
+static
+void dbxmcsowned(dbxmcs *M, dbxmcsnode *N, epicsThreadId self)
+{
+    M->holder = N;
+    M->owner = self;
+    M->depth = 1;
+}
+
+int dbxmcsinit(dbxmcs *M)
+{
+    epicsThreadOnce(&mcsonce, &dbxmcsonce, NULL);
+    memset(M, 0, sizeof(*M));
+    return 0;
+}
+
+void dbxmcsclean(dbxmcs *M)
+{
+    assert(M->tail==NULL && M->owner==NULL);
+}
+
+void dbxmcslock(dbxmcs *M)
+{
+    epicsThreadId self = epicsThreadGetIdSelf();
+    dbxmcsnode *N, *prev;
+
+    if(M->owner==self) {
+        M->depth++;
+        return;
+    }
+
+    N = dbxmcsget();
+
+    do {
+        prev = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&M->tail);
+    } while(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&M->tail, prev, N)!=prev);
+
+    if(prev) {
+        epicsAtomicSetPtrT((EpicsAtomicPtrT*)&prev->next, N);
+        dbxmcswait(N);
+    }
+
+    dbxmcsowned(M, N, self);
+}
+
+int dbxmcstrylock(dbxmcs *M)
+{
+    epicsThreadId self = epicsThreadGetIdSelf();
+    dbxmcsnode *N;
+
+    if(M->owner==self) {
+        M->depth++;
+        return 1;
+    }
+
+    if(epicsAtomicGetPtrT((EpicsAtomicPtrT*)&M->tail))
+        return 0;
+
+    N = dbxmcsget();
+    if(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&M->tail, NULL, N)!=NULL) {
+        dbxmcsput(N);
+        return 0;
+    }
+
+    dbxmcsowned(M, N, self);
+    return 1;
+}
+
+void dbxmcsunlock(dbxmcs *M)
+{
+    dbxmcsnode *N = M->holder, *next;
+
+    assert(M->owner==epicsThreadGetIdSelf() && M->depth>0);
+    if(--M->depth)
+        return;
+
+    M->owner = NULL;
+    M->holder = NULL;
+
+    next = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&N->next);
+    if(!next) {
+        if(epicsAtomicCmpAndSwapPtrT((EpicsAtomicPtrT*)&M->tail, N, NULL)==N) {
+            dbxmcsput(N);
+            return;
+        }
+        /* a waiter has swapped tail, but not yet linked to us */
+        while((next = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&N->next))==NULL)
+            epicsThreadSleep(0.0);
+    }
+
+    dbxmcsgrant(next);
+    dbxmcsput(N);
+}
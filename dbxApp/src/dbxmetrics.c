@@ -0,0 +1,166 @@
+
+#ifdef __linux__
+#  define _GNU_SOURCE
+#  include <sched.h>
+#endif
+
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  define HAVE_MMAP
+#endif
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+/* slot stride is a multiple of the cache line size */
+#define SLOTALIGN 64
+
+char *dbxmetricsbase;
+
+static size_t nslots, slotsize;
+
+size_t* dbxmetricsslot(void)
+{
+    size_t idx;
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    idx = cpu<0 ? 0 : cpu;
+#else
+    idx = ((size_t)epicsThreadGetIdSelf())/SLOTALIGN;
+#endif
+    return (size_t*)(dbxmetricsbase + SLOTALIGN + (idx%nslots)*slotsize);
+}
+
+static
+unsigned dbxmetricsbucket(size_t sz)
+{
+    unsigned b = 0;
+    while(sz>>=1)
+        b++;
+    return b<DBXMETRICS_NHIST ? b : DBXMETRICS_NHIST-1;
+}
+
+void dbxmetricshist(size_t oldsz, size_t newsz)
+{
+    size_t *hist = dbxmetricsslot()+dbxMetricMax;
+
+    if(oldsz)
+        epicsAtomicDecrSizeT(&hist[dbxmetricsbucket(oldsz)]);
+    if(newsz)
+        epicsAtomicIncrSizeT(&hist[dbxmetricsbucket(newsz)]);
+}
+
+/************ public api ***********/
+
+int dbxLockMetricsOpen(const char *fname)
+{
+#ifdef HAVE_MMAP
+    static int opened;
+    dbxMetricsHeader *head;
+    size_t len;
+    int fd;
+    void *base;
+
+    if(epicsAtomicCmpAndSwapIntT(&opened, 0, 1)!=0) {
+        errlogPrintf("dbxLockMetrics: already open\n");
+        return 1;
+    }
+
+    assert(sizeof(dbxMetricsHeader)<=SLOTALIGN);
+
+    nslots = epicsThreadGetCPUs();
+    if(nslots<1)
+        nslots = 1;
+    slotsize = (dbxMetricMax+DBXMETRICS_NHIST)*sizeof(size_t);
+    slotsize = (slotsize+SLOTALIGN-1)&~(size_t)(SLOTALIGN-1);
+    len = SLOTALIGN + nslots*slotsize;
+
+    fd = open(fname, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if(fd<0) {
+        errlogPrintf("dbxLockMetrics: Can't open '%s'\n", fname);
+        return 1;
+    }
+    if(ftruncate(fd, len)) {
+        errlogPrintf("dbxLockMetrics: Can't size '%s'\n", fname);
+        close(fd);
+        return 1;
+    }
+    base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED) {
+        errlogPrintf("dbxLockMetrics: Can't map '%s'\n", fname);
+        return 1;
+    }
+
+    /* file is zero filled.  Fill in the header, magic last. */
+    head = base;
+    head->version = DBXMETRICS_VERSION;
+    head->wordsize = sizeof(size_t);
+    head->nslots = nslots;
+    head->slotsize = slotsize;
+    head->headsize = SLOTALIGN;
+    head->ncounters = dbxMetricMax;
+    head->nhist = DBXMETRICS_NHIST;
+    epicsAtomicWriteMemoryBarrier();
+    memcpy(head->magic, DBXMETRICS_MAGIC, sizeof(head->magic));
+
+    /* never unmapped */
+    epicsAtomicSetPtrT((EpicsAtomicPtrT*)&dbxmetricsbase, base);
+    return 0;
+#else
+    errlogPrintf("dbxLockMetrics: not supported on this target\n");
+    return 1;
+#endif
+}
+
+int dbxLockMetricsSum(const void *base, size_t len,
+                      epicsUInt64 *counters, epicsUInt64 *hist)
+{
+    const dbxMetricsHeader *head = base;
+    const char *slot;
+    size_t i, j, ncounters, nhist;
+
+    memset(counters, 0, dbxMetricMax*sizeof(*counters));
+    memset(hist, 0, DBXMETRICS_NHIST*sizeof(*hist));
+
+    if(len<sizeof(*head) || memcmp(head->magic, DBXMETRICS_MAGIC, sizeof(head->magic))!=0
+            || head->version!=DBXMETRICS_VERSION
+            || (head->wordsize!=4 && head->wordsize!=8)
+            || len < head->headsize + (size_t)head->nslots*head->slotsize
+            || head->slotsize < (head->ncounters+head->nhist)*head->wordsize)
+        return 1;
+
+    ncounters = head->ncounters<dbxMetricMax ? head->ncounters : dbxMetricMax;
+    nhist = head->nhist<DBXMETRICS_NHIST ? head->nhist : DBXMETRICS_NHIST;
+
+    for(i=0, slot=(const char*)base+head->headsize; i<head->nslots; i++, slot+=head->slotsize) {
+        for(j=0; j<ncounters+nhist; j++) {
+            size_t idx = j<ncounters ? j : head->ncounters+j-ncounters;
+            epicsUInt64 val;
+            if(head->wordsize==4)
+                val = ((const volatile epicsUInt32*)slot)[idx];
+            else
+                val = ((const volatile epicsUInt64*)slot)[idx];
+
+            if(j<ncounters)
+                counters[j] += val;
+            else
+                hist[j-ncounters] += val;
+        }
+    }
+    if(head->wordsize==4) {
+        for(j=0; j<ncounters; j++)
+            counters[j] &= 0xffffffffu;
+        for(j=0; j<nhist; j++)
+            hist[j] &= 0xffffffffu;
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* Print lock statistics published by dbxLockMetricsOpen()
+ *
+ *  dbxmetricsdump [-i <period>] <metrics file>
+ *
+ * With -i, print again every period seconds until interrupted.
+ * Reads the mapped file only, so may be run against a live IOC.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <epicsThread.h>
+#include <dbDefs.h>
+
+#include "dbx/metrics.h"
+
+static const char *names[dbxMetricMax] = {
+    "acquire",
+    "contended",
+    "retry",
+    "join",
+    "split",
+    "merge",
+    "divide",
+    "locks",
+    "refs",
+    "links",
+    "delegate",
+    "combine",
+    "biashit",
+    "biasrevoke",
+    "extendbackoff",
+    "extendrelock",
+    "inflate",
+    "stale",
+    "sweep",
+    "planhit",
+    "planmiss",
+    "retrybackoff",
+    "escalate",
+    "condmorph",
+    "numamigrate",
+};
+
+static
+void show(const void *base, size_t len)
+{
+    epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+    size_t i;
+
+    if(dbxLockMetricsSum(base, len, counters, hist)) {
+        fprintf(stderr, "Not a version %u metrics file\n", DBXMETRICS_VERSION);
+        exit(1);
+    }
+
+    for(i=0; i<dbxMetricMax; i++)
+        printf("%-10s %llu\n", names[i], (unsigned long long)counters[i]);
+    printf("lockset size histogram\n");
+    for(i=0; i<DBXMETRICS_NHIST; i++) {
+        if(hist[i])
+            printf("  [%lu, %lu) %llu\n", 1ul<<i, 2ul<<i, (unsigned long long)hist[i]);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = NULL;
+    double period = 0.0;
+    struct stat info;
+    void *base;
+    int i, fd;
+
+    for(i=1; i<argc; i++) {
+        if(strcmp(argv[i], "-i")==0 && i+1<argc)
+            period = atof(argv[++i]);
+        else if(argv[i][0]=='-' || fname) {
+            fprintf(stderr, "Usage: %s [-i <period>] <metrics file>\n", argv[0]);
+            return 1;
+        } else
+            fname = argv[i];
+    }
+    if(!fname) {
+        fprintf(stderr, "Usage: %s [-i <period>] <metrics file>\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if(fd<0 || fstat(fd, &info)) {
+        perror("open");
+        return 1;
+    }
+    base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    show(base, info.st_size);
+    while(period>0.0) {
+        epicsThreadSleep(period);
+        printf("\n");
+        show(base, info.st_size);
+    }
+
+    munmap(base, info.st_size);
+    return 0;
+}
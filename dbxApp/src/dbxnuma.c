@@ -0,0 +1,193 @@
+#ifdef __linux__
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/mempolicy.h>
+#  if defined(__NR_mbind) && defined(__NR_getcpu)
+#    define HAVE_NUMA
+#  endif
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+/* NUMA placement.
+ *
+ * dbxLock memory is carved from slabs bound to one node with mbind(),
+ * and kept in a pool per node when free'd.  A new lock is placed on the
+ * node of the allocating thread.
+ *
+ * One in DBXNUMA_SAMPLE+1 releases samples the node of the holder.
+ * A majority vote over samples, kept in the lock, gives the node which
+ * mostly holds it.  Join merges into the lock on that node, if either
+ * is.  Join and split then move the refs of a lock placed elsewhere
+ * to a new lock on that node.  See dbxlockmigrate()
+ */
+
+#define DBXNUMA_SLAB (64*1024)
+#define DBXNUMA_ALIGN 64
+
+int dbxnumaactive;
+int dbxnumanodes = 1;
+
+static epicsThreadOnceId numaonce = EPICS_THREAD_ONCE_INIT;
+static int numaok;
+
+/* next free byte of the current slab of each node.  Guarded by slablock */
+static char *slabnext[DBXNUMA_MAXNODES], *slabend[DBXNUMA_MAXNODES];
+static epicsMutexId slablock;
+
+static void dbxnumaonce(void *x)
+{
+    slablock = epicsMutexMustCreate();
+#ifdef HAVE_NUMA
+    {
+        /* eg. "0-1" */
+        FILE *fp = fopen("/sys/devices/system/node/online", "r");
+        char buf[64];
+        const char *last;
+        int n;
+
+        if(fp && fgets(buf, sizeof(buf), fp)) {
+            last = buf;
+            for(n=0; buf[n]; n++) {
+                if(buf[n]=='-' || buf[n]==',')
+                    last = &buf[n+1];
+            }
+            n = atoi(last)+1;
+            if(n>DBXNUMA_MAXNODES)
+                n = DBXNUMA_MAXNODES;
+            dbxnumanodes = n>0 ? n : 1;
+        }
+        if(fp)
+            fclose(fp);
+        numaok = 1;
+    }
+#endif
+}
+
+int dbxnumaself(void)
+{
+#ifdef HAVE_NUMA
+    unsigned cpu, node;
+    if(syscall(__NR_getcpu, &cpu, &node, NULL)==0 && node<DBXNUMA_MAXNODES)
+        return (int)node;
+#endif
+    return 0;
+}
+
+void* dbxnumaalloc(size_t size, int node)
+{
+    char *ret = NULL;
+
+    assert(node>=0 && node<DBXNUMA_MAXNODES);
+    size = (size+DBXNUMA_ALIGN-1)&~(size_t)(DBXNUMA_ALIGN-1);
+    assert(size<=DBXNUMA_SLAB);
+
+    epicsMutexMustLock(slablock);
+#ifdef HAVE_NUMA
+    if(slabend[node]-slabnext[node] < (ptrdiff_t)size) {
+        unsigned long mask[DBXNUMA_MAXNODES/(8*sizeof(unsigned long))] = {0};
+        void *slab = mmap(NULL, DBXNUMA_SLAB, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+        if(slab!=MAP_FAILED) {
+            /* before first touch.  If refused, the memory is still usable */
+            mask[node/(8*sizeof(unsigned long))] = 1ul<<(node%(8*sizeof(unsigned long)));
+            (void)syscall(__NR_mbind, slab, DBXNUMA_SLAB, MPOL_PREFERRED,
+                          mask, DBXNUMA_MAXNODES+1, 0);
+            slabnext[node] = slab;
+            slabend[node] = slabnext[node]+DBXNUMA_SLAB;
+        }
+    }
+    if(slabend[node]-slabnext[node] >= (ptrdiff_t)size) {
+        /* zero'd by mmap() */
+        ret = slabnext[node];
+        slabnext[node] += size;
+    }
+#endif
+    epicsMutexUnlock(slablock);
+    return ret;
+}
+
+void dbxnumasample(dbxLock *L)
+{
+    dbxlockext *X = dbxlockextget(L);
+    int node = dbxnumaself();
+
+    if(X->numacand==node) {
+        if(X->numavote<DBXNUMA_MAXVOTE)
+            X->numavote++;
+    } else if(X->numavote==0) {
+        X->numacand = node;
+        X->numavote = 1;
+    } else {
+        X->numavote--;
+    }
+}
+
+int dbxnumapreferred(const dbxLock *L)
+{
+    const dbxlockext *X = DBXLOCK_EXT(L);
+    return X && X->numavote>=DBXNUMA_MINVOTE ? X->numacand : -1;
+}
+
+/* combine the votes c2,v2 into cand,vote */
+static
+void dbxnumacombine(int *cand, int *vote, int c2, int v2)
+{
+    if(*cand==c2) {
+        *vote += v2;
+        if(*vote>DBXNUMA_MAXVOTE)
+            *vote = DBXNUMA_MAXVOTE;
+    } else if(v2>*vote) {
+        *cand = c2;
+        *vote = v2-*vote;
+    } else {
+        *vote -= v2;
+    }
+}
+
+void dbxnumamerge(dbxLock *dst, const dbxLock *src)
+{
+    const dbxlockext *Xsrc = DBXLOCK_EXT(src);
+    dbxlockext *Xdst;
+
+    if(!Xsrc || Xsrc->numavote==0)
+        return; /* no votes */
+    Xdst = dbxlockextget(dst);
+    dbxnumacombine(&Xdst->numacand, &Xdst->numavote, Xsrc->numacand, Xsrc->numavote);
+}
+
+int dbxnumajoin(const dbxLock *A, const dbxLock *B)
+{
+    const dbxlockext *XA = DBXLOCK_EXT(A), *XB = DBXLOCK_EXT(B);
+    int cand = XA ? XA->numacand : 0, vote = XA ? XA->numavote : 0;
+
+    if(XB)
+        dbxnumacombine(&cand, &vote, XB->numacand, XB->numavote);
+    if(vote<DBXNUMA_MINVOTE)
+        return 0;
+    return A->numanode!=cand && B->numanode==cand;
+}
+
+/************ public api ***********/
+
+int dbxLockNuma(int enable)
+{
+    epicsThreadOnce(&numaonce, &dbxnumaonce, NULL);
+    if(enable && !numaok) {
+        errlogPrintf("dbxLockNuma: not supported on this target\n");
+        return 1;
+    }
+    epicsAtomicSetIntT(&dbxnumaactive, !!enable);
+    return 0;
+}
@@ -0,0 +1,67 @@
+
+#include <errlog.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+
+#ifdef DBXLOCK_HAVE_PI
+
+#include <unistd.h>
+
+/* Priority inheriting mutex.
+ *
+ * The kernel tracks the owning thread of each mutex, and boosts it
+ * to the priority of the highest waiter.  Transitively when the owner
+ * is itself waiting for another mutex.  eg. one of several locked by
+ * dbxLockMany().
+ *
+ * Like epicsMutex, must be unlocked by the thread which locked it.
+ */
+
+int dbxpiinit(dbxpi *M)
+{
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT>=0
+    pthread_mutexattr_t attr;
+    int ret;
+
+    if(pthread_mutexattr_init(&attr))
+        return 1;
+    ret = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if(!ret)
+        ret = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    if(!ret)
+        ret = pthread_mutex_init(M, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if(ret)
+        errlogPrintf("dbxpiinit: error %d\n", ret);
+    return ret!=0;
+#else
+    errlogPrintf("dbxpiinit: PTHREAD_PRIO_INHERIT not supported\n");
+    return 1;
+#endif
+}
+
+void dbxpiclean(dbxpi *M)
+{
+    int ret = pthread_mutex_destroy(M);
+    assert(ret==0);
+}
+
+void dbxpilock(dbxpi *M)
+{
+    int ret = pthread_mutex_lock(M);
+    assert(ret==0);
+}
+
+int dbxpitrylock(dbxpi *M)
+{
+    return pthread_mutex_trylock(M)==0;
+}
+
+void dbxpiunlock(dbxpi *M)
+{
+    int ret = pthread_mutex_unlock(M);
+    assert(ret==0);
+}
+
+#endif /* DBXLOCK_HAVE_PI */
@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsAssert.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+
+/* Lock plan cache.  See DBXLOCKER_PLAN
+ *
+ * A plan is the refs[] of a dbxLocker after dbxupdaterefs(), keyed by
+ * its refs sorted by address, with the gen of each lock in refs[i].gen.
+ *
+ * dbxLock::gen is a sequence count.  It is odd while refs are moved out
+ * of the lock, so a plan is only saved if each gen is even, and unchanged
+ * after checking each ref against its lock.  A plan is valid while each
+ * gen is unchanged, as then none of its refs has moved.
+ *
+ * Plans take no refs, so may name locks since free'd.  dbxLock memory
+ * is never free'd (see dbxlockalloc()), and gen is kept on re-use,
+ * so a ref is taken only if the lock is still live (dbxlocktryref())
+ * and gen then checked.
+ *
+ * A ref may move after the check.  dbxLockMany() then finds it
+ * as the locker recomp is from before the check.
+ */
+
+#define DBXPLAN_NBUCKETS 256
+/* beyond which a new plan replaces the oldest in its bucket */
+#define DBXPLAN_MAX 4096
+
+typedef struct {
+    ELLNODE node;
+    size_t hash, nrefs;
+    dbxLockRef **key;     /* [nrefs] sorted */
+    dbx_locker_ref *refs; /* [nrefs] as dbxLocker::refs */
+} dbxplan;
+
+static epicsThreadOnceId planonce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId planlock;
+static ELLLIST plans[DBXPLAN_NBUCKETS];
+static size_t nplans;
+
+static void dbxplanonce(void *x)
+{
+    planlock = epicsMutexMustCreate();
+}
+
+/* by ref */
+static
+int dbxplancomp(const void *rawA, const void *rawB)
+{
+    const dbx_locker_ref *A = rawA, *B = rawB;
+    return A->ref < B->ref ? -1 : A->ref > B->ref ? 1 : 0;
+}
+
+static
+int dbxplankeycomp(const void *rawA, const void *rawB)
+{
+    dbxLockRef *A = *(dbxLockRef**)rawA, *B = *(dbxLockRef**)rawB;
+    return A < B ? -1 : A > B ? 1 : 0;
+}
+
+/* with planlock */
+static
+dbxplan* dbxplanfind(dbxLocker *ptr, size_t hash)
+{
+    ELLNODE *cur;
+
+    ELL_FOREACH(&plans[hash%DBXPLAN_NBUCKETS], cur) {
+        dbxplan *P = CONTAINER(cur, dbxplan, node);
+        size_t i;
+
+        if(P->hash!=hash || P->nrefs!=ptr->maxrefs)
+            continue;
+        for(i=0; i<P->nrefs; i++) {
+            if(P->key[i]!=ptr->refs[i].ref)
+                break;
+        }
+        if(i==P->nrefs)
+            return P;
+    }
+    return NULL;
+}
+
+int dbxplanget(dbxLocker *ptr, size_t *phash)
+{
+    size_t i, hash = 14695981039346656037ull;
+    dbxplan *P;
+    int ret = 1;
+
+    epicsThreadOnce(&planonce, &dbxplanonce, NULL);
+
+    qsort(ptr->refs, ptr->maxrefs, sizeof(*ptr->refs), &dbxplancomp);
+    for(i=0; i<ptr->maxrefs; i++) {
+        hash ^= (size_t)ptr->refs[i].ref;
+        hash *= 1099511628211ull;
+    }
+    *phash = hash;
+
+    epicsMutexMustLock(planlock);
+    P = dbxplanfind(ptr, hash);
+    if(P) {
+        for(i=0; i<P->nrefs; i++) {
+            dbxLock *L = P->refs[i].lock;
+
+            if(!L)
+                continue;
+            if(!dbxlocktryref(L))
+                break;
+            if(epicsAtomicGetSizeT(&L->gen)!=P->refs[i].gen) {
+                dbxlockunref(L);
+                break;
+            }
+        }
+        if(i==P->nrefs) {
+            memcpy(ptr->refs, P->refs, P->nrefs*sizeof(*P->refs));
+            ret = 0;
+        } else {
+            /* stale */
+            while(i--) {
+                if(P->refs[i].lock)
+                    dbxlockunref(P->refs[i].lock);
+            }
+        }
+    }
+    epicsMutexUnlock(planlock);
+
+    if(ret)
+        DBXMETRIC_ADD(PlanMiss, 1);
+    else
+        DBXMETRIC_ADD(PlanHit, 1);
+    return ret;
+}
+
+void dbxplanput(dbxLocker *ptr, size_t hash)
+{
+    size_t i, n = ptr->maxrefs;
+    dbxplan *P, *old;
+    ELLLIST *bucket = &plans[hash%DBXPLAN_NBUCKETS];
+
+    epicsThreadOnce(&planonce, &dbxplanonce, NULL);
+
+    P = malloc(sizeof(*P) + n*(sizeof(*P->key)+sizeof(*P->refs)));
+    if(!P)
+        return;
+    P->hash = hash;
+    P->nrefs = n;
+    P->refs = (dbx_locker_ref*)(P+1);
+    P->key = (dbxLockRef**)(P->refs+n);
+
+    memcpy(P->refs, ptr->refs, n*sizeof(*P->refs));
+    for(i=0; i<n; i++) {
+        dbxLock *L = P->refs[i].lock;
+        P->key[i] = P->refs[i].ref;
+        P->refs[i].gen = L ? epicsAtomicGetSizeT(&L->gen) : 0;
+        if(P->refs[i].gen&1)
+            goto stale;
+    }
+    epicsAtomicReadMemoryBarrier();
+    /* no ref moved since these gens */
+    for(i=0; i<n; i++) {
+        dbx_locker_ref *ref = &P->refs[i];
+        dbxLock *cur;
+
+        if(!ref->ref)
+            continue;
+        slock(ref->ref);
+        cur = ref->ref->lock;
+        sunlock(ref->ref);
+        if(cur!=ref->lock)
+            goto stale;
+    }
+    epicsAtomicReadMemoryBarrier();
+    for(i=0; i<n; i++) {
+        if(P->refs[i].lock && epicsAtomicGetSizeT(&P->refs[i].lock->gen)!=P->refs[i].gen)
+            goto stale;
+    }
+    qsort(P->key, n, sizeof(*P->key), &dbxplankeycomp);
+
+    epicsMutexMustLock(planlock);
+    /* replace any stale plan for the same refs */
+    {
+        ELLNODE *cur;
+        ELL_FOREACH(bucket, cur) {
+            old = CONTAINER(cur, dbxplan, node);
+            if(old->hash==hash && old->nrefs==n &&
+               memcmp(old->key, P->key, n*sizeof(*P->key))==0)
+                break;
+        }
+        if(!cur)
+            old = NULL;
+    }
+    if(!old && nplans>=DBXPLAN_MAX) {
+        old = (dbxplan*)ellFirst(bucket);
+        if(!old) {
+            /* full, and none to replace here */
+            epicsMutexUnlock(planlock);
+            goto stale;
+        }
+    }
+    if(old) {
+        ellDelete(bucket, &old->node);
+        free(old);
+    } else {
+        nplans++;
+    }
+    ellAdd(bucket, &P->node);
+    epicsMutexUnlock(planlock);
+    return;
+stale:
+    free(P);
+}
+
+void dbxLockPlanFlush(void)
+{
+    size_t i;
+
+    epicsThreadOnce(&planonce, &dbxplanonce, NULL);
+
+    epicsMutexMustLock(planlock);
+    for(i=0; i<DBXPLAN_NBUCKETS; i++) {
+        ELLNODE *cur;
+        ELL_FOREACH_POP(&plans[i], cur) {
+            free(CONTAINER(cur, dbxplan, node));
+        }
+    }
+    nplans = 0;
+    epicsMutexUnlock(planlock);
+}
@@ -0,0 +1,460 @@
+/* Replay a lock event trace captured with dbxLockTraceStart()
+ *
+ *  dbxreplay [-s <scale>] <trace.bin>
+ *
+ * One thread is created for each thread in the trace.  Each operation is
+ * started at its original time offset, and locks are held for their original
+ * duration, multiplied by the scale factor (default 1.0).  -s 0 replays
+ * as quickly as possible.
+ *
+ * All refs start out as singletons.  Joins which happened before the trace
+ * was started are not known, and splits of unknown links are ignored.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+
+typedef struct {
+    epicsUInt16 op;
+    epicsUInt16 thread;
+    size_t nrefs;
+    size_t *refs; /* indices into replay refs[] */
+    epicsUInt64 time, wait, hold;
+} replayop;
+
+typedef struct replaythread {
+    epicsUInt16 id;
+    replayop *ops;
+    size_t nops;
+    epicsEventId done;
+
+    size_t nwait;
+    epicsUInt64 sumwait, maxwait;
+    epicsUInt64 origsumwait, origmaxwait;
+} replaythread;
+
+typedef struct linkentry {
+    struct linkentry *next;
+    size_t A, B;
+    dbxLockLink *link;
+} linkentry;
+
+static double scale = 1.0;
+static epicsUInt64 traceT0, replayT0;
+
+static dbxLockRef *refs;
+static size_t nrefs;
+
+static epicsMutexId linklock;
+static linkentry **linktable;
+static size_t linkmask;
+static size_t nunknown;
+
+static
+int reccomp(const void *rawA, const void *rawB)
+{
+    const dbxTraceRecord *A = rawA, *B = rawB;
+    if(A->thread!=B->thread)
+        return A->thread<B->thread ? -1 : 1;
+    if(A->time!=B->time)
+        return A->time<B->time ? -1 : 1;
+    if(A->op!=B->op)
+        return A->op<B->op ? -1 : 1;
+    if(A->index!=B->index)
+        return A->index<B->index ? -1 : 1;
+    return 0;
+}
+
+static
+int idcomp(const void *rawA, const void *rawB)
+{
+    epicsUInt64 A = *(const epicsUInt64*)rawA, B = *(const epicsUInt64*)rawB;
+    return A<B ? -1 : A>B ? 1 : 0;
+}
+
+static
+size_t hashlink(size_t A, size_t B)
+{
+    return (A*2654435761u ^ B)&linkmask;
+}
+
+static
+void linkPush(size_t A, size_t B, dbxLockLink *link)
+{
+    linkentry *ent = calloc(1, sizeof(*ent));
+    size_t h = hashlink(A, B);
+    if(!ent)
+        return;
+    ent->A = A;
+    ent->B = B;
+    ent->link = link;
+    epicsMutexMustLock(linklock);
+    ent->next = linktable[h];
+    linktable[h] = ent;
+    epicsMutexUnlock(linklock);
+}
+
+static
+dbxLockLink* linkPop(size_t A, size_t B)
+{
+    linkentry **pent, *ent = NULL;
+    dbxLockLink *link = NULL;
+    size_t h = hashlink(A, B);
+
+    epicsMutexMustLock(linklock);
+    for(pent=&linktable[h]; *pent; pent=&(*pent)->next) {
+        if((*pent)->A==A && (*pent)->B==B) {
+            ent = *pent;
+            *pent = ent->next;
+            break;
+        }
+    }
+    if(!ent)
+        nunknown++;
+    epicsMutexUnlock(linklock);
+
+    if(ent) {
+        link = ent->link;
+        free(ent);
+    }
+    return link;
+}
+
+static
+void waitUntil(epicsUInt64 target)
+{
+    epicsUInt64 now;
+    while((now=epicsMonotonicGet())<target) {
+        if(target-now > 2000000u)
+            epicsThreadSleep((target-now-1000000u)*1e-9);
+    }
+}
+
+static
+epicsUInt64 scaled(epicsUInt64 dt)
+{
+    return (epicsUInt64)(dt*scale);
+}
+
+static size_t runOp(replaythread *self, size_t i, dbxLocker *outer);
+
+/* run ops nested within the critical section of op i */
+static
+size_t runNested(replaythread *self, size_t i, dbxLocker *outer)
+{
+    replayop *op = &self->ops[i];
+    epicsUInt64 end = op->time + op->wait + op->hold;
+    size_t j = i+1;
+
+    while(j<self->nops && self->ops[j].time < end)
+        j = runOp(self, j, outer);
+    return j;
+}
+
+static
+dbxLocker* lockerFor(replayop *op)
+{
+    dbxLockRef *prefs[64], **pprefs = prefs;
+    dbxLocker *locker;
+    size_t i;
+
+    if(op->nrefs>NELEMENTS(prefs))
+        pprefs = malloc(op->nrefs*sizeof(*pprefs));
+    if(!pprefs)
+        return NULL;
+    for(i=0; i<op->nrefs; i++)
+        pprefs[i] = &refs[op->refs[i]];
+    locker = dbxLockerAlloc(pprefs, op->nrefs, 0);
+    if(pprefs!=prefs)
+        free(pprefs);
+    return locker;
+}
+
+/* returns index of next op to run */
+static
+size_t runOp(replaythread *self, size_t i, dbxLocker *outer)
+{
+    replayop *op = &self->ops[i];
+    epicsUInt64 T0, T1;
+    size_t next = i+1;
+
+    if(scale>0.0)
+        waitUntil(replayT0 + scaled(op->time - traceT0));
+
+    switch(op->op) {
+    case dbxTraceLockOne: {
+        dbxLock *L;
+        T0 = epicsMonotonicGet();
+        L = dbxLockOne(&refs[op->refs[0]], 0);
+        T1 = epicsMonotonicGet();
+        next = runNested(self, i, outer);
+        waitUntil(T1 + scaled(op->hold));
+        dbxUnlockOne(L);
+        break;
+    }
+    case dbxTraceLockMany: {
+        dbxLocker *locker = lockerFor(op);
+        if(!locker) {
+            fprintf(stderr, "Alloc fails\n");
+            exit(1);
+        }
+        T0 = epicsMonotonicGet();
+        dbxLockMany(locker, 0);
+        T1 = epicsMonotonicGet();
+        next = runNested(self, i, locker);
+        waitUntil(T1 + scaled(op->hold));
+        dbxUnlockMany(locker);
+        dbxLockerFree(locker);
+        break;
+    }
+    case dbxTraceJoin:
+    case dbxTraceSplit: {
+        dbxLocker *locker = outer;
+        dbxLockLink *link;
+
+        if(!locker) {
+            /* trace began while locked.  Make our own */
+            locker = lockerFor(op);
+            if(!locker) {
+                fprintf(stderr, "Alloc fails\n");
+                exit(1);
+            }
+            dbxLockMany(locker, 0);
+        }
+        T0 = T1 = epicsMonotonicGet();
+        if(op->op==dbxTraceJoin) {
+            link = dbxLockRefJoin(locker, &refs[op->refs[0]], &refs[op->refs[1]]);
+            if(link)
+                linkPush(op->refs[0], op->refs[1], link);
+        } else {
+            link = linkPop(op->refs[0], op->refs[1]);
+            if(link)
+                dbxLockRefSplit(locker, link);
+        }
+        if(locker!=outer) {
+            dbxUnlockMany(locker);
+            dbxLockerFree(locker);
+        }
+        return next;
+    }
+    default:
+        return next;
+    }
+
+    self->nwait++;
+    self->sumwait += T1-T0;
+    if(T1-T0 > self->maxwait)
+        self->maxwait = T1-T0;
+    self->origsumwait += op->wait;
+    if(op->wait > self->origmaxwait)
+        self->origmaxwait = op->wait;
+    return next;
+}
+
+static
+void replayTask(void *raw)
+{
+    replaythread *self = raw;
+    size_t i = 0;
+
+    while(i<self->nops)
+        i = runOp(self, i, NULL);
+
+    epicsEventSignal(self->done);
+}
+
+static
+size_t refIndex(const epicsUInt64 *ids, size_t nids, epicsUInt64 id)
+{
+    const epicsUInt64 *pos = bsearch(&id, ids, nids, sizeof(*ids), &idcomp);
+    assert(pos);
+    return pos-ids;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fp;
+    dbxTraceHeader head;
+    dbxTraceRecord *recs = NULL;
+    size_t nrecs = 0, maxrecs = 0, i, nops = 0, nthreads = 0, nids = 0;
+    epicsUInt64 *ids, traceT1 = 0, T1;
+    replayop *ops;
+    size_t *oprefs;
+    replaythread *threads;
+    const char *fname = NULL;
+    size_t nwait = 0;
+    epicsUInt64 sumwait = 0, maxwait = 0, origsumwait = 0, origmaxwait = 0;
+
+    for(i=1; i<(size_t)argc; i++) {
+        if(strcmp(argv[i], "-s")==0 && i+1<(size_t)argc)
+            scale = atof(argv[++i]);
+        else if(argv[i][0]=='-' || fname) {
+            fprintf(stderr, "Usage: %s [-s <scale>] <trace.bin>\n", argv[0]);
+            return 1;
+        } else
+            fname = argv[i];
+    }
+    if(!fname) {
+        fprintf(stderr, "Usage: %s [-s <scale>] <trace.bin>\n", argv[0]);
+        return 1;
+    }
+
+    if(!(fp = fopen(fname, "rb"))) {
+        perror("open");
+        return 1;
+    }
+    if(fread(&head, sizeof(head), 1, fp)!=1 ||
+            memcmp(head.magic, DBXTRACE_MAGIC, sizeof(head.magic))!=0 ||
+            head.version!=DBXTRACE_VERSION ||
+            head.recsize!=sizeof(dbxTraceRecord))
+    {
+        fprintf(stderr, "%s: Not a version %u trace file\n", fname, DBXTRACE_VERSION);
+        return 1;
+    }
+    while(1) {
+        size_t n;
+        if(nrecs==maxrecs) {
+            maxrecs = maxrecs ? maxrecs*2 : 4096;
+            recs = realloc(recs, maxrecs*sizeof(*recs));
+            if(!recs) {
+                fprintf(stderr, "Alloc fails\n");
+                return 1;
+            }
+        }
+        n = fread(recs+nrecs, sizeof(*recs), maxrecs-nrecs, fp);
+        if(n==0)
+            break;
+        nrecs += n;
+    }
+    fclose(fp);
+
+    if(nrecs==0) {
+        fprintf(stderr, "%s: empty trace\n", fname);
+        return 1;
+    }
+
+    /* map ref ids to replay refs */
+    ids = malloc(2*nrecs*sizeof(*ids));
+    assert(ids);
+    for(i=0; i<nrecs; i++) {
+        if(recs[i].ref)
+            ids[nids++] = recs[i].ref;
+        if(recs[i].ref2)
+            ids[nids++] = recs[i].ref2;
+    }
+    qsort(ids, nids, sizeof(*ids), &idcomp);
+    for(i=0, nrefs=0; i<nids; i++) {
+        if(nrefs==0 || ids[nrefs-1]!=ids[i])
+            ids[nrefs++] = ids[i];
+    }
+    nids = nrefs;
+
+    refs = calloc(nrefs, sizeof(*refs));
+    assert(refs);
+    for(i=0; i<nrefs; i++)
+        dbxLockRefInit(&refs[i], 0);
+
+    /* group records into operations */
+    qsort(recs, nrecs, sizeof(*recs), &reccomp);
+
+    ops = calloc(nrecs, sizeof(*ops));
+    oprefs = calloc(2*nrecs, sizeof(*oprefs));
+    assert(ops && oprefs);
+
+    traceT0 = recs[0].time;
+    for(i=0; i<nrecs; i++) {
+        dbxTraceRecord *rec = &recs[i];
+        replayop *op = nops ? &ops[nops-1] : NULL;
+
+        if(!rec->ref)
+            continue; /* unused locker entry, from older traces */
+
+        if(!op || rec->index==0 || op->op!=rec->op || op->thread!=rec->thread
+                || op->time!=rec->time)
+        {
+            op = &ops[nops++];
+            op->op = rec->op;
+            op->thread = rec->thread;
+            op->time = rec->time;
+            op->wait = rec->wait;
+            op->hold = rec->hold;
+            op->refs = oprefs;
+            if(rec->thread>=nthreads)
+                nthreads = rec->thread+1u;
+        }
+        op->refs[op->nrefs++] = refIndex(ids, nids, rec->ref);
+        oprefs++;
+        if(rec->ref2) {
+            op->refs[op->nrefs++] = refIndex(ids, nids, rec->ref2);
+            oprefs++;
+        }
+
+        if(rec->time < traceT0)
+            traceT0 = rec->time;
+        if(rec->time+rec->wait+rec->hold > traceT1)
+            traceT1 = rec->time+rec->wait+rec->hold;
+    }
+
+    for(linkmask=1; linkmask<nops; linkmask<<=1) {}
+    linktable = calloc(linkmask, sizeof(*linktable));
+    linkmask--;
+    linklock = epicsMutexMustCreate();
+    assert(linktable);
+
+    threads = calloc(nthreads, sizeof(*threads));
+    assert(threads);
+    for(i=0; i<nops; i++) {
+        replaythread *T = &threads[ops[i].thread];
+        if(!T->ops)
+            T->ops = &ops[i];
+        T->nops++;
+    }
+
+    printf("%lu records, %lu operations, %lu refs, %lu threads, %.3f sec.\n",
+           (unsigned long)nrecs, (unsigned long)nops, (unsigned long)nrefs,
+           (unsigned long)nthreads, (traceT1-traceT0)*1e-9);
+
+    replayT0 = epicsMonotonicGet();
+    for(i=0; i<nthreads; i++) {
+        replaythread *T = &threads[i];
+        T->id = i;
+        T->done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("replay",
+                              epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              &replayTask, T);
+    }
+    for(i=0; i<nthreads; i++) {
+        replaythread *T = &threads[i];
+        epicsEventMustWait(T->done);
+        nwait += T->nwait;
+        sumwait += T->sumwait;
+        origsumwait += T->origsumwait;
+        if(T->maxwait>maxwait)
+            maxwait = T->maxwait;
+        if(T->origmaxwait>origmaxwait)
+            origmaxwait = T->origmaxwait;
+    }
+    T1 = epicsMonotonicGet();
+
+    printf("Replay took %.3f sec.\n", (T1-replayT0)*1e-9);
+    printf("%10s %12s %12s\n", "wait (ns)", "trace", "replay");
+    printf("%10s %12.0f %12.0f\n", "mean",
+           nwait ? origsumwait/(double)nwait : 0.0,
+           nwait ? sumwait/(double)nwait : 0.0);
+    printf("%10s %12llu %12llu\n", "max",
+           (unsigned long long)origmaxwait, (unsigned long long)maxwait);
+    if(nunknown)
+        printf("%lu splits of unknown links ignored\n", (unsigned long)nunknown);
+
+    return 0;
+}
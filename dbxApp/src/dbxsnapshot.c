@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define HAVE_MMAP
+#endif
+
+#include <errlog.h>
+#include <epicsAssert.h>
+
+#include "dbxlock_priv.h"
+#include "dbx/snapshot.h"
+
+#define NOCOMP ((epicsUInt32)-1)
+
+typedef struct {
+    dbxLock *lock;
+    size_t idx;
+} dbxsnapref;
+
+/* by lock, then by ref index */
+static
+int dbxsnapcomp(const void *rawA, const void *rawB)
+{
+    const dbxsnapref *A = rawA, *B = rawB;
+    if(A->lock!=B->lock)
+        return A->lock < B->lock ? -1 : 1;
+    return A->idx < B->idx ? -1 : A->idx > B->idx ? 1 : 0;
+}
+
+static
+epicsUInt64 dbxsnaphash(epicsUInt64 hash, epicsUInt32 val)
+{
+    unsigned i;
+    for(i=0; i<4; i++, val>>=8) {
+        hash ^= val&0xff;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/* fold the component numbers into hash */
+static
+epicsUInt64 dbxsnaphashcomps(epicsUInt64 hash, const epicsUInt32 *comp, size_t nrefs)
+{
+    size_t i;
+    for(i=0; i<nrefs; i++)
+        hash = dbxsnaphash(hash, comp[i]);
+    return hash;
+}
+
+/* map, or read, all of fname.  Returns NULL on failure */
+static
+void* dbxsnapread(const char *fname, size_t *len)
+{
+#ifdef HAVE_MMAP
+    struct stat st;
+    void *base;
+    int fd = open(fname, O_RDONLY);
+
+    if(fd<0)
+        return NULL;
+    if(fstat(fd, &st) || st.st_size==0) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED)
+        return NULL;
+    *len = st.st_size;
+    return base;
+#else
+    FILE *fp = fopen(fname, "rb");
+    void *base = NULL;
+    long size;
+
+    if(!fp)
+        return NULL;
+    if(fseek(fp, 0, SEEK_END)==0 && (size = ftell(fp))>0 && fseek(fp, 0, SEEK_SET)==0) {
+        base = malloc(size);
+        if(base && fread(base, 1, size, fp)!=(size_t)size) {
+            free(base);
+            base = NULL;
+        }
+        *len = size;
+    }
+    fclose(fp);
+    return base;
+#endif
+}
+
+static
+void dbxsnaprelease(void *base, size_t len)
+{
+#ifdef HAVE_MMAP
+    munmap(base, len);
+#else
+    free(base);
+#endif
+}
+
+/************ public api ***********/
+
+epicsUInt64 dbxLockSnapshotHash(size_t nrefs, const size_t *linkA,
+                                const size_t *linkB, size_t nlinks)
+{
+    epicsUInt64 hash = 14695981039346656037ull;
+    size_t i;
+
+    hash = dbxsnaphash(hash, nrefs);
+    for(i=0; i<nlinks; i++) {
+        hash = dbxsnaphash(hash, linkA[i]);
+        hash = dbxsnaphash(hash, linkB[i]);
+    }
+    return hash;
+}
+
+int dbxLockSnapshotSave(const char *fname, dbxLockRef **refs, size_t nrefs,
+                        const size_t *linkA, const size_t *linkB, size_t nlinks)
+{
+    dbxSnapshotHeader head;
+    dbxsnapref *sorted;
+    epicsUInt32 *comp, *remap, *pairs, ngroup = 0;
+    size_t i;
+    FILE *fp;
+    int ret = 1;
+
+    if(nrefs>=NOCOMP || nlinks>=NOCOMP/2) {
+        errlogPrintf("dbxLockSnapshotSave: too many refs or links\n");
+        return 1;
+    }
+
+    sorted = malloc((nrefs+1)*sizeof(*sorted));
+    comp = malloc((nrefs+1)*sizeof(*comp));
+    remap = malloc((nrefs+1)*sizeof(*remap));
+    pairs = malloc((2*nlinks+1)*sizeof(*pairs));
+    if(!sorted || !comp || !remap || !pairs)
+        goto done;
+
+    for(i=0; i<nrefs; i++) {
+        slock(refs[i]);
+        sorted[i].lock = refs[i]->lock;
+        sunlock(refs[i]);
+        sorted[i].idx = i;
+    }
+    qsort(sorted, nrefs, sizeof(*sorted), &dbxsnapcomp);
+
+    /* group refs by lock, then number groups by lowest ref */
+    for(i=0; i<nrefs; i++) {
+        if(i==0 || sorted[i].lock!=sorted[i-1].lock)
+            remap[ngroup++] = NOCOMP;
+        comp[sorted[i].idx] = ngroup-1;
+    }
+    head.ncomps = 0;
+    for(i=0; i<nrefs; i++) {
+        if(remap[comp[i]]==NOCOMP)
+            remap[comp[i]] = head.ncomps++;
+        comp[i] = remap[comp[i]];
+    }
+
+    for(i=0; i<nlinks; i++) {
+        if(linkA[i]>=nrefs || linkB[i]>=nrefs || comp[linkA[i]]!=comp[linkB[i]]) {
+            errlogPrintf("dbxLockSnapshotSave: link %u is not joined\n", (unsigned)i);
+            goto done;
+        }
+        pairs[2*i] = linkA[i];
+        pairs[2*i+1] = linkB[i];
+    }
+
+    memcpy(head.magic, DBXSNAPSHOT_MAGIC, sizeof(head.magic));
+    head.version = DBXSNAPSHOT_VERSION;
+    head.nrefs = nrefs;
+    head.nlinks = nlinks;
+    head.hash = dbxsnaphashcomps(dbxLockSnapshotHash(nrefs, linkA, linkB, nlinks),
+                                 comp, nrefs);
+
+    fp = fopen(fname, "wb");
+    if(!fp) {
+        errlogPrintf("dbxLockSnapshotSave: can't open %s\n", fname);
+        goto done;
+    }
+    if(fwrite(&head, sizeof(head), 1, fp)==1 &&
+            fwrite(comp, sizeof(*comp), nrefs, fp)==nrefs &&
+            fwrite(pairs, sizeof(*pairs), 2*nlinks, fp)==2*nlinks)
+        ret = 0;
+    if(fclose(fp))
+        ret = 1;
+    if(ret)
+        errlogPrintf("dbxLockSnapshotSave: write error %s\n", fname);
+
+done:
+    free(sorted);
+    free(comp);
+    free(remap);
+    free(pairs);
+    return ret;
+}
+
+int dbxLockSnapshotLoad(const char *fname, dbxLockRef **refs, size_t nrefs,
+                        const size_t *linkA, const size_t *linkB, size_t nlinks,
+                        dbxLockLink **links)
+{
+    const dbxSnapshotHeader *head;
+    const epicsUInt32 *comp, *pairs;
+    dbxLock **locks = NULL;
+    epicsUInt32 ncomps = 0;
+    size_t i, len = 0;
+    void *base;
+    int ret = 1;
+
+    base = dbxsnapread(fname, &len);
+    if(!base)
+        return 1;
+    head = base;
+
+    if(len<sizeof(*head) || memcmp(head->magic, DBXSNAPSHOT_MAGIC, sizeof(head->magic))!=0
+            || head->version!=DBXSNAPSHOT_VERSION)
+    {
+        errlogPrintf("dbxLockSnapshotLoad: %s is not a snapshot\n", fname);
+        goto done;
+    }
+    if(head->nrefs!=nrefs || head->nlinks!=nlinks
+            || len!=sizeof(*head)+(nrefs+2*nlinks)*sizeof(*comp))
+        goto stale;
+    comp = (const epicsUInt32*)(head+1);
+    pairs = comp+nrefs;
+    if(head->hash!=dbxsnaphashcomps(dbxLockSnapshotHash(nrefs, linkA, linkB, nlinks),
+                                    comp, nrefs))
+        goto stale;
+    /* the refs of each link are in one component */
+    for(i=0; i<nlinks; i++) {
+        if(pairs[2*i]!=linkA[i] || pairs[2*i+1]!=linkB[i]
+                || linkA[i]>=nrefs || linkB[i]>=nrefs
+                || comp[linkA[i]]!=comp[linkB[i]])
+            goto stale;
+    }
+    /* each component has refs, and is numbered after its lowest */
+    for(i=0; i<nrefs; i++) {
+        if(comp[i]==ncomps)
+            ncomps++;
+        else if(comp[i]>ncomps)
+            goto stale;
+    }
+    if(ncomps!=head->ncomps)
+        goto stale;
+
+    for(i=0; i<nrefs; i++)
+        assert(refs[i]->lock==NULL && refs[i]->spin==0);
+
+    locks = calloc(ncomps+1, sizeof(*locks));
+    for(i=0; locks && i<ncomps; i++) {
+        locks[i] = dbxlockalloc();
+        if(!locks[i])
+            break;
+    }
+    if(!locks || i<ncomps) {
+        for(i=0; locks && i<ncomps; i++)
+            dbxlockunref(locks[i]);
+        goto done;
+    }
+
+    for(i=0; i<nrefs; i++) {
+        dbxLockRef *R = refs[i];
+        dbxLock *L = locks[comp[i]];
+
+        memset(R, 0, sizeof(*R));
+        R->lock = L;
+        alloclock(R);
+        /* the first uses the initial ref */
+        if(ellCount(&L->refsets))
+            L->refcnt++;
+        ellAdd(&L->refsets, &R->refsetsNode);
+    }
+    DBXMETRIC_ADD(Refs, nrefs);
+    for(i=0; i<ncomps; i++)
+        DBXMETRIC_HIST(0, ellCount(&locks[i]->refsets));
+
+    /* refs of each link already share a lock, so no merging */
+    for(i=0; i<nlinks; i++)
+        links[i] = dbxlockrefjoin(NULL, refs[linkA[i]], refs[linkB[i]]);
+
+    ret = 0;
+    goto done;
+stale:
+    errlogPrintf("dbxLockSnapshotLoad: %s does not match\n", fname);
+done:
+    free(locks);
+    dbxsnaprelease(base, len);
+    return ret;
+}
@@ -0,0 +1,266 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsTypes.h>
+#include <epicsAssert.h>
+
+#include "dbxtopo.h"
+
+typedef struct {
+    size_t n, max;
+    size_t *A, *B;
+} pairlist;
+
+/* xorshift, rand_r() has too few bits for large topologies */
+static
+epicsUInt32 topoRand(epicsUInt32 *state)
+{
+    epicsUInt32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static
+double topoUniform(epicsUInt32 *state)
+{
+    return topoRand(state)/4294967296.0;
+}
+
+static
+size_t topoPick(epicsUInt32 *state, size_t n)
+{
+    return (size_t)(topoUniform(state)*n);
+}
+
+/* power law distributed size >=2 */
+static
+size_t topoPowerLaw(epicsUInt32 *state, double alpha, size_t max)
+{
+    double u = topoUniform(state);
+    size_t sz = (size_t)(2.0*pow(1.0-u, -1.0/(alpha-1.0)));
+    return sz>max ? max : sz;
+}
+
+static
+int pairAdd(pairlist *P, size_t A, size_t B)
+{
+    if(P->n==P->max) {
+        size_t nmax = P->max ? P->max*2 : 1024;
+        size_t *nA = realloc(P->A, nmax*sizeof(*nA)),
+               *nB = nA ? realloc(P->B, nmax*sizeof(*nB)) : NULL;
+        if(nA) P->A = nA;
+        if(nB) P->B = nB;
+        if(!nA || !nB)
+            return 1;
+        P->max = nmax;
+    }
+    P->A[P->n] = A;
+    P->B[P->n] = B;
+    P->n++;
+    return 0;
+}
+
+/* plan links for refs [base, base+k) */
+static
+int topoSubsystem(const dbxTopoConfig *conf, epicsUInt32 *state,
+                  pairlist *P, size_t *ends, size_t base, size_t k)
+{
+    size_t j, nends = 0, nextra;
+
+    for(j=1; j<k; j++) {
+        size_t peer;
+
+        if(nends==0)
+            peer = base;
+        else if(topoUniform(state)<conf->pchain)
+            peer = base+j-1; /* FLNK chain */
+        else
+            peer = ends[topoPick(state, nends)]; /* hub */
+
+        /* the existing ref first so that the new lock merges into the old */
+        if(pairAdd(P, peer, base+j))
+            return 1;
+        ends[nends++] = peer;
+        ends[nends++] = base+j;
+    }
+
+    nextra = (size_t)(k*conf->extra + topoUniform(state));
+    for(j=0; j<nextra; j++) {
+        size_t A = base+topoPick(state, k),
+               B = base+topoPick(state, k);
+        if(A!=B && pairAdd(P, A, B))
+            return 1;
+    }
+    return 0;
+}
+
+static
+dbxLockLink* topoJoin(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2] = {A, B};
+    dbxLockLink *link = NULL;
+    dbxLocker *locker = dbxLockerAlloc(refs, 2, 0);
+
+    if(locker) {
+        if(!dbxLockMany(locker, 0)) {
+            link = dbxLockRefJoin(locker, A, B);
+            dbxUnlockMany(locker);
+        }
+        dbxLockerFree(locker);
+    }
+    return link;
+}
+
+static
+int lockptrcomp(const void *rawA, const void *rawB)
+{
+    const dbxLock *A = *(dbxLock* const*)rawA, *B = *(dbxLock* const*)rawB;
+    return A<B ? -1 : A>B ? 1 : 0;
+}
+
+/************ public api ***********/
+
+void dbxTopoDefaults(dbxTopoConfig *conf, size_t nrefs)
+{
+    memset(conf, 0, sizeof(*conf));
+    conf->nrefs = nrefs;
+    conf->seed = 1;
+    conf->singletons = 0.5;
+    conf->giantfrac = 0.1;
+    conf->ngiant = 2;
+    conf->alpha = 2.0;
+    conf->maxsubsys = 500;
+    conf->pchain = 0.5;
+    conf->extra = 0.05;
+}
+
+dbxTopo* dbxTopoCreate(const dbxTopoConfig *conf)
+{
+    dbxTopo *topo;
+    pairlist P;
+    epicsUInt32 state = conf->seed ? conf->seed : 1;
+    size_t i, base = 0, ngiant = conf->ngiant,
+           giantsz, nlinked, maxsz;
+    size_t *ends = NULL;
+
+    assert(conf->alpha>1.0);
+    memset(&P, 0, sizeof(P));
+
+    topo = calloc(1, sizeof(*topo));
+    if(!topo)
+        return NULL;
+    topo->nrefs = conf->nrefs;
+    topo->refs = calloc(conf->nrefs ? conf->nrefs : 1, sizeof(*topo->refs));
+
+    nlinked = conf->nrefs - (size_t)(conf->nrefs*conf->singletons);
+    giantsz = ngiant ? (size_t)(conf->nrefs*conf->giantfrac)/ngiant : 0;
+    if(giantsz<2)
+        ngiant = giantsz = 0;
+    if(giantsz*ngiant > nlinked)
+        giantsz = nlinked/ngiant;
+
+    maxsz = giantsz>conf->maxsubsys ? giantsz : conf->maxsubsys;
+    ends = malloc(2*(maxsz+1)*sizeof(*ends));
+
+    if(!topo->refs || !ends)
+        goto fail;
+
+    /* plan links */
+    for(i=0; i<ngiant; i++, base+=giantsz) {
+        if(topoSubsystem(conf, &state, &P, ends, base, giantsz))
+            goto fail;
+    }
+    while(base+2 <= nlinked) {
+        size_t k = topoPowerLaw(&state, conf->alpha, conf->maxsubsys);
+        if(base+k > nlinked)
+            k = nlinked-base;
+        if(topoSubsystem(conf, &state, &P, ends, base, k))
+            goto fail;
+        base += k;
+    }
+    /* remaining refs are singletons */
+
+    free(ends);
+    ends = NULL;
+
+    topo->nlinks = P.n;
+    topo->linkA = P.A;
+    topo->linkB = P.B;
+    P.A = P.B = NULL;
+    topo->links = calloc(topo->nlinks ? topo->nlinks : 1, sizeof(*topo->links));
+    if(!topo->links)
+        goto fail;
+
+    /* build */
+    for(i=0; i<topo->nrefs; i++) {
+        if(dbxLockRefInit(&topo->refs[i], 0))
+            goto fail;
+    }
+    for(i=0; i<topo->nlinks; i++) {
+        topo->links[i] = topoJoin(&topo->refs[topo->linkA[i]],
+                                  &topo->refs[topo->linkB[i]]);
+        if(!topo->links[i])
+            goto fail;
+    }
+
+    return topo;
+fail:
+    free(ends);
+    free(P.A);
+    free(P.B);
+    dbxTopoFree(topo);
+    return NULL;
+}
+
+void dbxTopoFree(dbxTopo *topo)
+{
+    size_t i;
+
+    if(!topo)
+        return;
+
+    for(i=0; topo->refs && i<topo->nrefs; i++) {
+        if(topo->refs[i].lock)
+            dbxLockRefClean(&topo->refs[i]);
+    }
+    /* free links orphaned by dbxLockRefClean() */
+    for(i=0; topo->links && i<topo->nlinks; i++) {
+        if(topo->links[i])
+            dbxLockRefSplit(NULL, topo->links[i]);
+    }
+
+    free(topo->refs);
+    free(topo->links);
+    free(topo->linkA);
+    free(topo->linkB);
+    free(topo);
+}
+
+void dbxTopoCount(const dbxTopo *topo, size_t *nsets, size_t *largest)
+{
+    size_t i, run = 0;
+    dbxLock **locks = malloc((topo->nrefs ? topo->nrefs : 1)*sizeof(*locks));
+
+    *nsets = *largest = 0;
+    if(!locks)
+        return;
+
+    for(i=0; i<topo->nrefs; i++)
+        locks[i] = topo->refs[i].lock;
+    qsort(locks, topo->nrefs, sizeof(*locks), &lockptrcomp);
+
+    for(i=0; i<topo->nrefs; i++) {
+        if(i==0 || locks[i]!=locks[i-1]) {
+            (*nsets)++;
+            run = 0;
+        }
+        run++;
+        if(run>*largest)
+            *largest = run;
+    }
+    free(locks);
+}
@@ -0,0 +1,62 @@
+#ifndef DBXTOPO_H
+#define DBXTOPO_H
+
+#include <stddef.h>
+
+#include "dbx/lock.h"
+
+/* Synthetic lockset topologies resembling an EPICS database.
+ * For use by tests and benchmarks.
+ *
+ * Refs are divided into subsystems whose sizes follow a power law,
+ * plus a few giant subsystems.  Within a subsystem records are
+ * connected by FLNK-like chains, and by hub records (eg. FANOUT or CALC)
+ * chosen by preferential attachment, which gives a power law link degree.
+ * Some redundant links are added so that not every split breaks a lockset.
+ */
+
+typedef struct {
+    size_t nrefs;
+    unsigned int seed;
+
+    /* fraction of refs which are never linked */
+    double singletons;
+    /* fraction of refs in giant subsystems */
+    double giantfrac;
+    size_t ngiant;
+    /* Size of normal subsystems are drawn from a power law
+     * with this exponent (>1), up to maxsubsys.
+     */
+    double alpha;
+    size_t maxsubsys;
+    /* probability that a record is added to the end of a chain
+     * instead of being attached to a hub.
+     */
+    double pchain;
+    /* number of redundant links per record in a subsystem */
+    double extra;
+} dbxTopoConfig;
+
+typedef struct {
+    size_t nrefs;
+    dbxLockRef *refs;
+
+    /* one entry for each call to dbxLockRefJoin().
+     * Refs are refs[linkA[i]] and refs[linkB[i]].
+     */
+    size_t nlinks;
+    dbxLockLink **links;
+    size_t *linkA, *linkB;
+} dbxTopo;
+
+void dbxTopoDefaults(dbxTopoConfig *conf, size_t nrefs);
+
+/* Initialize refs and join according to conf */
+dbxTopo* dbxTopoCreate(const dbxTopoConfig *conf);
+/* Clean all refs and links */
+void dbxTopoFree(dbxTopo *topo);
+
+/* Count distinct locksets, and the number of refs in the largest */
+void dbxTopoCount(const dbxTopo *topo, size_t *nsets, size_t *largest);
+
+#endif /* DBXTOPO_H */
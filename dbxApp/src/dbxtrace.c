@@ -0,0 +1,368 @@
+
+#include <stdio.h>
+
+#include <errlog.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAssert.h>
+#include <dbDefs.h>
+
+#include "dbxlock_priv.h"
+
+#define NTRACEBUF 1024
+
+/* Records are kept in per-thread blocks.  A full block is handed to a
+ * writer thread, so no record is written to the file by the thread which
+ * made it.  Blocks are free'd when the trace stops.
+ */
+typedef struct {
+    ELLNODE node;
+    size_t nrecs;
+    dbxTraceRecord recs[NTRACEBUF];
+} dbxtraceblock;
+
+/* per-thread.  Reclaimed when the trace stops, then re-used by any thread.
+ * Never free'd, as the previous owner may still look at it.
+ */
+typedef struct {
+    ELLNODE node;
+    epicsMutexId lock; /* only contended during dbxLockTraceStop() */
+    /* Guarded by lock */
+    epicsThreadId owner; /* NULL once reclaimed */
+    epicsUInt16 thread;
+    int trace; /* thread is numbered in this trace */
+    dbxtraceblock *cur;
+} dbxtracebuf;
+
+int dbxtraceactive; /* Atomic */
+
+static epicsThreadOnceId traceonce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId tracekey;
+
+/* Guards the following */
+static epicsMutexId tracelock;
+static FILE *tracefile;
+static ELLLIST tracebufs; /* owned dbxtracebuf */
+static ELLLIST freebufs;  /* reclaimed dbxtracebuf */
+static ELLLIST fullblocks, freeblocks;
+static int writerstop;
+/* threads are numbered from 0 in each trace, in order of first record.
+ * Also read w/o tracelock.  Atomic
+ */
+static int tracecur;
+static epicsUInt16 tracenextthread;
+
+static epicsEventId writerwake, writerdone;
+static int writeerr; /* only used by the writer */
+
+static void dbxtraceonce(void *x)
+{
+    tracekey = epicsThreadPrivateCreate();
+    tracelock = epicsMutexMustCreate();
+    writerwake = epicsEventMustCreate(epicsEventEmpty);
+    writerdone = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/* Write full blocks until stopped, then those left */
+static
+void dbxtracewriter(void *x)
+{
+    ELLLIST todo;
+    ELLNODE *cur;
+    int stop;
+
+    writeerr = 0;
+    do {
+        epicsEventMustWait(writerwake);
+
+        ellInit(&todo);
+        epicsMutexMustLock(tracelock);
+        stop = writerstop;
+        ellConcat(&todo, &fullblocks);
+        epicsMutexUnlock(tracelock);
+
+        /* only this thread writes tracefile until writerdone */
+        for(cur = ellFirst(&todo); cur; cur = ellNext(cur)) {
+            dbxtraceblock *blk = CONTAINER(cur, dbxtraceblock, node);
+            if(!writeerr &&
+                    fwrite(blk->recs, sizeof(blk->recs[0]), blk->nrecs, tracefile)!=blk->nrecs)
+            {
+                errlogPrintf("dbxLockTrace: write error.  Stopping\n");
+                epicsAtomicSetIntT(&dbxtraceactive, 0);
+                writeerr = 1;
+            }
+            blk->nrecs = 0;
+        }
+
+        epicsMutexMustLock(tracelock);
+        ellConcat(&freeblocks, &todo);
+        epicsMutexUnlock(tracelock);
+    } while(!stop);
+
+    epicsEventSignal(writerdone);
+}
+
+/* caller must lock buf->lock and tracelock.  Give the block of buf to
+ * the writer, or discard its records if there is none.
+ */
+static
+void dbxtracehandoff(dbxtracebuf *buf)
+{
+    dbxtraceblock *blk = buf->cur;
+
+    if(!blk || !blk->nrecs)
+        return;
+    if(tracefile) {
+        ellAdd(&fullblocks, &blk->node);
+        buf->cur = NULL;
+        epicsEventSignal(writerwake);
+    } else {
+        blk->nrecs = 0;
+    }
+}
+
+/* Returns with buf->lock held, or NULL */
+static
+dbxtracebuf *dbxtracegetbuf(void)
+{
+    epicsThreadId self = epicsThreadGetIdSelf();
+    dbxtracebuf *buf = epicsThreadPrivateGet(tracekey);
+
+    if(buf) {
+        epicsMutexMustLock(buf->lock);
+        if(buf->owner==self)
+            return buf;
+        /* reclaimed since */
+        epicsMutexUnlock(buf->lock);
+    }
+
+    epicsMutexMustLock(tracelock);
+    buf = (dbxtracebuf*)ellGet(&freebufs);
+    if(!buf) {
+        buf = calloc(1, sizeof(*buf));
+        if(buf && !(buf->lock = epicsMutexCreate())) {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    if(buf) {
+        buf->owner = self;
+        buf->trace = 0;
+        ellAdd(&tracebufs, &buf->node);
+    }
+    epicsMutexUnlock(tracelock);
+    if(!buf)
+        return NULL;
+
+    epicsThreadPrivateSet(tracekey, buf);
+    epicsMutexMustLock(buf->lock);
+    return buf;
+}
+
+epicsUInt64 dbxtracenow(void)
+{
+    return epicsMonotonicGet();
+}
+
+void dbxtraceemit(dbxTraceOp op, dbxLockRef *ref, dbxLockRef *ref2, dbxLock *lock,
+                  size_t index, size_t count,
+                  epicsUInt64 T0, epicsUInt64 T1, epicsUInt64 T2)
+{
+    dbxTraceRecord *rec;
+    dbxtracebuf *buf = dbxtracegetbuf();
+
+    if(!buf)
+        return;
+
+    if(buf->trace!=epicsAtomicGetIntT(&tracecur) || !buf->cur) {
+        epicsMutexMustLock(tracelock);
+        if(buf->trace!=tracecur) {
+            buf->trace = tracecur;
+            buf->thread = tracenextthread++;
+        }
+        if(!buf->cur)
+            buf->cur = (dbxtraceblock*)ellGet(&freeblocks);
+        epicsMutexUnlock(tracelock);
+        if(!buf->cur) {
+            if(!(buf->cur = malloc(sizeof(*buf->cur)))) {
+                epicsMutexUnlock(buf->lock);
+                return;
+            }
+            buf->cur->nrecs = 0;
+        }
+    }
+
+    rec = &buf->cur->recs[buf->cur->nrecs++];
+    rec->op = op;
+    rec->thread = buf->thread;
+    rec->index = index;
+    rec->count = count;
+    rec->pad = 0;
+    rec->ref = (size_t)ref;
+    rec->ref2 = (size_t)ref2;
+    rec->lock = (size_t)lock;
+    rec->time = T0;
+    rec->wait = T1-T0;
+    rec->hold = T2-T1;
+
+    if(buf->cur->nrecs==NTRACEBUF) {
+        epicsMutexMustLock(tracelock);
+        dbxtracehandoff(buf);
+        epicsMutexUnlock(tracelock);
+    }
+    epicsMutexUnlock(buf->lock);
+}
+
+/* Hand off, or discard, the records of all threads.
+ * Reclaim their buffers if reclaim.
+ */
+static
+void dbxtraceflushall(int discard, int reclaim)
+{
+    ELLNODE *cur;
+    int i, n;
+
+    /* buffers are only removed here, by the one thread which starts
+     * and stops.  So the first n are stable while we drop tracelock
+     * to lock each buffer.
+     */
+    epicsMutexMustLock(tracelock);
+    cur = ellFirst(&tracebufs);
+    n = ellCount(&tracebufs);
+    epicsMutexUnlock(tracelock);
+
+    for(i=0; i<n; i++) {
+        dbxtracebuf *buf = CONTAINER(cur, dbxtracebuf, node);
+
+        epicsMutexMustLock(buf->lock);
+        epicsMutexMustLock(tracelock);
+        cur = ellNext(cur);
+        if(discard && buf->cur)
+            buf->cur->nrecs = 0;
+        dbxtracehandoff(buf);
+        if(reclaim) {
+            if(buf->cur)
+                ellAdd(&freeblocks, &buf->cur->node);
+            buf->cur = NULL;
+            buf->owner = NULL;
+            ellDelete(&tracebufs, &buf->node);
+            ellAdd(&freebufs, &buf->node);
+        }
+        epicsMutexUnlock(tracelock);
+        epicsMutexUnlock(buf->lock);
+    }
+}
+
+#if defined(DBXLOCK_TRACEPOINTS) && !defined(DBXLOCK_USDT)
+size_t dbxtpcount[dbxTPMax];
+dbxTracePointFn dbxtpfn[dbxTPMax];
+#endif
+
+/************ public api ***********/
+
+int dbxLockTraceStart(const char *fname)
+{
+    dbxTraceHeader head;
+    FILE *fp;
+
+    epicsThreadOnce(&traceonce, &dbxtraceonce, NULL);
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, DBXTRACE_MAGIC, sizeof(head.magic));
+    head.version = DBXTRACE_VERSION;
+    head.recsize = sizeof(dbxTraceRecord);
+
+    epicsMutexMustLock(tracelock);
+    if(tracefile) {
+        errlogPrintf("dbxLockTrace: already active\n");
+        epicsMutexUnlock(tracelock);
+        return 1;
+
+    } else if(!(fp = fopen(fname, "wb"))) {
+        errlogPrintf("dbxLockTrace: Can't open '%s'\n", fname);
+
+    } else if(fwrite(&head, sizeof(head), 1, fp)!=1) {
+        errlogPrintf("dbxLockTrace: write error\n");
+        fclose(fp);
+        fp = NULL;
+
+    } else {
+        epicsAtomicIncrIntT(&tracecur);
+        tracenextthread = 0;
+        writerstop = 0;
+    }
+    tracefile = fp;
+    epicsMutexUnlock(tracelock);
+
+    if(!fp)
+        return 1;
+
+    /* discard anything recorded since the previous trace stopped */
+    dbxtraceflushall(1, 0);
+
+    epicsThreadMustCreate("dbxtrace", epicsThreadPriorityLow,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &dbxtracewriter, NULL);
+    epicsAtomicSetIntT(&dbxtraceactive, 1);
+
+    return 0;
+}
+
+int dbxLockTraceStop(void)
+{
+    ELLNODE *cur;
+    FILE *fp;
+
+    epicsThreadOnce(&traceonce, &dbxtraceonce, NULL);
+
+    epicsMutexMustLock(tracelock);
+    fp = tracefile;
+    epicsMutexUnlock(tracelock);
+    if(!fp)
+        return 1;
+
+    epicsAtomicSetIntT(&dbxtraceactive, 0);
+
+    dbxtraceflushall(0, 1);
+
+    epicsMutexMustLock(tracelock);
+    writerstop = 1;
+    epicsMutexUnlock(tracelock);
+    epicsEventSignal(writerwake);
+    epicsEventMustWait(writerdone);
+
+    epicsMutexMustLock(tracelock);
+    tracefile = NULL;
+    /* From an operation which began while active, handed off after the
+     * writer stopped.  Lost.  Reclaimed buffers keep no blocks.
+     */
+    ellConcat(&freeblocks, &fullblocks);
+    while((cur = ellGet(&freeblocks))!=NULL)
+        free(CONTAINER(cur, dbxtraceblock, node));
+    epicsMutexUnlock(tracelock);
+
+    return fclose(fp)!=0;
+}
+
+int dbxLockTracePointSet(dbxTracePoint point, dbxTracePointFn fn)
+{
+    assert(point>=0 && point<dbxTPMax);
+#if defined(DBXLOCK_TRACEPOINTS) && !defined(DBXLOCK_USDT)
+    dbxtpfn[point] = fn;
+    return 0;
+#else
+    (void)fn;
+    return 1;
+#endif
+}
+
+size_t dbxLockTracePointCount(dbxTracePoint point)
+{
+    assert(point>=0 && point<dbxTPMax);
+#if defined(DBXLOCK_TRACEPOINTS) && !defined(DBXLOCK_USDT)
+    return epicsAtomicGetSizeT(&dbxtpcount[point]);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsThreadPool.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+typedef struct {
+    epicsEventId done;
+    dbxLockRef *A, *B;
+    int ownedA, ownedB;
+    int ncalls;
+} simplestate;
+
+static void simpleCB(dbxLocker *ptr, void *raw)
+{
+    simplestate *S = raw;
+    S->ownedA = S->A->lock->owner==ptr;
+    S->ownedB = S->B->lock->owner==ptr;
+    S->ncalls++;
+    dbxUnlockMany(ptr);
+    epicsEventSignal(S->done);
+}
+
+static void testSimple(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLock *K;
+    simplestate S;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&S, 0, sizeof(S));
+
+    testDiag("Test dbxLockManyAsync()");
+
+    S.done = epicsEventMustCreate(epicsEventEmpty);
+    S.A = &A;
+    S.B = &B;
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+    testOk1((L=dbxLockerAlloc(refs, 2, 0))!=NULL);
+
+    testOk1(dbxLockManyAsync(L, NULL, &simpleCB, &S)==0);
+    testOk1(epicsEventWaitWithTimeout(S.done, 5.0)==epicsEventOK);
+    testOk1(S.ncalls==1);
+    testOk1(S.ownedA && S.ownedB);
+    testOk1(ellCount(&L->locked)==0);
+
+    testDiag("Wait for a lock held by another thread");
+    K = dbxLockOne(&B, 0);
+    S.ownedA = S.ownedB = 0;
+
+    testOk1(dbxLockManyAsync(L, NULL, &simpleCB, &S)==0);
+    testOk1(epicsEventWaitWithTimeout(S.done, 0.2)==epicsEventWaitTimeout);
+    testOk1(S.ncalls==1);
+    /* nothing is held while waiting */
+    testOk1(A.lock->owner==NULL);
+    testOk1(dbxlocknwaiters(B.lock)==1);
+
+    dbxUnlockOne(K);
+    testOk1(epicsEventWaitWithTimeout(S.done, 5.0)==epicsEventOK);
+    testOk1(S.ncalls==2);
+    testOk1(S.ownedA && S.ownedB);
+    testOk1(dbxlocknwaiters(B.lock)==0);
+
+    testOk1(dbxLockerFree(L)==0);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+    epicsEventDestroy(S.done);
+}
+
+typedef struct {
+    epicsEventId done;
+    int remaining;
+} joinstate;
+
+static void joinCB(dbxLocker *ptr, void *raw)
+{
+    joinstate *S = raw;
+    dbxUnlockMany(ptr);
+    if(epicsAtomicDecrIntT(&S->remaining)==0)
+        epicsEventSignal(S->done);
+}
+
+#define NJOINWAIT 2
+
+static void testJoin(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *J, *L[NJOINWAIT];
+    dbxLockLink *link;
+    joinstate S;
+    size_t i;
+    int n;
+
+    testDiag("Waiters follow a join");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    S.done = epicsEventMustCreate(epicsEventEmpty);
+    S.remaining = NJOINWAIT;
+
+    dbxLockRefInit(&A, 0);
+    dbxLockRefInit(&B, 0);
+    J = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(J, 0);
+
+    for(i=0; i<NJOINWAIT; i++) {
+        L[i] = dbxLockerAlloc(&refs[1], 1, 0);
+        dbxLockManyAsync(L[i], NULL, &joinCB, &S);
+    }
+    for(n=0; n<500 && dbxlocknwaiters(B.lock)<NJOINWAIT; n++)
+        epicsThreadSleep(0.01);
+    testOk1(dbxlocknwaiters(B.lock)==NJOINWAIT);
+
+    link = dbxLockRefJoin(J, &A, &B);
+    testOk1(A.lock==B.lock);
+    testOk1(dbxlocknwaiters(B.lock)==NJOINWAIT);
+    dbxUnlockMany(J);
+
+    testOk1(epicsEventWaitWithTimeout(S.done, 5.0)==epicsEventOK);
+    testOk1(dbxlocknwaiters(B.lock)==0);
+
+    for(i=0; i<NJOINWAIT; i++)
+        dbxLockerFree(L[i]);
+    dbxLockMany(J, 0);
+    dbxLockRefSplit(J, link);
+    dbxUnlockMany(J);
+    dbxLockerFree(J);
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+    epicsEventDestroy(S.done);
+}
+
+#define NREFS 8
+#define NLOCKERS 32
+#define NROUNDS 100
+
+typedef struct {
+    epicsEventId done;
+    int remaining; /* # of lockers not finished */
+    size_t counts[NREFS];
+} manystate;
+
+typedef struct {
+    manystate *S;
+    size_t idx[3];
+    int rounds;
+    epicsThreadPool *pool;
+} manylocker;
+
+static void manyCB(dbxLocker *ptr, void *raw)
+{
+    manylocker *M = raw;
+    manystate *S = M->S;
+    size_t i;
+
+    /* not atomic.  Guarded by the locks */
+    for(i=0; i<NELEMENTS(M->idx); i++)
+        S->counts[M->idx[i]]++;
+    epicsThreadSleep(0.0);
+
+    dbxUnlockMany(ptr);
+
+    if(--M->rounds > 0) {
+        if(dbxLockManyAsync(ptr, M->pool, &manyCB, M))
+            testAbort("resubmit fails");
+    } else if(epicsAtomicDecrIntT(&S->remaining)==0) {
+        epicsEventSignal(S->done);
+    }
+}
+
+static void testMany(void)
+{
+    epicsThreadPoolConfig conf;
+    epicsThreadPool *pool;
+    dbxLockRef refs[NREFS];
+    dbxLocker *lockers[NLOCKERS];
+    manylocker M[NLOCKERS];
+    manystate S;
+    size_t i, j, total = 0;
+    int ok = 1;
+
+    testDiag("%d lockers sharing a pool of 2 threads", NLOCKERS);
+
+    memset(refs, 0, sizeof(refs));
+    memset(&S, 0, sizeof(S));
+    S.done = epicsEventMustCreate(epicsEventEmpty);
+    S.remaining = NLOCKERS;
+
+    epicsThreadPoolConfigDefaults(&conf);
+    conf.initialThreads = conf.maxThreads = 2;
+    pool = epicsThreadPoolCreate(&conf);
+    if(!pool)
+        testAbort("pool create fails");
+
+    for(i=0; i<NREFS; i++)
+        ok &= dbxLockRefInit(&refs[i], 0)==0;
+    testOk1(ok);
+
+    for(i=0; i<NLOCKERS; i++) {
+        dbxLockRef *lrefs[NELEMENTS(M[i].idx)];
+        M[i].S = &S;
+        M[i].rounds = NROUNDS;
+        M[i].pool = pool;
+        for(j=0; j<NELEMENTS(M[i].idx); j++) {
+            M[i].idx[j] = (i+j*3)%NREFS;
+            lrefs[j] = &refs[M[i].idx[j]];
+        }
+        lockers[i] = dbxLockerAlloc(lrefs, NELEMENTS(lrefs), 0);
+        if(!lockers[i])
+            testAbort("locker alloc fails");
+    }
+
+    for(i=0; i<NLOCKERS; i++)
+        ok &= dbxLockManyAsync(lockers[i], pool, &manyCB, &M[i])==0;
+    testOk1(ok);
+
+    testOk1(epicsEventWaitWithTimeout(S.done, 30.0)==epicsEventOK);
+
+    for(i=0; i<NREFS; i++)
+        total += S.counts[i];
+    testOk(total==NLOCKERS*NROUNDS*3, "total %u == %u",
+           (unsigned)total, (unsigned)(NLOCKERS*NROUNDS*3));
+
+    epicsThreadPoolWait(pool, -1);
+    for(i=0; i<NLOCKERS; i++)
+        dbxLockerFree(lockers[i]);
+    for(i=0; i<NREFS; i++) {
+        ok &= dbxlocknwaiters(refs[i].lock)==0;
+        dbxLockRefClean(&refs[i]);
+    }
+    testOk1(ok);
+
+    epicsThreadPoolDestroy(pool);
+    epicsEventDestroy(S.done);
+}
+
+typedef struct {
+    epicsEventId held, release, done;
+    dbxLockRef *A;
+} holdstate;
+
+static void holdTask(void *raw)
+{
+    holdstate *H = raw;
+    dbxLock *K = dbxLockOne(H->A, 0);
+    epicsEventSignal(H->held);
+    epicsEventMustWait(H->release);
+    dbxUnlockOne(K);
+    epicsEventSignal(H->done);
+}
+
+typedef struct {
+    dbxlockwaiter W;
+    int id;
+} orderwaiter;
+
+static int wakeorder[4];
+static int nwakes;
+
+static void orderWake(dbxlockwaiter *W)
+{
+    wakeorder[nwakes++] = CONTAINER(W, orderwaiter, W)->id;
+}
+
+static void testRequeue(void)
+{
+    dbxLockRef A;
+    dbxLock *L;
+    holdstate H;
+    orderwaiter W1, W2;
+    memset(&A, 0, sizeof(A));
+    memset(&W1, 0, sizeof(W1));
+    memset(&W2, 0, sizeof(W2));
+
+    testDiag("A woken waiter which loses the race is queued first");
+
+    dbxLockRefInit(&A, 0);
+    L = A.lock;
+    H.A = &A;
+    H.held = epicsEventMustCreate(epicsEventEmpty);
+    H.release = epicsEventMustCreate(epicsEventEmpty);
+    H.done = epicsEventMustCreate(epicsEventEmpty);
+    W1.W.wake = W2.W.wake = &orderWake;
+    W1.id = 1;
+    W2.id = 2;
+
+    epicsThreadMustCreate("holder", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &holdTask, &H);
+    epicsEventMustWait(H.held);
+
+    testOk1(dbxlockwait(L, &W1.W)==1);
+    testOk1(dbxlockwait(L, &W2.W)==1);
+    dbxlockwakeone(L);
+    /* W1 tries again, and loses */
+    testOk1(dbxlockwait(L, &W1.W)==1);
+    dbxlockwakeone(L);
+    testOk(nwakes==2 && wakeorder[0]==1 && wakeorder[1]==1,
+           "woke %d, %d", wakeorder[0], wakeorder[1]);
+
+    testOk1(dbxlockdequeue(&W2.W)==1);
+    epicsEventSignal(H.release);
+    epicsEventMustWait(H.done);
+
+    epicsEventDestroy(H.held);
+    epicsEventDestroy(H.release);
+    epicsEventDestroy(H.done);
+    dbxLockRefClean(&A);
+}
+
+MAIN(testasync)
+{
+    testPlan(35);
+    testSimple();
+    testJoin();
+    testMany();
+    testRequeue();
+    return testDone();
+}
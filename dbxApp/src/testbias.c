@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testbias.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static int holding(dbxLock *L)
+{
+    dbxbiasowner *B = dbxbiasself();
+    size_t i;
+    int n = 0;
+    for(i=0; i<DBXBIAS_NHELD; i++)
+        n += B->held[i]==L;
+    return n;
+}
+
+typedef struct {
+    dbxLockRef *ref;
+    int nloops;
+    dbxbiasowner *bias;
+    epicsEventId started, done;
+} locker;
+
+static void lockTask(void *raw)
+{
+    locker *T = raw;
+    int i;
+
+    epicsEventSignal(T->started);
+    for(i=0; i<T->nloops; i++) {
+        dbxLock *L = dbxLockOne(T->ref, 0);
+        if(i==0)
+            T->bias = dbxlockbias(L);
+        dbxUnlockOne(L);
+    }
+    epicsEventSignal(T->done);
+}
+
+static void startLocker(locker *T, dbxLockRef *ref, int nloops)
+{
+    T->ref = ref;
+    T->nloops = nloops;
+    T->bias = NULL;
+    T->started = epicsEventMustCreate(epicsEventEmpty);
+    T->done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("locker", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &lockTask, T);
+    epicsEventMustWait(T->started);
+}
+
+static void stopLocker(locker *T)
+{
+    epicsEventMustWait(T->done);
+    epicsEventDestroy(T->started);
+    epicsEventDestroy(T->done);
+}
+
+static void testBias(void)
+{
+    dbxLockRef A;
+    dbxLock *L, *L2;
+    locker T;
+    int refcnt;
+    memset(&A, 0, sizeof(A));
+
+    testDiag("Test biased dbxLockOne()");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+
+    L = dbxLockOne(&A, 0);
+    testOk1(dbxlockbias(L)==dbxbiasself());
+    testOk1(holding(L)==0);
+    refcnt = L->refcnt;
+    dbxUnlockOne(L);
+
+    testDiag("Re-lock w/o mutex");
+    L = dbxLockOne(&A, 0);
+    testOk1(holding(L)==1);
+    testOk1(L->refcnt==refcnt-1);
+    L2 = dbxLockOne(&A, 0);
+    testOk1(L==L2 && holding(L)==2);
+    dbxUnlockOne(L2);
+    dbxUnlockOne(L);
+    testOk1(holding(L)==0);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricBiasHit]==2);
+    testOk1(counters[dbxMetricBiasRevoke]==0);
+
+    testDiag("Another thread revokes");
+    startLocker(&T, &A, 1);
+    stopLocker(&T);
+    testOk1(T.bias!=dbxbiasself());
+    testOk1(DBXLOCK_EXT(L)->nrevoke==1);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricBiasRevoke]==1);
+
+    testDiag("Take it back, and hold while another thread waits");
+    L = dbxLockOne(&A, 0);
+    dbxUnlockOne(L);
+    testOk1(dbxlockbias(L)==dbxbiasself());
+    testOk1(DBXLOCK_EXT(L)->nrevoke==2);
+
+    L = dbxLockOne(&A, 0);
+    testOk1(holding(L)==1);
+    startLocker(&T, &A, 1);
+    epicsThreadSleep(0.1);
+    testOk1(epicsEventTryWait(T.done)!=epicsEventOK);
+    testOk1(DBXLOCK_EXT(L)->revoke);
+    dbxUnlockOne(L);
+    stopLocker(&T);
+    testOk1(DBXLOCK_EXT(L)->nrevoke==3);
+
+    testOk1(dbxLockRefClean(&A)==0);
+}
+
+static void testJoin(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *locker;
+    dbxLockLink *link;
+    dbxLock *L;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+
+    testDiag("Biased lock is joined and split");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+
+    dbxUnlockOne(dbxLockOne(&A, 0));
+    dbxUnlockOne(dbxLockOne(&B, 0));
+    testOk1(dbxlockbias(A.lock)==dbxbiasself() && dbxlockbias(B.lock)==dbxbiasself());
+
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, &A, &B);
+    dbxUnlockMany(locker);
+    testOk1(A.lock==B.lock);
+
+    L = dbxLockOne(&B, 0);
+    testOk1(L==A.lock && holding(L)==1);
+    dbxUnlockOne(L);
+
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    testOk1(A.lock!=B.lock);
+
+    L = dbxLockOne(&B, 0);
+    testOk1(L==B.lock);
+    dbxUnlockOne(L);
+
+    dbxLockerFree(locker);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
+#define NTHREADS 4
+#define NLOOPS 10000
+
+typedef struct {
+    dbxLockRef *shared, *mine;
+    size_t *count;
+    epicsEventId done;
+} counter;
+
+static void countTask(void *raw)
+{
+    counter *C = raw;
+    int i;
+
+    for(i=0; i<NLOOPS; i++) {
+        dbxLock *L = dbxLockOne(i%4 ? C->mine : C->shared, 0);
+        /* not atomic.  Guarded by the lock */
+        if(i%4==0)
+            (*C->count)++;
+        dbxUnlockOne(L);
+    }
+    epicsEventSignal(C->done);
+}
+
+static void testContended(void)
+{
+    dbxLockRef shared, mine[NTHREADS];
+    counter C[NTHREADS];
+    size_t count = 0;
+    epicsUInt64 hits;
+    int i, ok = 1;
+
+    testDiag("%d threads with shared and private refs", NTHREADS);
+
+    memset(&shared, 0, sizeof(shared));
+    memset(mine, 0, sizeof(mine));
+    ok &= dbxLockRefInit(&shared, 0)==0;
+    for(i=0; i<NTHREADS; i++)
+        ok &= dbxLockRefInit(&mine[i], 0)==0;
+    testOk1(ok);
+
+    testOk1(readMetrics()==0);
+    hits = counters[dbxMetricBiasHit];
+
+    for(i=0; i<NTHREADS; i++) {
+        C[i].shared = &shared;
+        C[i].mine = &mine[i];
+        C[i].count = &count;
+        C[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("counter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &countTask, &C[i]);
+    }
+    for(i=0; i<NTHREADS; i++) {
+        epicsEventMustWait(C[i].done);
+        epicsEventDestroy(C[i].done);
+    }
+
+    testOk(count==NTHREADS*NLOOPS/4, "count %u == %u",
+           (unsigned)count, (unsigned)(NTHREADS*NLOOPS/4));
+
+    testOk1(readMetrics()==0);
+    hits = counters[dbxMetricBiasHit]-hits;
+    testOk(hits>=NTHREADS*(NLOOPS*3/4-1), "bias hits %llu",
+           (unsigned long long)hits);
+
+    dbxLockRefClean(&shared);
+    for(i=0; i<NTHREADS; i++)
+        dbxLockRefClean(&mine[i]);
+}
+
+typedef struct {
+    dbxLockRef *ref;
+    dbxbiasowner *self;
+    epicsEventId done;
+} exiter;
+
+static void exitTask(void *raw)
+{
+    exiter *T = raw;
+    dbxUnlockOne(dbxLockOne(T->ref, 0));
+    T->self = dbxbiasself();
+    epicsEventSignal(T->done);
+}
+
+static void testExit(void)
+{
+    dbxLockRef A;
+    dbxbiasowner *seen[10];
+    exiter T;
+    int i, j, reused = 0;
+
+    testDiag("Owner of an exited thread is re-used");
+
+    memset(&A, 0, sizeof(A));
+    dbxLockRefInit(&A, 0);
+    T.ref = &A;
+    T.done = epicsEventMustCreate(epicsEventEmpty);
+
+    for(i=0; i<NELEMENTS(seen) && !reused; i++) {
+        epicsThreadMustCreate("exiter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &exitTask, &T);
+        epicsEventMustWait(T.done);
+        seen[i] = T.self;
+        for(j=0; j<i; j++)
+            reused |= seen[j]==T.self;
+        /* for the thread to exit */
+        epicsThreadSleep(0.01);
+    }
+    testOk(reused, "re-used after %d threads", i);
+
+    epicsEventDestroy(T.done);
+    dbxLockRefClean(&A);
+}
+
+MAIN(testbias)
+{
+    testPlan(37);
+    if(dbxLockBias(1)) {
+        testSkip(37, "Biased locking not supported");
+        return testDone();
+    }
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testBias();
+    testJoin();
+    testContended();
+    testExit();
+    testOk1(dbxLockBias(0)==0);
+    return testDone();
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testbulk.bin"
+
+#define NREFS 100
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockRef refs[NREFS], *ptrs[NREFS];
+
+static void testInit(void)
+{
+    dbxLockRef *pair[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+    dbxLock *L;
+    size_t i, nthin = 0;
+    int ok = 1;
+
+    testDiag("Init many, then use a few");
+
+    for(i=0; i<NREFS; i++)
+        ptrs[i] = &refs[i];
+    testOk1(dbxLockRefInitMany(ptrs, NREFS, 0)==0);
+
+    for(i=0; i<NREFS; i++) {
+        nthin += !refs[i].lock->inflated;
+        ok &= refs[i].lock->refcnt==1 && ellCount(&refs[i].lock->refsets)==1;
+        ok &= i==0 || refs[i].lock!=refs[i-1].lock;
+    }
+    testOk1(ok);
+    testOk1(nthin==NREFS);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricLocks]==NREFS);
+    testOk1(counters[dbxMetricRefs]==NREFS);
+    testOk1(hist[0]==NREFS);
+
+    L = dbxLockOne(&refs[0], 0);
+    testOk1(L==refs[0].lock && L->word==DBXLOCK_THIN);
+    testOk1(dbxUnlockOne(L)==0);
+    testOk1(refs[0].lock->word==DBXLOCK_FREE);
+
+    pair[0] = &refs[1];
+    pair[1] = &refs[2];
+    locker = dbxLockerAlloc(pair, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, &refs[1], &refs[2]);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    testOk1(link && refs[1].lock==refs[2].lock);
+    testOk1(!refs[1].lock->inflated);
+}
+
+#define NTHREADS 4
+#define NLOOPS 1000
+
+typedef struct {
+    dbxLockRef *ref;
+    size_t *count;
+    epicsEventId start, done;
+} counter;
+
+static void countTask(void *raw)
+{
+    counter *C = raw;
+    int i;
+
+    epicsEventMustWait(C->start);
+    for(i=0; i<NLOOPS; i++) {
+        dbxLock *L = dbxLockOne(C->ref, 0);
+        /* not atomic.  Guarded by the lock */
+        (*C->count)++;
+        dbxUnlockOne(L);
+    }
+    epicsEventSignal(C->done);
+}
+
+static void testFirstUse(void)
+{
+    counter C[NTHREADS];
+    size_t count = 0;
+    int i;
+
+    testDiag("%d threads race to first lock", NTHREADS);
+
+    for(i=0; i<NTHREADS; i++) {
+        C[i].ref = &refs[NREFS-1];
+        C[i].count = &count;
+        C[i].start = epicsEventMustCreate(epicsEventEmpty);
+        C[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("counter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &countTask, &C[i]);
+    }
+    for(i=0; i<NTHREADS; i++)
+        epicsEventSignal(C[i].start);
+    for(i=0; i<NTHREADS; i++) {
+        epicsEventMustWait(C[i].done);
+        epicsEventDestroy(C[i].start);
+        epicsEventDestroy(C[i].done);
+    }
+
+    testOk(count==NTHREADS*NLOOPS, "count %u == %u",
+           (unsigned)count, (unsigned)(NTHREADS*NLOOPS));
+    testOk1(refs[NREFS-1].lock->word!=DBXLOCK_THIN && refs[NREFS-1].lock->holder==NULL);
+}
+
+static void testClean(void)
+{
+    dbxLockRef other, *pair[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+    dbxLock *L;
+
+    testDiag("Clean many at once, one joined to an outside ref");
+
+    memset(&other, 0, sizeof(other));
+    testOk1(dbxLockRefInit(&other, 0)==0);
+    pair[0] = &other;
+    pair[1] = &refs[5];
+    locker = dbxLockerAlloc(pair, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, &other, &refs[5]);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    testOk1(link && other.lock==refs[5].lock);
+
+    testOk1(dbxLockRefCleanMany(ptrs, NREFS)==0);
+    testOk1(refs[5].lock==NULL && link->A==NULL && link->B==NULL);
+    testOk1(ellCount(&other.linksA)==0);
+    testOk1(other.lock->refcnt==1 && ellCount(&other.lock->refsets)==1);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricRefs]==1);
+    testOk(counters[dbxMetricLocks]==1, "Locks %llu",
+           (unsigned long long)counters[dbxMetricLocks]);
+
+    L = dbxLockOne(&other, 0);
+    testOk1(dbxUnlockOne(L)==0);
+    testOk1(dbxLockRefSplit(NULL, link)==0);
+    testOk1(dbxLockRefClean(&other)==0);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricRefs]==0 && counters[dbxMetricLocks]==0);
+}
+
+MAIN(testbulk)
+{
+    testPlan(28);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testInit();
+    testFirstUse();
+    testClean();
+    return testDone();
+}
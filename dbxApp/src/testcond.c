@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testcond.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+#define NWAITERS 4
+
+static dbxLockRef A, B;
+static dbxLockCond C;
+
+/* guarded by the lock of A */
+static int ready;
+
+typedef struct {
+    epicsEventId done;
+    int ret;
+    int ready;   /* ready when woken */
+    int current; /* lock held is that of A */
+} waiter;
+
+static waiter W[NWAITERS];
+/* of each wait.  Forever if <0 */
+static double waittimeout = -1.0;
+
+static void waitTask(void *raw)
+{
+    waiter *me = raw;
+    dbxLock *L = dbxLockOne(&A, 0);
+
+    while(!ready) {
+        me->ret = dbxLockCondWait(&C, &L, waittimeout);
+        if(me->ret)
+            break;
+    }
+    me->ready = ready;
+    me->current = L==A.lock;
+    dbxUnlockOne(L);
+    epicsEventSignal(me->done);
+}
+
+static void startWaiters(size_t n)
+{
+    size_t i;
+
+    ready = 0;
+    for(i=0; i<n; i++) {
+        memset(&W[i], 0, sizeof(W[i]));
+        W[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("waiter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &waitTask, &W[i]);
+    }
+}
+
+/* lock A once n are waiting */
+static dbxLock* lockWaiting(size_t n)
+{
+    while(1) {
+        dbxLock *L = dbxLockOne(&A, 0);
+        if((size_t)ellCount(&C.waiters)==n)
+            return L;
+        dbxUnlockOne(L);
+        epicsThreadSleep(0.01);
+    }
+}
+
+static int finishWaiters(size_t n)
+{
+    size_t i;
+    int ok = 1;
+
+    for(i=0; i<n; i++) {
+        epicsEventMustWait(W[i].done);
+        epicsEventDestroy(W[i].done);
+        ok &= W[i].ret==0 && W[i].ready && W[i].current;
+    }
+    return ok;
+}
+
+static void testSignal(void)
+{
+    dbxLock *L;
+    epicsUInt64 morph;
+
+    testDiag("Signal one waiter");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    dbxLockRefInit(&A, 0);
+    dbxLockRefInit(&B, 0);
+    testOk1(dbxLockCondInit(&C, &A)==0);
+
+    L = dbxLockOne(&A, 0);
+    testOk1(dbxLockCondSignal(&C)==0);
+    dbxUnlockOne(L);
+
+    startWaiters(1);
+    L = lockWaiting(1);
+    ready = 1;
+    testOk1(dbxLockCondSignal(&C)==1);
+    testOk1(ellCount(&C.waiters)==0);
+    testDiag("Moved to the lock wait queue, not woken");
+    testOk1(dbxlocknwaiters(L)==1);
+    dbxUnlockOne(L);
+    testOk1(finishWaiters(1));
+    testOk1(dbxlocknwaiters(A.lock)==0);
+
+    testDiag("Timeout");
+    L = dbxLockOne(&A, 0);
+    testOk1(dbxLockCondWait(&C, &L, 0.01)==1);
+    testOk1(L==A.lock && L->holder==epicsThreadGetIdSelf());
+    testOk1(ellCount(&C.waiters)==0);
+    dbxUnlockOne(L);
+
+    testOk1(readMetrics()==0);
+    morph = counters[dbxMetricCondMorph];
+    testOk(morph==1, "condmorph %llu", (unsigned long long)morph);
+}
+
+static void testBroadcast(void)
+{
+    dbxLock *L;
+
+    testDiag("Broadcast to %u waiters", NWAITERS);
+
+    startWaiters(NWAITERS);
+    L = lockWaiting(NWAITERS);
+    ready = 1;
+    testOk1(dbxLockCondBroadcast(&C)==NWAITERS);
+    testOk1(ellCount(&C.waiters)==0);
+    testOk1(dbxlocknwaiters(L)==NWAITERS);
+    dbxUnlockOne(L);
+    testOk1(finishWaiters(NWAITERS));
+    testOk1(dbxlocknwaiters(A.lock)==0);
+}
+
+static void testBroadcastJoin(void)
+{
+    dbxLockRef *refs[2] = {&A, &B};
+    dbxLocker *locker;
+    dbxLockLink *link;
+    epicsUInt64 start;
+    double elapsed;
+
+    testDiag("Broadcast, then join away the lock waited on");
+
+    /* a stranded waiter returns at its timeout */
+    waittimeout = 5.0;
+    startWaiters(2);
+    locker = dbxLockerAlloc(refs, 2, 0);
+    while(1) {
+        dbxLockMany(locker, 0);
+        if(ellCount(&C.waiters)==2)
+            break;
+        dbxUnlockMany(locker);
+        epicsThreadSleep(0.01);
+    }
+    ready = 1;
+    testOk1(dbxLockCondBroadcast(&C)==2);
+    /* the lock of A, with the waiters, into that of B */
+    link = dbxLockRefJoin(locker, &B, &A);
+    testOk1(A.lock==B.lock);
+    testOk1(dbxlocknwaiters(A.lock)==2);
+    start = epicsMonotonicGet();
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    testOk1(finishWaiters(2));
+    elapsed = (epicsMonotonicGet()-start)*1e-9;
+    testOk(elapsed<waittimeout/2, "woken after %.2f sec.", elapsed);
+    testOk1(dbxlocknwaiters(A.lock)==0);
+
+    split(&B, &A, link);
+    waittimeout = -1.0;
+}
+
+static void testFollow(void)
+{
+    dbxLockLink *link;
+    dbxLock *L, *old;
+
+    testDiag("Waiter follows a join");
+
+    startWaiters(1);
+    dbxUnlockOne(lockWaiting(1));
+    old = A.lock;
+    link = join(&B, &A);
+    testOk1(A.lock==B.lock);
+    testDiag("%s lock of A after join", A.lock==old ? "kept" : "new");
+
+    L = dbxLockOne(&A, 0);
+    testOk1(ellCount(&C.waiters)==1);
+    ready = 1;
+    testOk1(dbxLockCondSignal(&C)==1);
+    dbxUnlockOne(L);
+    testOk1(finishWaiters(1));
+
+    testDiag("Waiter follows a split");
+
+    startWaiters(1);
+    dbxUnlockOne(lockWaiting(1));
+    split(&B, &A, link);
+    testOk1(A.lock!=B.lock);
+
+    L = dbxLockOne(&A, 0);
+    ready = 1;
+    testOk1(dbxLockCondSignal(&C)==1);
+    dbxUnlockOne(L);
+    testOk1(finishWaiters(1));
+
+    testOk1(dbxLockCondClean(&C)==0);
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+}
+
+MAIN(testcond)
+{
+    testPlan(31);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testSignal();
+    testBroadcast();
+    testBroadcastJoin();
+    testFollow();
+    return testDone();
+}
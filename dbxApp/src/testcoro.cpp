@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsThreadPool.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbx/coro.h"
+
+#ifdef DBX_HAVE_CORO
+
+namespace {
+
+/* started eagerly, signals done when finished */
+struct task {
+    struct promise_type {
+        epicsEventId done;
+        promise_type() :done(epicsEventMustCreate(epicsEventEmpty)) {}
+        ~promise_type() { epicsEventDestroy(done); }
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        /* kept until the task is destroyed.
+         * Signal only once suspended, when the frame may be destroyed.
+         */
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                epicsEventSignal(h.promise().done);
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { testAbort("unhandled exception"); }
+    };
+
+    std::coroutine_handle<promise_type> h;
+    explicit task(std::coroutine_handle<promise_type> h) :h(h) {}
+    task(const task&) = delete;
+    ~task() { h.destroy(); }
+
+    bool wait(double timeout) {
+        return epicsEventWaitWithTimeout(h.promise().done, timeout)==epicsEventOK;
+    }
+};
+
+struct state {
+    dbxLockRef *A, *B;
+    int ownedA, ownedB;
+    int unlocked;
+    epicsThreadId resumed;
+};
+
+task lockBoth(state& S)
+{
+    dbx::guard G = co_await dbx::lock(*S.A, *S.B);
+    S.ownedA = S.A->lock->owner==G.get();
+    S.ownedB = S.B->lock->owner==G.get();
+    G.unlock();
+    S.unlocked = S.A->lock->owner==NULL && S.B->lock->owner==NULL;
+}
+
+task lockBothOn(state& S, epicsThreadPool *pool)
+{
+    dbx::guard G = co_await dbx::lock(pool, *S.A, *S.B);
+    S.ownedA = S.A->lock->owner==G.get();
+    S.ownedB = S.B->lock->owner==G.get();
+    S.resumed = epicsThreadGetIdSelf();
+}
+
+void whoami(void *raw, epicsJobMode mode)
+{
+    if(mode==epicsJobModeRun)
+        *static_cast<epicsThreadId*>(raw) = epicsThreadGetIdSelf();
+}
+
+task lockSeveral(dbxLockRef& ref, int& count, int n)
+{
+    for(int i=0; i<n; i++) {
+        dbx::guard G = co_await dbx::lockOne(ref);
+        count++;
+    }
+}
+
+void testLock()
+{
+    dbxLockRef A, B;
+    dbxLock *K;
+    state S;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&S, 0, sizeof(S));
+    S.A = &A;
+    S.B = &B;
+
+    testDiag("Test co_await dbx::lock()");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+
+    {
+        task T(lockBoth(S));
+        testOk1(T.wait(5.0));
+        testOk1(S.ownedA && S.ownedB);
+        testOk1(S.unlocked);
+    }
+
+    testDiag("Suspend while B is locked");
+    S.ownedA = S.ownedB = S.unlocked = 0;
+    K = dbxLockOne(&B, 0);
+    {
+        task T(lockBoth(S));
+        testOk1(!T.wait(0.2));
+        testOk1(!S.ownedA && !S.ownedB);
+        testOk1(dbxlocknwaiters(B.lock)==1);
+
+        dbxUnlockOne(K);
+        testOk1(T.wait(5.0));
+        testOk1(S.ownedA && S.ownedB);
+        testOk1(S.unlocked);
+    }
+
+    testDiag("Test co_await dbx::lock() on a given pool");
+    {
+        epicsThreadPoolConfig conf;
+        epicsThreadPool *pool;
+        epicsJob *job;
+        epicsThreadId worker = 0;
+
+        epicsThreadPoolConfigDefaults(&conf);
+        conf.initialThreads = conf.maxThreads = 1;
+        pool = epicsThreadPoolCreate(&conf);
+        if(!pool)
+            testAbort("pool create fails");
+        /* the one worker of pool */
+        job = epicsJobCreate(pool, &whoami, &worker);
+        if(!job || epicsJobQueue(job))
+            testAbort("job queue fails");
+        epicsThreadPoolWait(pool, -1);
+
+        S.ownedA = S.ownedB = 0;
+        {
+            task T(lockBothOn(S, pool));
+            testOk1(T.wait(5.0));
+            testOk1(S.ownedA && S.ownedB);
+            testOk1(worker && S.resumed==worker);
+        }
+        epicsJobDestroy(job);
+        epicsThreadPoolDestroy(pool);
+    }
+
+    testDiag("Test co_await dbx::lockOne() in a loop");
+    {
+        int count = 0;
+        task T(lockSeveral(A, count, 10));
+        testOk1(T.wait(5.0));
+        testOk1(count==10);
+    }
+
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
+} // namespace
+
+MAIN(testcoro)
+{
+    testPlan(18);
+    testLock();
+    return testDone();
+}
+
+#else /* DBX_HAVE_CORO */
+
+MAIN(testcoro)
+{
+    testPlan(1);
+    testSkip(1, "Not built with C++20 coroutines");
+    return testDone();
+}
+
+#endif /* DBX_HAVE_CORO */
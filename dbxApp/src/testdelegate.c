@@ -0,0 +1,186 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+typedef struct {
+    int count;
+    epicsThreadId ranby;
+} counter;
+
+static void incr(dbxLockRef *ref, void *raw)
+{
+    counter *C = raw;
+    /* ended by whichever unlock ran us */
+    dbxLockMarkWrite(ref);
+    C->count++;
+    C->ranby = epicsThreadGetIdSelf();
+}
+
+typedef struct {
+    dbxLockRef *ref;
+    counter *C;
+    int n;
+    epicsEventId started, done;
+} publisher;
+
+static void publish(void *raw)
+{
+    publisher *P = raw;
+    int i;
+
+    epicsEventSignal(P->started);
+    for(i=0; i<P->n; i++)
+        dbxLockDelegate(P->ref, &incr, P->C);
+    epicsEventSignal(P->done);
+}
+
+static void startPublisher(publisher *P, dbxLockRef *ref, counter *C, int n)
+{
+    P->ref = ref;
+    P->C = C;
+    P->n = n;
+    P->started = epicsEventMustCreate(epicsEventEmpty);
+    P->done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("publisher", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &publish, P);
+    epicsEventMustWait(P->started);
+}
+
+static void stopPublisher(publisher *P)
+{
+    epicsEventMustWait(P->done);
+    epicsEventDestroy(P->started);
+    epicsEventDestroy(P->done);
+}
+
+static void testDelegate(void)
+{
+    dbxLockRef A;
+    dbxLock *K;
+    counter C;
+    publisher P;
+    memset(&A, 0, sizeof(A));
+    memset(&C, 0, sizeof(C));
+
+    testDiag("Test dbxLockDelegate()");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+
+    testOk1(dbxLockDelegate(&A, &incr, &C)==0);
+    testOk1(C.count==1);
+    testOk1(C.ranby==epicsThreadGetIdSelf());
+
+    testDiag("Run by the holder when it unlocks");
+    K = dbxLockOne(&A, 0);
+    startPublisher(&P, &A, &C, 1);
+    epicsThreadSleep(0.1);
+    testOk1(C.count==1);
+    testOk1(dbxlockdelegates(A.lock)!=NULL);
+    dbxUnlockOne(K);
+    testOk1(C.count==2);
+    testOk1(C.ranby==epicsThreadGetIdSelf());
+    stopPublisher(&P);
+
+    testDiag("Run at once when already held");
+    K = dbxLockOne(&A, 0);
+    testOk1(dbxLockDelegate(&A, &incr, &C)==0);
+    testOk1(C.count==3);
+    testOk1(dbxLockOne(&A, 0)==K);
+    testOk1(dbxLockDelegate(&A, &incr, &C)==0);
+    testOk1(C.count==4);
+    dbxUnlockOne(K);
+    dbxUnlockOne(K);
+    testOk1(dbxlockdelegates(A.lock)==NULL);
+
+    testOk1(dbxLockRefClean(&A)==0);
+}
+
+static void testMoved(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLockLink *link;
+    dbxLock *K;
+    counter C;
+    publisher P;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&C, 0, sizeof(C));
+
+    testDiag("Ref is joined while a closure is pending");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+
+    K = dbxLockOne(&B, 0);
+    startPublisher(&P, &B, &C, 1);
+    epicsThreadSleep(0.1);
+    testOk1(C.count==0);
+
+    L = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(L, 0);
+    /* B moves to the lock of A */
+    link = dbxLockRefJoin(L, &A, &B);
+    testOk1(A.lock==B.lock);
+    dbxUnlockMany(L);
+    dbxUnlockOne(K);
+
+    stopPublisher(&P);
+    testOk1(C.count==1);
+
+    dbxLockMany(L, 0);
+    dbxLockRefSplit(L, link);
+    dbxUnlockMany(L);
+    dbxLockerFree(L);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
+#define NPUB 4
+#define NOPS 10000
+
+static void testMany(void)
+{
+    dbxLockRef A;
+    counter C;
+    publisher P[NPUB];
+    int i;
+    memset(&A, 0, sizeof(A));
+    memset(&C, 0, sizeof(C));
+
+    testDiag("%d threads delegating %d closures", NPUB, NOPS);
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+
+    for(i=0; i<NPUB; i++)
+        startPublisher(&P[i], &A, &C, NOPS);
+    for(i=0; i<NOPS; i++) {
+        dbxLock *K = dbxLockOne(&A, 0);
+        C.count++;
+        dbxUnlockOne(K);
+    }
+    for(i=0; i<NPUB; i++)
+        stopPublisher(&P[i]);
+
+    testOk(C.count==(NPUB+1)*NOPS, "count %d == %d", C.count, (NPUB+1)*NOPS);
+    testOk1(dbxlockdelegates(A.lock)==NULL);
+    testOk1((A.lock->wseq&1)==0);
+
+    testOk1(dbxLockRefClean(&A)==0);
+}
+
+MAIN(testdelegate)
+{
+    testPlan(27);
+    testDelegate();
+    testMoved();
+    testMany();
+    return testDone();
+}
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbx/exec.h"
+
+#define NREFS 4
+#define NTASKS 1000
+
+static dbxLockRef refs[NREFS];
+static size_t counts[NREFS];
+static int nbad;
+
+typedef struct {
+    dbxTask task;
+    dbxLockRef *trefs[2];
+} mytask;
+
+static void countTask(dbxTask *task)
+{
+    size_t i;
+    for(i=0; i<task->nrefs; i++) {
+        dbxLock *L = task->refs[i]->lock;
+        /* recursive lock.  Must not block */
+        if(!dbxlocktrylock(L))
+            nbad++;
+        else
+            DBXLOCK_UNLOCK(L);
+        /* not atomic.  Guarded by the lock */
+        counts[task->refs[i]-refs]++;
+    }
+}
+
+typedef struct {
+    dbxTask task;
+    dbxLockRef *trefs[1];
+    epicsEventId started, resume;
+} blocktask;
+
+static void blockTask(dbxTask *raw)
+{
+    blocktask *B = CONTAINER(raw, blocktask, task);
+    epicsEventSignal(B->started);
+    epicsEventMustWait(B->resume);
+}
+
+static dbxLockLink* joinRefs(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *jrefs[2] = {A, B};
+    dbxLocker *L = dbxLockerAlloc(jrefs, 2, 0);
+    dbxLockLink *link;
+    dbxLockMany(L, 0);
+    link = dbxLockRefJoin(L, A, B);
+    dbxUnlockMany(L);
+    dbxLockerFree(L);
+    return link;
+}
+
+static void splitRefs(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *jrefs[2] = {A, B};
+    dbxLocker *L = dbxLockerAlloc(jrefs, 2, 0);
+    dbxLockMany(L, 0);
+    dbxLockRefSplit(L, link);
+    dbxUnlockMany(L);
+    dbxLockerFree(L);
+}
+
+static void testExec(void)
+{
+    dbxExecutor *ex;
+    dbxExecutorStats stats;
+    mytask *tasks = calloc(NTASKS, sizeof(*tasks));
+    dbxLockLink *link;
+    size_t i;
+    int ok = 1;
+
+    testDiag("Test executor w/ %d tasks", NTASKS);
+
+    if(!tasks)
+        testAbort("Alloc fails");
+
+    for(i=0; i<NREFS; i++)
+        ok &= dbxLockRefInit(&refs[i], 0)==0;
+    testOk1(ok);
+
+    /* 0 and 1 share a lockset */
+    link = joinRefs(&refs[0], &refs[1]);
+
+    testOk1((ex=dbxExecutorCreate(2, 0))!=NULL);
+
+    for(i=0; i<NTASKS; i++) {
+        tasks[i].task.refs = tasks[i].trefs;
+        tasks[i].task.fn = &countTask;
+        tasks[i].trefs[0] = &refs[i%NREFS];
+        tasks[i].trefs[1] = &refs[(i+1)%NREFS];
+        tasks[i].task.nrefs = i%3==0 ? 2 : 1;
+        ok &= dbxExecutorSubmit(ex, &tasks[i].task)==0;
+    }
+    testOk1(ok);
+
+    dbxExecutorFlush(ex);
+    dbxExecutorGetStats(ex, &stats);
+    testOk(stats.tasks==NTASKS, "tasks %u", (unsigned)stats.tasks);
+    testOk(stats.batches<=NTASKS, "batches %u steals %u slow %u",
+           (unsigned)stats.batches, (unsigned)stats.steals, (unsigned)stats.slow);
+    dbxExecutorDestroy(ex);
+
+    for(i=0, ok=1; i<NREFS; i++) {
+        size_t expect = NTASKS/NREFS, j;
+        for(j=0; j<NTASKS; j++)
+            expect += j%3==0 && (j+1)%NREFS==i;
+        ok &= counts[i]==expect;
+        testDiag("ref %u count %u expect %u", (unsigned)i, (unsigned)counts[i], (unsigned)expect);
+    }
+    testOk1(ok);
+    testOk1(nbad==0);
+
+    splitRefs(&refs[0], &refs[1], link);
+
+    free(tasks);
+}
+
+static void testReroute(void)
+{
+    dbxExecutor *ex;
+    dbxExecutorStats stats;
+    blocktask B;
+    mytask T[3];
+    dbxLockLink *link;
+    size_t i;
+
+    testDiag("Test routing after split");
+
+    memset(counts, 0, sizeof(counts));
+    memset(&B, 0, sizeof(B));
+    memset(T, 0, sizeof(T));
+
+    B.started = epicsEventMustCreate(epicsEventEmpty);
+    B.resume = epicsEventMustCreate(epicsEventEmpty);
+    B.task.refs = B.trefs;
+    B.task.nrefs = 1;
+    B.task.fn = &blockTask;
+    B.trefs[0] = &refs[2];
+
+    link = joinRefs(&refs[0], &refs[1]);
+
+    testOk1((ex=dbxExecutorCreate(1, 0))!=NULL);
+
+    /* keep the worker busy while we queue */
+    testOk1(dbxExecutorSubmit(ex, &B.task)==0);
+    epicsEventMustWait(B.started);
+
+    /* all queued for the lockset of 0 and 1 */
+    for(i=0; i<3; i++) {
+        T[i].task.refs = T[i].trefs;
+        T[i].task.fn = &countTask;
+        T[i].task.nrefs = 1;
+        T[i].trefs[0] = &refs[i%2];
+    }
+    T[2].task.nrefs = 2;
+    T[2].trefs[1] = &refs[3];
+    for(i=0; i<3; i++)
+        testOk1(dbxExecutorSubmit(ex, &T[i].task)==0);
+
+    /* moves refs[1] to a new lockset */
+    splitRefs(&refs[0], &refs[1], link);
+
+    epicsEventSignal(B.resume);
+    dbxExecutorFlush(ex);
+
+    dbxExecutorGetStats(ex, &stats);
+    testOk(stats.tasks==4, "tasks %u", (unsigned)stats.tasks);
+    testOk(stats.reroutes==1, "reroutes %u", (unsigned)stats.reroutes);
+    testOk(stats.slow==1, "slow %u", (unsigned)stats.slow);
+    testOk1(counts[0]==2 && counts[1]==1 && counts[3]==1);
+    testOk1(nbad==0);
+
+    dbxExecutorDestroy(ex);
+
+    for(i=0; i<NREFS; i++)
+        dbxLockRefClean(&refs[i]);
+    epicsEventDestroy(B.started);
+    epicsEventDestroy(B.resume);
+}
+
+MAIN(testexec)
+{
+    testPlan(17);
+    testExec();
+    testReroute();
+    return testDone();
+}
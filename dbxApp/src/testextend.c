@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testextend.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static int cmpRef(const void *rawA, const void *rawB)
+{
+    const dbxLockRef *A = *(const dbxLockRef**)rawA,
+                     *B = *(const dbxLockRef**)rawB;
+    return A->lock < B->lock ? -1 : A->lock > B->lock ? 1 : 0;
+}
+
+static dbxLockRef refs[3];
+/* refs[] ordered by lock */
+static dbxLockRef *lo, *mid, *hi;
+
+static void initRefs(void)
+{
+    dbxLockRef *sorted[3] = {&refs[0], &refs[1], &refs[2]};
+    int i, ok = 1;
+
+    memset(refs, 0, sizeof(refs));
+    for(i=0; i<3; i++)
+        ok &= dbxLockRefInit(&refs[i], 0)==0;
+    testOk1(ok);
+
+    qsort(sorted, 3, sizeof(sorted[0]), &cmpRef);
+    lo = sorted[0];
+    mid = sorted[1];
+    hi = sorted[2];
+}
+
+static void cleanRefs(void)
+{
+    int i, ok = 1;
+    for(i=0; i<3; i++)
+        ok &= refs[i].lock->refcnt==1;
+    testOk1(ok);
+    for(i=0; i<3; i++)
+        dbxLockRefClean(&refs[i]);
+}
+
+static void testInOrder(void)
+{
+    dbxLocker *L;
+
+    testDiag("Extend with locks ordered after those held");
+    initRefs();
+
+    testOk1((L=dbxLockerAlloc(&lo, 1, 0))!=NULL);
+    testOk1(dbxLockMany(L, 0)==0);
+
+    testOk1(dbxLockerExtend(L, &hi, 1, 0)==0);
+    testOk1(ellCount(&L->locked)==2);
+    testOk1(lo->lock->owner==L && hi->lock->owner==L);
+
+    /* already held */
+    testOk1(dbxLockerExtend(L, &lo, 1, 0)==0);
+    testOk1(ellCount(&L->locked)==2);
+    testOk1(L->maxrefs==3);
+
+    testOk1(dbxUnlockMany(L)==0);
+    testOk1(lo->lock->owner==NULL && hi->lock->owner==NULL);
+
+    testDiag("Re-lock with all refs");
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(ellCount(&L->locked)==2);
+    testOk1(dbxUnlockMany(L)==0);
+
+    testOk1(dbxLockerFree(L)==0);
+    cleanRefs();
+}
+
+static void testOutOfOrder(void)
+{
+    dbxLocker *L;
+    dbxLockRef *held[2];
+
+    testDiag("Extend with an idle lock ordered before those held");
+    initRefs();
+    held[0] = mid;
+    held[1] = hi;
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricExtendRelock]==0);
+
+    testOk1((L=dbxLockerAlloc(held, 2, 0))!=NULL);
+    testOk1(dbxLockMany(L, 0)==0);
+
+    testOk1(dbxLockerExtend(L, &lo, 1, 0)==0);
+    testOk1(ellCount(&L->locked)==3);
+    testOk1(lo->lock->owner==L);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricExtendBackoff]==0);
+    testOk1(counters[dbxMetricExtendRelock]==0);
+
+    testOk1(dbxUnlockMany(L)==0);
+    testOk1(dbxLockerFree(L)==0);
+    cleanRefs();
+}
+
+/* Locks lo.  Then, when told, also mid.  Which the extend must release. */
+typedef struct {
+    dbxLockRef *A, *B;
+    epicsEventId locked, next, done;
+} holder;
+
+static void holdTask(void *raw)
+{
+    holder *H = raw;
+    dbxLock *K = dbxLockOne(H->A, 0), *K2;
+
+    epicsEventSignal(H->locked);
+    epicsEventMustWait(H->next);
+    K2 = dbxLockOne(H->B, 0);
+    dbxUnlockOne(K2);
+    dbxUnlockOne(K);
+    epicsEventSignal(H->done);
+}
+
+static void testRelock(void)
+{
+    dbxLocker *L;
+    dbxLockRef *held[2];
+    holder H;
+    epicsUInt64 backoff;
+
+    testDiag("Extend with a busy lock ordered before those held");
+    initRefs();
+    held[0] = mid;
+    held[1] = hi;
+
+    testOk1(readMetrics()==0);
+    backoff = counters[dbxMetricExtendBackoff];
+
+    H.A = lo;
+    H.B = mid;
+    H.locked = epicsEventMustCreate(epicsEventEmpty);
+    H.next = epicsEventMustCreate(epicsEventEmpty);
+    H.done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("holder", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &holdTask, &H);
+    epicsEventMustWait(H.locked);
+
+    testOk1((L=dbxLockerAlloc(held, 2, 0))!=NULL);
+    testOk1(dbxLockMany(L, 0)==0);
+
+    /* the holder waits for mid before unlocking lo */
+    epicsEventSignal(H.next);
+
+    testOk1(dbxLockerExtend(L, &lo, 1, 0)==0);
+    testOk1(ellCount(&L->locked)==3);
+    testOk1(lo->lock->owner==L && mid->lock->owner==L && hi->lock->owner==L);
+
+    testOk1(readMetrics()==0);
+    testOk(counters[dbxMetricExtendBackoff]-backoff>=DBXEXTEND_NTRY,
+           "backoff %llu", (unsigned long long)(counters[dbxMetricExtendBackoff]-backoff));
+    testOk1(counters[dbxMetricExtendRelock]==1);
+
+    testOk1(dbxUnlockMany(L)==0);
+    epicsEventMustWait(H.done);
+    testOk1(dbxLockerFree(L)==0);
+
+    epicsEventDestroy(H.locked);
+    epicsEventDestroy(H.next);
+    epicsEventDestroy(H.done);
+    cleanRefs();
+}
+
+MAIN(testextend)
+{
+    testPlan(43);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testInOrder();
+    testOutOfOrder();
+    testRelock();
+    return testDone();
+}
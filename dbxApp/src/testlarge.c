@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testlarge.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+#define NREFS 1000
+#define NGROUPS 10
+#define GROUPSIZE (NREFS/NGROUPS)
+
+static dbxLockRef refs[NREFS], extra[2];
+static dbxLockRef *prefs[NREFS];
+
+static int allOwned(dbxLocker *L)
+{
+    size_t i, n = 0;
+    for(i=0; i<NREFS; i++)
+        n += refs[i].lock->owner==L;
+    return n==NREFS;
+}
+
+/* refs[i] for i%NGROUPS==g are one lockset */
+static void initRefs(void)
+{
+    size_t i;
+
+    memset(refs, 0, sizeof(refs));
+    for(i=0; i<NREFS; i++)
+        prefs[i] = &refs[i];
+    dbxLockRefInitMany(prefs, NREFS, 0);
+    for(i=NGROUPS; i<NREFS; i++)
+        join(&refs[i%NGROUPS], &refs[i]);
+}
+
+static void testRuns(void)
+{
+    dbxLocker *L;
+    dbxLockLink *link;
+    dbxLockRef *pextra[2] = {&extra[0], &extra[1]};
+
+    testDiag("One ref to each lock of %u refs in %u locksets", NREFS, NGROUPS);
+
+    initRefs();
+    testOk1(refs[0].lock->refcnt==GROUPSIZE);
+
+    L = dbxLockerAlloc(prefs, NREFS, DBXLOCKER_LARGE);
+    testOk1(L && L->large);
+    testOk1(refs[0].lock->refcnt==GROUPSIZE+1);
+    testOk1(refs[NGROUPS-1].lock->refcnt==GROUPSIZE+1);
+
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(allOwned(L));
+    testOk1(ellCount(&L->locked)==NGROUPS);
+    testOk1(dbxUnlockMany(L)==0);
+    testOk1(refs[0].lock->refcnt==GROUPSIZE+1);
+
+    testDiag("Merge of two locksets");
+    link = join(&refs[0], &refs[1]);
+    testOk1(dbxupdaterefs(L, 1)==GROUPSIZE);
+    testOk1(refs[0].lock->refcnt==2*GROUPSIZE+1);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricLocks]==NGROUPS-1);
+
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(allOwned(L));
+    testOk1(ellCount(&L->locked)==NGROUPS-1);
+    testOk1(dbxUnlockMany(L)==0);
+
+    testDiag("Split");
+    split(&refs[0], &refs[1], link);
+    testOk1(dbxupdaterefs(L, 1)==GROUPSIZE);
+    testOk1(refs[0].lock->refcnt==GROUPSIZE+1);
+    testOk1(refs[1].lock->refcnt==GROUPSIZE+1);
+
+    testDiag("Extend");
+    memset(extra, 0, sizeof(extra));
+    dbxLockRefInit(&extra[0], 0);
+    dbxLockRefInit(&extra[1], 0);
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(dbxLockerExtend(L, pextra, 2, 0)==0);
+    testOk1(allOwned(L));
+    testOk1(extra[0].lock->owner==L && extra[1].lock->owner==L);
+    testOk1(ellCount(&L->locked)==NGROUPS+2);
+    testOk1(dbxUnlockMany(L)==0);
+    testOk1(extra[0].lock->refcnt==2);
+
+    testDiag("Sweep");
+    link = join(&refs[2], &refs[3]);
+    testOk1(dbxLockSweep()==GROUPSIZE);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricStale]==0);
+    split(&refs[2], &refs[3], link);
+
+    testOk1(dbxLockerFree(L)==0);
+    testOk1(refs[0].lock->refcnt==GROUPSIZE);
+    testOk1(extra[0].lock->refcnt==1);
+    dbxLockRefClean(&extra[0]);
+    dbxLockRefClean(&extra[1]);
+}
+
+#define NLOOPS 200
+
+static int stop, nbad, nlocked;
+static epicsEventId done;
+
+static void workTask(void *raw)
+{
+    dbxLocker *L = dbxLockerAlloc(prefs, NREFS, DBXLOCKER_LARGE);
+
+    while(!epicsAtomicGetIntT(&stop)) {
+        dbxLockMany(L, 0);
+        if(!allOwned(L))
+            epicsAtomicIncrIntT(&nbad);
+        dbxUnlockMany(L);
+        epicsAtomicIncrIntT(&nlocked);
+    }
+    dbxLockerFree(L);
+    epicsEventSignal(done);
+}
+
+static void testChurn(void)
+{
+    size_t i, n;
+    int ok = 1;
+
+    testDiag("Lock all while locksets are joined and split");
+
+    done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("worker", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &workTask, NULL);
+
+    /* until both have looped enough */
+    for(n=0; n<NLOOPS || epicsAtomicGetIntT(&nlocked)<NLOOPS; n++) {
+        dbxLockRef *A = &refs[n%NGROUPS], *B = &refs[(n+1)%NGROUPS];
+        split(A, B, join(A, B));
+    }
+    epicsAtomicSetIntT(&stop, 1);
+    epicsEventMustWait(done);
+    epicsEventDestroy(done);
+    testDiag("%lu join/split, locked %d times", (unsigned long)n, nlocked);
+
+    testOk(nbad==0, "%d times not all locked", nbad);
+    for(i=0; i<NGROUPS; i++)
+        ok &= refs[i].lock->refcnt==GROUPSIZE;
+    testOk(ok, "No refs left");
+
+    testOk1(dbxLockRefCleanMany(prefs, NREFS)==0);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricLocks]==0 && counters[dbxMetricStale]==0);
+}
+
+MAIN(testlarge)
+{
+    testPlan(38);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testRuns();
+    testChurn();
+    return testDone();
+}
@@ -141,8 +141,10 @@ static void testLockManyToOne(void)
 
     testOk1((K=dbxLockOne(&A, 0))!=NULL);
 
-    testOk1(A.lock->refcnt==4);
+    /* re-entry takes no ref */
+    testOk1(A.lock->refcnt==3);
     testOk1(B.lock->refcnt==3);
+    testOk1(K->depth==2);
 
     testOk1(dbxUnlockOne(K)==0);
 
@@ -158,6 +160,48 @@ static void testLockManyToOne(void)
     testOk1(dbxLockRefClean(&B)==0);
 }
 
+static void testRecursion(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLock *K, *K2;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+
+    testDiag("Test recursive dbxLockOne, then dbxLockMany");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+    testOk1((L=dbxLockerAlloc(refs, 2, 0))!=NULL);
+
+    testOk1((K=dbxLockOne(&A, 0))!=NULL);
+    testOk1(K->holder==epicsThreadGetIdSelf() && K->depth==1);
+    testOk1(A.lock->refcnt==3);
+
+    testOk1((K2=dbxLockOne(&A, 0))==K);
+    testOk1(K->depth==2);
+    testOk1(A.lock->refcnt==3);
+
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(K->depth==3 && K->owner==L);
+    testOk1(A.lock->refcnt==3);
+    testOk1(B.lock->refcnt==3);
+
+    /* not in reverse order */
+    testOk1(dbxUnlockOne(K)==0);
+    testOk1(dbxUnlockOne(K2)==0);
+    testOk1(K->depth==1);
+    testOk1(dbxUnlockMany(L)==0);
+
+    testOk1(K->holder==NULL && K->depth==0 && K->owner==NULL);
+    testOk1(A.lock->refcnt==2);
+    testOk1(B.lock->refcnt==2);
+
+    testOk1(dbxLockerFree(L)==0);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
 static void testLockJoin(void)
 {
     dbxLockRef A, B, *refs[] = {&A, &B};
@@ -494,12 +538,13 @@ static void testRelockJoin(void)
 
 MAIN(testlock)
 {
-    testPlan(231);
+    testPlan(255);
     testCreate();
     testLockerSort();
     testLockOne();
     testLockMany();
     testLockManyToOne();
+    testRecursion();
     testLockJoin();
     testLockSplit();
     testLockLinks();
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+typedef struct {
+    dbxmcs *M;
+    int order; /* position in queue */
+    int *next; /* next position to take the lock.  Guarded by M */
+    int ok;
+    epicsEventId started, done;
+} waiter;
+
+static void waitTask(void *raw)
+{
+    waiter *W = raw;
+
+    epicsEventSignal(W->started);
+    dbxmcslock(W->M);
+    W->ok = *W->next==W->order;
+    (*W->next)++;
+    dbxmcsunlock(W->M);
+    epicsEventSignal(W->done);
+}
+
+static void startWaiter(waiter *W, dbxmcs *M, int order, int *next)
+{
+    W->M = M;
+    W->order = order;
+    W->next = next;
+    W->started = epicsEventMustCreate(epicsEventEmpty);
+    W->done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("waiter", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &waitTask, W);
+    epicsEventMustWait(W->started);
+}
+
+static void stopWaiter(waiter *W)
+{
+    epicsEventMustWait(W->done);
+    epicsEventDestroy(W->started);
+    epicsEventDestroy(W->done);
+}
+
+typedef struct {
+    dbxmcs *M;
+    int locked;
+    epicsEventId done;
+} trier;
+
+static void tryTask(void *raw)
+{
+    trier *T = raw;
+    T->locked = dbxmcstrylock(T->M);
+    if(T->locked)
+        dbxmcsunlock(T->M);
+    epicsEventSignal(T->done);
+}
+
+/* dbxmcstrylock() from another thread */
+static int tryOther(dbxmcs *M)
+{
+    trier T;
+    T.M = M;
+    T.done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("trier", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &tryTask, &T);
+    epicsEventMustWait(T.done);
+    epicsEventDestroy(T.done);
+    return T.locked;
+}
+
+static void testSimple(void)
+{
+    dbxmcs M;
+
+    testDiag("Test dbxmcs lock/unlock");
+
+    testOk1(dbxmcsinit(&M)==0);
+
+    dbxmcslock(&M);
+    testOk1(M.owner==epicsThreadGetIdSelf());
+    testOk1(M.tail!=NULL && M.tail==M.holder);
+    testOk1(!tryOther(&M));
+
+    testDiag("Recursive");
+    dbxmcslock(&M);
+    testOk1(dbxmcstrylock(&M));
+    testOk1(M.depth==3);
+    dbxmcsunlock(&M);
+    dbxmcsunlock(&M);
+    testOk1(M.owner==epicsThreadGetIdSelf());
+    dbxmcsunlock(&M);
+    testOk1(M.owner==NULL && M.tail==NULL);
+    testOk1(tryOther(&M));
+
+    testOk1(dbxmcstrylock(&M));
+    dbxmcsunlock(&M);
+    testOk1(M.tail==NULL);
+
+    dbxmcsclean(&M);
+}
+
+#define NWAITERS 4
+
+static void testFIFO(void)
+{
+    dbxmcs M;
+    waiter W[NWAITERS];
+    int i, next = 0, ok = 1;
+
+    testDiag("Waiters are granted the lock in arrival order");
+
+    testOk1(dbxmcsinit(&M)==0);
+    dbxmcslock(&M);
+
+    for(i=0; i<NWAITERS; i++) {
+        startWaiter(&W[i], &M, i, &next);
+        /* wait until queued */
+        epicsThreadSleep(0.1);
+    }
+    testOk1(next==0);
+    testOk1(M.tail!=M.holder);
+
+    dbxmcsunlock(&M);
+    for(i=0; i<NWAITERS; i++) {
+        stopWaiter(&W[i]);
+        ok &= W[i].ok;
+    }
+    testOk1(ok);
+    testOk1(next==NWAITERS);
+    testOk1(M.tail==NULL);
+
+    dbxmcsclean(&M);
+}
+
+#define NTHREADS 4
+#define NLOOPS 20000
+
+typedef struct {
+    dbxmcs *M;
+    size_t *count;
+    epicsEventId done;
+} counter;
+
+static void countTask(void *raw)
+{
+    counter *C = raw;
+    int i;
+
+    for(i=0; i<NLOOPS; i++) {
+        if(i%2 || !dbxmcstrylock(C->M))
+            dbxmcslock(C->M);
+        /* not atomic.  Guarded by M */
+        (*C->count)++;
+        dbxmcsunlock(C->M);
+    }
+    epicsEventSignal(C->done);
+}
+
+static void testContended(int spin)
+{
+    dbxmcs M;
+    counter C[NTHREADS];
+    size_t count = 0;
+    int i, prevspin = dbxMCSSpin;
+
+    testDiag("%d threads w/ dbxMCSSpin=%d", NTHREADS, spin);
+
+    testOk1(dbxmcsinit(&M)==0);
+    dbxMCSSpin = spin;
+
+    for(i=0; i<NTHREADS; i++) {
+        C[i].M = &M;
+        C[i].count = &count;
+        C[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("counter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &countTask, &C[i]);
+    }
+    for(i=0; i<NTHREADS; i++) {
+        epicsEventMustWait(C[i].done);
+        epicsEventDestroy(C[i].done);
+    }
+
+    dbxMCSSpin = prevspin;
+    testOk(count==NTHREADS*NLOOPS, "count %u == %u",
+           (unsigned)count, (unsigned)(NTHREADS*NLOOPS));
+    testOk1(M.tail==NULL && M.owner==NULL);
+    dbxmcsclean(&M);
+}
+
+MAIN(testmcs)
+{
+    testPlan(23);
+    testSimple();
+    testFIFO();
+    testContended(0);
+    testContended(100);
+    return testDone();
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testmetrics.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+typedef struct {
+    dbxLockRef *ref;
+    epicsEventId started, done;
+} waiter;
+
+static void waitLock(void *raw)
+{
+    waiter *W = raw;
+    dbxLock *L;
+
+    epicsEventSignal(W->started);
+    L = dbxLockOne(W->ref, 0);
+    dbxUnlockOne(L);
+    epicsEventSignal(W->done);
+}
+
+static void testCounters(void)
+{
+    dbxLockRef A, B, C, *refs[] = {&A, &B, &C};
+    dbxLocker *locker;
+    dbxLockLink *link;
+    dbxLock *L;
+    waiter W;
+    char junk[256];
+
+    testDiag("Test metrics file");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&C, 0, sizeof(C));
+
+    testOk1(dbxLockMetricsOpen(METRICSFILE)==0);
+    testOk1(dbxLockMetricsOpen(METRICSFILE)!=0);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricRefs]==0);
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+    testOk1(dbxLockRefInit(&C, 0)==0);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricRefs]==3);
+    testOk1(counters[dbxMetricLocks]==3);
+    testOk1(hist[0]==3);
+
+    locker = dbxLockerAlloc(refs, 3, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, &A, &B);
+    dbxUnlockMany(locker);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricAcquire]==3);
+    testOk1(counters[dbxMetricJoin]==1);
+    testOk1(counters[dbxMetricMerge]==1);
+    testOk1(counters[dbxMetricLinks]==1);
+    testOk1(hist[0]==1);
+    testOk1(hist[1]==1);
+
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricSplit]==1);
+    testOk1(counters[dbxMetricDivide]==1);
+    testOk1(counters[dbxMetricLinks]==0);
+    testOk1(hist[0]==3);
+    testOk1(hist[1]==0);
+
+    testDiag("Contended dbxLockOne()");
+    W.ref = &A;
+    W.started = epicsEventMustCreate(epicsEventEmpty);
+    W.done = epicsEventMustCreate(epicsEventEmpty);
+
+    L = dbxLockOne(&A, 0);
+    epicsThreadMustCreate("waiter", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &waitLock, &W);
+    epicsEventMustWait(W.started);
+    epicsThreadSleep(0.1);
+    dbxUnlockOne(L);
+    epicsEventMustWait(W.done);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricContended]==1);
+
+    dbxLockerFree(locker);
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+    dbxLockRefClean(&C);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricRefs]==0);
+    testOk1(counters[dbxMetricLocks]==0);
+    testOk1(hist[0]==0);
+
+    memset(junk, 0, sizeof(junk));
+    testOk1(dbxLockMetricsSum(junk, sizeof(junk), counters, hist)!=0);
+
+    epicsEventDestroy(W.started);
+    epicsEventDestroy(W.done);
+    remove(METRICSFILE);
+}
+
+MAIN(testmetrics)
+{
+    testPlan(31);
+    testCounters();
+    return testDone();
+}
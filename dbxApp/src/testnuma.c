@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testnuma.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+/* enough releases to reach DBXNUMA_MAXVOTE.
+ * Through dbxLockMany(), which is never biased, so each release samples.
+ */
+static void hold(dbxLockRef *R)
+{
+    dbxLocker *locker = dbxLockerAlloc(&R, 1, 0);
+    size_t i;
+
+    for(i=0; i<(DBXNUMA_SAMPLE+1)*DBXNUMA_MAXVOTE; i++) {
+        dbxLockMany(locker, 0);
+        dbxUnlockMany(locker);
+    }
+    dbxLockerFree(locker);
+}
+
+static dbxLockRef A, B, C, D, E;
+
+static void testNuma(void)
+{
+    dbxLockRef *pE = &E;
+    dbxLockLink *link;
+    dbxLock *old;
+    int self;
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&C, 0, sizeof(C));
+    memset(&D, 0, sizeof(D));
+    dbxLockRefInit(&A, 0);
+    dbxLockRefInit(&B, 0);
+    dbxLockRefInit(&D, 0);
+    testOk1(A.lock->numanode==-1);
+    memset(&E, 0, sizeof(E));
+    dbxLockRefInitMany(&pE, 1, 0);
+    testOk1(E.lock->numanode==-1);
+    dbxLockRefCleanMany(&pE, 1);
+
+    testOk1(dbxLockNuma(1)==0);
+    self = dbxnumaself();
+    testDiag("%d nodes, on node %d", dbxnumanodes, self);
+
+    testDiag("Placed on the node of the allocating thread");
+    dbxLockRefInit(&C, 0);
+    testOk1(C.lock->numanode==self);
+
+    testDiag("Sampled holders");
+    testOk1(dbxnumapreferred(A.lock)==-1);
+    hold(&A);
+    testOk1(dbxnumapreferred(A.lock)==self);
+    testOk1(dbxnumapreferred(B.lock)==-1);
+
+    testDiag("Join moves to that node");
+    link = join(&A, &B);
+    testOk1(A.lock==B.lock);
+    testOk1(A.lock->numanode==self);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricNumaMigrate]==1);
+
+    testDiag("As does split");
+    split(&A, &B, link);
+    testOk1(A.lock!=B.lock);
+    testOk1(A.lock->numanode==self && B.lock->numanode==self);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricNumaMigrate]==1);
+
+    testDiag("Join merges into a lock already on that node");
+    hold(&D);
+    old = A.lock;
+    link = join(&D, &A);
+    testOk1(D.lock==old && A.lock==old);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricNumaMigrate]==1);
+    split(&D, &A, link);
+
+    testOk1(dbxLockNuma(0)==0);
+    dbxLockRefClean(&C);
+    dbxLockRefInit(&C, 0);
+    testOk1(C.lock->numanode==-1);
+
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+    dbxLockRefClean(&C);
+    dbxLockRefClean(&D);
+}
+
+MAIN(testnuma)
+{
+    testPlan(20);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    if(dbxLockNuma(1)) {
+        testSkip(20, "NUMA placement not supported");
+        return testDone();
+    }
+    dbxLockNuma(0);
+    testNuma();
+    return testDone();
+}
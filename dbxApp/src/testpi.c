@@ -0,0 +1,145 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#ifdef DBXLOCK_HAVE_PI
+
+typedef struct {
+    int (*trylock)(void *);
+    void (*unlock)(void *);
+    void *M;
+    int locked;
+    epicsEventId done;
+} trier;
+
+static void tryTask(void *raw)
+{
+    trier *T = raw;
+    T->locked = (*T->trylock)(T->M);
+    if(T->locked)
+        (*T->unlock)(T->M);
+    epicsEventSignal(T->done);
+}
+
+/* trylock from another thread */
+static int tryOther(int (*trylock)(void *), void (*unlock)(void *), void *M)
+{
+    trier T;
+    T.trylock = trylock;
+    T.unlock = unlock;
+    T.M = M;
+    T.done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("trier", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &tryTask, &T);
+    epicsEventMustWait(T.done);
+    epicsEventDestroy(T.done);
+    return T.locked;
+}
+
+static int trypi(void *M) { return dbxpitrylock(M); }
+static void unlockpi(void *M) { dbxpiunlock(M); }
+
+static void testPI(void)
+{
+    dbxpi M;
+
+    testDiag("Test dbxpi lock/unlock");
+
+    testOk1(dbxpiinit(&M)==0);
+
+    dbxpilock(&M);
+    testOk1(!tryOther(&trypi, &unlockpi, &M));
+
+    testDiag("Recursive");
+    testOk1(dbxpitrylock(&M));
+    dbxpilock(&M);
+    dbxpiunlock(&M);
+    dbxpiunlock(&M);
+    testOk1(!tryOther(&trypi, &unlockpi, &M));
+
+    dbxpiunlock(&M);
+    testOk1(tryOther(&trypi, &unlockpi, &M));
+
+    dbxpiclean(&M);
+}
+
+#ifdef DBXLOCK_PI
+
+/* thin, or the mutex once inflated */
+static int trylock(void *L) { return dbxthintrylock((dbxLock*)L); }
+static void unlock(void *L) { dbxthinunlock((dbxLock*)L); }
+
+static int held(dbxLockRef *R)
+{
+    return !tryOther(&trylock, &unlock, R->lock);
+}
+
+static void testOwner(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLockLink *link;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+
+    testDiag("Locks are owned by the thread calling dbxLockMany()");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+    testOk1((L=dbxLockerAlloc(refs, 2, 0))!=NULL);
+
+    dbxLockMany(L, 0);
+    testOk1(held(&A) && held(&B));
+    link = dbxLockRefJoin(L, &A, &B);
+    testOk1(A.lock==B.lock);
+    dbxUnlockMany(L);
+    testOk1(!held(&A));
+
+    testDiag("and by the thread calling dbxLockRefSplit()");
+    dbxLockMany(L, 0);
+    testOk1(dbxLockRefSplit(L, link)==0);
+    testOk1(A.lock!=B.lock);
+    /* lock of B was created by the split */
+    testOk1(held(&A) && held(&B));
+    dbxUnlockMany(L);
+    testOk1(!held(&A) && !held(&B));
+
+    testOk1(dbxLockerFree(L)==0);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
+#else /* DBXLOCK_PI */
+
+static void testOwner(void)
+{
+    testSkip(13, "Not built with DBXLOCK_PI");
+}
+
+#endif /* DBXLOCK_PI */
+
+MAIN(testpi)
+{
+    testPlan(18);
+    testPI();
+    testOwner();
+    return testDone();
+}
+
+#else /* DBXLOCK_HAVE_PI */
+
+MAIN(testpi)
+{
+    testPlan(1);
+    testSkip(1, "Priority inheritance not supported");
+    return testDone();
+}
+
+#endif /* DBXLOCK_HAVE_PI */
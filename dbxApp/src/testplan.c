@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testplan.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static epicsUInt64 hits;
+
+/* alloc w/ plan.  Returns 1 on hit */
+static int allocPlan(dbxLocker **pL, dbxLockRef **refs, size_t n)
+{
+    epicsUInt64 H = hits;
+    *pL = dbxLockerAlloc(refs, n, DBXLOCKER_PLAN);
+    readMetrics();
+    hits = counters[dbxMetricPlanHit];
+    return hits!=H;
+}
+
+/* allocate, then check that each ref is locked */
+static int lockPlan(dbxLockRef **refs, size_t n)
+{
+    dbxLocker *L;
+    size_t i;
+    int hit = allocPlan(&L, refs, n), ok = 1;
+
+    dbxLockMany(L, 0);
+    for(i=0; i<n; i++)
+        ok &= refs[i]->lock->owner==L;
+    dbxUnlockMany(L);
+    dbxLockerFree(L);
+    if(!ok)
+        testDiag("Not all locked");
+    return ok ? hit : -1;
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static dbxLockRef A, B, C, D;
+
+static void testCache(void)
+{
+    dbxLockRef *AB[2] = {&A, &B}, *BA[2] = {&B, &A};
+    dbxLocker *L1, *L2;
+    dbxLockLink *linkAB, *linkCD;
+
+    testDiag("Second locker for the same refs uses the plan");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    memset(&C, 0, sizeof(C));
+    memset(&D, 0, sizeof(D));
+    dbxLockRefInit(&A, 0);
+    dbxLockRefInit(&B, 0);
+    dbxLockRefInit(&C, 0);
+    dbxLockRefInit(&D, 0);
+
+    testOk1(allocPlan(&L1, AB, 2)==0);
+    testOk1(allocPlan(&L2, BA, 2)==1);
+    testOk1(memcmp(L1->refs, L2->refs, 2*sizeof(*L1->refs))==0);
+    testOk1(A.lock->refcnt==3 && B.lock->refcnt==3);
+    testOk1(dbxLockMany(L2, 0)==0);
+    testOk1(A.lock->owner==L2 && B.lock->owner==L2);
+    testOk1(dbxUnlockMany(L2)==0);
+    dbxLockerFree(L1);
+    dbxLockerFree(L2);
+    testOk1(A.lock->refcnt==1 && B.lock->refcnt==1);
+
+    testDiag("Unrelated join doesn't invalidate");
+    linkCD = join(&C, &D);
+    testOk1(lockPlan(AB, 2)==1);
+
+    testDiag("Join of planned refs does");
+    linkAB = join(&A, &B);
+    testOk1(lockPlan(AB, 2)==0);
+    testOk1(lockPlan(BA, 2)==1);
+
+    testDiag("As does split");
+    split(&A, &B, linkAB);
+    testOk1(A.lock!=B.lock);
+    testOk1(lockPlan(AB, 2)==0);
+    testOk1(lockPlan(AB, 2)==1);
+
+    testDiag("Join after alloc is found by dbxLockMany()");
+    testOk1(allocPlan(&L1, AB, 2)==1);
+    linkAB = join(&A, &B);
+    testOk1(dbxLockMany(L1, 0)==0);
+    testOk1(L1->refs[0].lock==A.lock && L1->refs[1].lock==A.lock);
+    testOk1(A.lock->owner==L1);
+    dbxUnlockMany(L1);
+    dbxLockerFree(L1);
+    split(&A, &B, linkAB);
+    split(&C, &D, linkCD);
+
+    testDiag("Re-init of a ref invalidates, even if its lock is re-used");
+    testOk1(lockPlan(AB, 2)==0);
+    testOk1(lockPlan(AB, 2)==1);
+    dbxLockRefClean(&A);
+    dbxLockRefInit(&A, 0);
+    testOk1(lockPlan(AB, 2)==0);
+
+    testDiag("Flush");
+    dbxLockPlanFlush();
+    testOk1(lockPlan(AB, 2)==0);
+    testOk1(lockPlan(AB, 2)==1);
+
+    testOk1(readMetrics()==0);
+    testOk(counters[dbxMetricPlanHit]==7 && counters[dbxMetricPlanMiss]==6,
+           "hit %llu miss %llu", (unsigned long long)counters[dbxMetricPlanHit],
+           (unsigned long long)counters[dbxMetricPlanMiss]);
+
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+    dbxLockRefClean(&C);
+    dbxLockRefClean(&D);
+}
+
+#define NREFS 8
+#define NWORKERS 2
+#define NLOOPS 2000
+
+static dbxLockRef crefs[NREFS];
+static int stop, nbad;
+
+typedef struct {
+    int id;
+    size_t n;
+    epicsEventId done;
+} worker;
+
+static void workTask(void *raw)
+{
+    worker *W = raw;
+    size_t n;
+
+    for(n=0; !epicsAtomicGetIntT(&stop); n++) {
+        dbxLockRef *refs[3];
+        dbxLocker *L;
+        size_t i;
+
+        for(i=0; i<3; i++)
+            refs[i] = &crefs[(W->id+n*i+i)%NREFS];
+        L = dbxLockerAlloc(refs, 3, DBXLOCKER_PLAN);
+        dbxLockMany(L, 0);
+        for(i=0; i<3; i++) {
+            if(refs[i]->lock->holder!=epicsThreadGetIdSelf())
+                epicsAtomicIncrIntT(&nbad);
+        }
+        dbxUnlockMany(L);
+        dbxLockerFree(L);
+    }
+    W->n = n;
+    epicsEventSignal(W->done);
+}
+
+static void testChurn(void)
+{
+    worker W[NWORKERS];
+    size_t i, n;
+
+    testDiag("Plans used while refs are joined and split");
+
+    memset(crefs, 0, sizeof(crefs));
+    for(i=0; i<NREFS; i++)
+        dbxLockRefInit(&crefs[i], 0);
+
+    for(i=0; i<NWORKERS; i++) {
+        W[i].id = i;
+        W[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("worker", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &workTask, &W[i]);
+    }
+
+    for(n=0; n<NLOOPS; n++) {
+        dbxLockRef *A = &crefs[n%NREFS], *B = &crefs[(n*3+1)%NREFS];
+        if(A!=B)
+            split(A, B, join(A, B));
+    }
+    epicsAtomicSetIntT(&stop, 1);
+    for(i=0; i<NWORKERS; i++) {
+        epicsEventMustWait(W[i].done);
+        epicsEventDestroy(W[i].done);
+        testDiag("worker %lu locked %lu times", (unsigned long)i, (unsigned long)W[i].n);
+    }
+
+    testOk(nbad==0, "%d refs not locked", nbad);
+    for(i=0; i<NREFS; i++)
+        dbxLockRefClean(&crefs[i]);
+}
+
+MAIN(testplan)
+{
+    testPlan(26);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testCache();
+    testChurn();
+    dbxLockPlanFlush();
+    return testDone();
+}
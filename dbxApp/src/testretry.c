@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testretry.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+/* counters before lockLoop() */
+static epicsUInt64 base[dbxMetricMax];
+#define DELTA(NAME) (counters[dbxMetric##NAME]-base[dbxMetric##NAME])
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+#define NREFS 1000
+#define NGROUPS 10
+#define NCHURN 2
+
+static dbxLockRef refs[NREFS];
+static dbxLockRef *prefs[NREFS];
+static int stop;
+static epicsEventId done[NCHURN];
+
+static int allOwned(dbxLocker *L)
+{
+    size_t i, n = 0;
+    for(i=0; i<NREFS; i++)
+        n += refs[i].lock->owner==L;
+    return n==NREFS;
+}
+
+/* join and split locksets 2*id and 2*id+1 until stopped */
+static void churnTask(void *raw)
+{
+    int id = (int)(size_t)raw;
+    dbxLockRef *A = &refs[2*id], *B = &refs[2*id+1];
+
+    while(!epicsAtomicGetIntT(&stop))
+        split(A, B, join(A, B));
+    epicsEventSignal(done[id]);
+}
+
+static void startChurn(void)
+{
+    size_t i;
+
+    epicsAtomicSetIntT(&stop, 0);
+    for(i=0; i<NCHURN; i++) {
+        done[i] = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("churn", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &churnTask, (void*)i);
+    }
+}
+
+static void stopChurn(void)
+{
+    size_t i;
+
+    epicsAtomicSetIntT(&stop, 1);
+    for(i=0; i<NCHURN; i++) {
+        epicsEventMustWait(done[i]);
+        epicsEventDestroy(done[i]);
+    }
+}
+
+#define NLOCKS 500
+
+/* lock NLOCKS times, or until an escalation if untilEscalate */
+static void lockLoop(int untilEscalate)
+{
+    dbxLocker *L = dbxLockerAlloc(prefs, NREFS, 0);
+    epicsUInt64 start, T0, T1, worst = 0;
+    size_t n;
+    int nbad = 0;
+
+    readMetrics();
+    memcpy(base, counters, sizeof(base));
+    start = epicsMonotonicGet();
+    for(n=0; ; n++) {
+        T0 = epicsMonotonicGet();
+        dbxLockMany(L, 0);
+        T1 = epicsMonotonicGet();
+        nbad += !allOwned(L);
+        dbxUnlockMany(L);
+
+        if(T1-T0>worst)
+            worst = T1-T0;
+        if(!untilEscalate && n>=NLOCKS)
+            break;
+        if(untilEscalate && (n&63)==0) {
+            readMetrics();
+            if(DELTA(Escalate) || T1-start>10000000000ull)
+                break;
+        }
+    }
+    dbxLockerFree(L);
+
+    testOk(nbad==0, "%d times not all locked", nbad);
+    testOk1(readMetrics()==0);
+    testDiag("%lu locks, retry %llu, backoff %llu, escalate %llu, worst %.3f ms",
+             (unsigned long)n, (unsigned long long)DELTA(Retry),
+             (unsigned long long)DELTA(RetryBackoff),
+             (unsigned long long)DELTA(Escalate), worst*1e-6);
+}
+
+static void testRetry(void)
+{
+    size_t i;
+
+    memset(refs, 0, sizeof(refs));
+    for(i=0; i<NREFS; i++)
+        prefs[i] = &refs[i];
+    dbxLockRefInitMany(prefs, NREFS, 0);
+    for(i=NGROUPS; i<NREFS; i++)
+        join(&refs[i%NGROUPS], &refs[i]);
+
+    startChurn();
+
+    testDiag("Retries w/ default escalation");
+    lockLoop(0);
+    testOk1(DELTA(Escalate)*dbxRetryEscalate<=DELTA(Retry));
+
+    testDiag("Escalate on first retry");
+    dbxRetryEscalate = 1;
+    lockLoop(1);
+    testOk1(DELTA(Escalate)>0);
+
+    testDiag("Always keep held locks");
+    dbxRetryEscalate = 0;
+    lockLoop(0);
+
+    stopChurn();
+    dbxRetryEscalate = 4;
+
+    testOk1(dbxLockRefCleanMany(prefs, NREFS)==0);
+}
+
+MAIN(testretry)
+{
+    testPlan(9);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testRetry();
+    return testDone();
+}
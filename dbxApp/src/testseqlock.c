@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static dbxLockRef A, B;
+
+/* begin, then validate */
+static int readNow(dbxLockRef *R)
+{
+    dbxLockSeq S;
+    dbxLockReadBegin(R, &S);
+    return dbxLockReadValidate(R, &S);
+}
+
+static void testSeq(void)
+{
+    dbxLockRef *refs[1] = {&A};
+    dbxLocker *locker;
+    dbxLockLink *link;
+    dbxLockSeq S;
+    dbxLock *L, *L2;
+
+    testDiag("Reads w/o writes");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    dbxLockRefInit(&A, 0);
+    dbxLockRefInit(&B, 0);
+
+    dbxLockReadBegin(&A, &S);
+    testOk1(dbxLockReadValidate(&A, &S)==0);
+    L = dbxLockOne(&A, 0);
+    testOk1(dbxLockReadValidate(&A, &S)==0);
+    dbxUnlockOne(L);
+    testOk1(dbxLockReadValidate(&A, &S)==0);
+
+    testDiag("Marked write");
+    L = dbxLockOne(&A, 0);
+    dbxLockMarkWrite(&A);
+    testOk1(dbxLockReadValidate(&A, &S)==1);
+    testOk1(readNow(&A)==1);
+    dbxLockMarkWrite(&A);
+    testOk1(readNow(&A)==1);
+    dbxUnlockOne(L);
+    testOk1(readNow(&A)==0);
+    testOk1(dbxLockReadValidate(&A, &S)==1);
+
+    testDiag("Ends at the last unlock");
+    L = dbxLockOne(&A, 0);
+    L2 = dbxLockOne(&A, 0);
+    dbxLockMarkWrite(&A);
+    dbxUnlockOne(L2);
+    testOk1(readNow(&A)==1);
+    dbxUnlockOne(L);
+    testOk1(readNow(&A)==0);
+
+    testDiag("Through dbxLockMany()");
+    locker = dbxLockerAlloc(refs, 1, 0);
+    dbxLockReadBegin(&A, &S);
+    dbxLockMany(locker, 0);
+    dbxLockMarkWrite(&A);
+    testOk1(readNow(&A)==1);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    testOk1(readNow(&A)==0);
+    testOk1(dbxLockReadValidate(&A, &S)==1);
+
+    testDiag("Join and split");
+    dbxLockReadBegin(&A, &S);
+    link = join(&A, &B);
+    /* only if A moved.  The refs of B may have moved instead */
+    testOk1(dbxLockReadValidate(&A, &S)==(A.lock!=S.lock));
+    dbxLockReadBegin(&A, &S);
+    testOk1(dbxLockReadValidate(&A, &S)==0);
+    split(&A, &B, link);
+    testOk1(dbxLockReadValidate(&A, &S)==1);
+    testOk1(readNow(&A)==0);
+}
+
+#define NWORDS 256
+#define NREADS 100000
+
+/* guarded by the lock of A */
+static epicsUInt32 data[NWORDS];
+static epicsUInt32 nwrites;
+static int stop;
+static epicsEventId done[2];
+
+static void writeTask(void *raw)
+{
+    epicsUInt32 n, i;
+
+    for(n=1; !epicsAtomicGetIntT(&stop); n++) {
+        dbxLock *L = dbxLockOne(&A, 0);
+        dbxLockMarkWrite(&A);
+        for(i=0; i<NWORDS; i++)
+            ((volatile epicsUInt32*)data)[i] = n;
+        nwrites = n;
+        dbxUnlockOne(L);
+    }
+    epicsEventSignal(done[0]);
+}
+
+static void churnTask(void *raw)
+{
+    while(!epicsAtomicGetIntT(&stop))
+        split(&A, &B, join(&A, &B));
+    epicsEventSignal(done[1]);
+}
+
+static void testRace(void)
+{
+    epicsUInt32 copy[NWORDS];
+    size_t nread = 0, nretry = 0, ntorn = 0, i;
+
+    testDiag("Read while written, and joined and split");
+
+    done[0] = epicsEventMustCreate(epicsEventEmpty);
+    done[1] = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("writer", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &writeTask, NULL);
+    epicsThreadMustCreate("churn", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &churnTask, NULL);
+
+    while(nread+nretry<NREADS) {
+        dbxLockSeq S;
+
+        dbxLockReadBegin(&A, &S);
+        for(i=0; i<NWORDS; i++)
+            copy[i] = ((volatile epicsUInt32*)data)[i];
+        if(dbxLockReadValidate(&A, &S)) {
+            nretry++;
+            continue;
+        }
+        nread++;
+        for(i=1; i<NWORDS; i++) {
+            if(copy[i]!=copy[0]) {
+                ntorn++;
+                break;
+            }
+        }
+    }
+    epicsAtomicSetIntT(&stop, 1);
+    epicsEventMustWait(done[0]);
+    epicsEventMustWait(done[1]);
+    epicsEventDestroy(done[0]);
+    epicsEventDestroy(done[1]);
+
+    testDiag("%lu reads, %lu retries, %lu writes", (unsigned long)nread,
+             (unsigned long)nretry, (unsigned long)nwrites);
+    testOk(ntorn==0, "%lu torn reads validated", (unsigned long)ntorn);
+    testOk1(data[0]==nwrites && nwrites>0);
+    testOk1(readNow(&A)==0);
+
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+}
+
+MAIN(testseqlock)
+{
+    testPlan(20);
+    testSeq();
+    testRace();
+    return testDone();
+}
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dbDefs.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbx/snapshot.h"
+#include "dbxtopo.h"
+
+#define SNAPFILE "testsnapshot.snap"
+
+static dbxTopo *topo;
+static dbxLockRef **topoptrs;
+
+/* a second set of refs, with the same links as topo */
+static dbxLockRef *refs, **ptrs;
+static dbxLockLink **links;
+
+static void allocRefs(void)
+{
+    size_t i;
+    refs = calloc(topo->nrefs, sizeof(*refs));
+    ptrs = calloc(topo->nrefs, sizeof(*ptrs));
+    links = calloc(topo->nlinks+1, sizeof(*links));
+    if(!refs || !ptrs || !links)
+        testAbort("Alloc fails");
+    for(i=0; i<topo->nrefs; i++)
+        ptrs[i] = &refs[i];
+}
+
+static void freeRefs(void)
+{
+    size_t i;
+    for(i=0; i<topo->nrefs; i++) {
+        if(refs[i].lock)
+            dbxLockRefClean(&refs[i]);
+    }
+    for(i=0; i<topo->nlinks; i++) {
+        if(links[i])
+            dbxLockRefSplit(NULL, links[i]);
+    }
+    free(refs);
+    free(ptrs);
+    free(links);
+}
+
+/* refs share a lock iff topo->refs do, and links match */
+static int checkSame(void)
+{
+    size_t i, bad = 0;
+
+    for(i=0; i<topo->nrefs; i++) {
+        dbxLock *orig = topo->refs[i].lock;
+        dbxLockRef *first = CONTAINER(ellFirst(&orig->refsets), dbxLockRef, refsetsNode);
+        size_t j = first - topo->refs;
+
+        if(refs[i].lock!=refs[j].lock
+                || ellCount(&refs[i].lock->refsets)!=ellCount(&orig->refsets)
+                || ellCount(&refs[i].linksA)!=ellCount(&topo->refs[i].linksA)
+                || ellCount(&refs[i].linksB)!=ellCount(&topo->refs[i].linksB))
+            bad++;
+    }
+    for(i=0; i<topo->nlinks; i++) {
+        if(!topo->links[i]) {
+            bad += links[i]!=NULL;
+            continue;
+        }
+        /* may be the link joined in the other direction */
+        if(!links[i] || links[i]->A-refs!=topo->links[i]->A-topo->refs
+                || links[i]->B-refs!=topo->links[i]->B-topo->refs
+                || links[i]->refcnt!=topo->links[i]->refcnt)
+            bad++;
+    }
+    if(bad)
+        testDiag("%lu differences", (unsigned long)bad);
+    return bad==0;
+}
+
+static void splitLink(dbxLockRef *A, dbxLockRef *B, dbxLockLink **link)
+{
+    dbxLockRef *lrefs[2];
+    dbxLocker *locker;
+
+    lrefs[0] = A;
+    lrefs[1] = B;
+    locker = dbxLockerAlloc(lrefs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, *link);
+    *link = NULL;
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static void testSaveLoad(void)
+{
+    dbxTopoConfig conf;
+    epicsUInt64 T0, T1;
+    size_t i;
+
+    testDiag("Save, then load, a generated topology");
+
+    dbxTopoDefaults(&conf, 5000);
+    T0 = epicsMonotonicGet();
+    topo = dbxTopoCreate(&conf);
+    T1 = epicsMonotonicGet();
+    if(!topo)
+        testAbort("dbxTopoCreate fails");
+    testDiag("init and join %lu refs, %lu links in %.3f ms",
+             (unsigned long)topo->nrefs, (unsigned long)topo->nlinks,
+             (T1-T0)*1e-6);
+
+    topoptrs = calloc(topo->nrefs, sizeof(*topoptrs));
+    if(!topoptrs)
+        testAbort("Alloc fails");
+    for(i=0; i<topo->nrefs; i++)
+        topoptrs[i] = &topo->refs[i];
+
+    testOk1(dbxLockSnapshotSave(SNAPFILE, topoptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks)==0);
+
+    allocRefs();
+    T0 = epicsMonotonicGet();
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks, links)==0);
+    T1 = epicsMonotonicGet();
+    testDiag("load in %.3f ms", (T1-T0)*1e-6);
+
+    testOk(checkSame(), "Same partition and links");
+
+    freeRefs();
+}
+
+static void testMismatch(void)
+{
+    size_t save;
+
+    testDiag("Refuse to load a snapshot of other refs or links");
+    allocRefs();
+
+    testOk1(dbxLockSnapshotLoad("no-such-file.snap", ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks, links)!=0);
+
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs-1,
+                                topo->linkA, topo->linkB, topo->nlinks, links)!=0);
+
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks-1, links)!=0);
+
+    save = topo->linkB[0];
+    topo->linkB[0] = (save+1)%topo->nrefs;
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks, links)!=0);
+    topo->linkB[0] = save;
+
+    {
+        /* move the second ref of a link to another component */
+        FILE *fp = fopen(SNAPFILE, "rb");
+        char buf[64*1024];
+        size_t len = fp ? fread(buf, 1, sizeof(buf), fp) : 0;
+        epicsUInt32 *comp = (epicsUInt32*)(buf+sizeof(dbxSnapshotHeader));
+
+        if(fp)
+            fclose(fp);
+        if(len<sizeof(dbxSnapshotHeader)+topo->nrefs*sizeof(*comp) || len==sizeof(buf))
+            testAbort("Can't read " SNAPFILE);
+        comp[topo->linkB[0]] = comp[topo->linkB[0]] ? 0 : 1;
+        fp = fopen("corrupt.snap", "wb");
+        if(!fp || fwrite(buf, 1, len, fp)!=len || fclose(fp))
+            testAbort("Can't write corrupt.snap");
+        testOk(dbxLockSnapshotLoad("corrupt.snap", ptrs, topo->nrefs,
+                                   topo->linkA, topo->linkB, topo->nlinks, links)!=0,
+               "corrupt components");
+    }
+
+    {
+        size_t i, ok = 1;
+        for(i=0; i<topo->nrefs; i++)
+            ok &= refs[i].lock==NULL;
+        testOk(ok, "refs untouched");
+    }
+
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks, links)==0);
+    testOk(checkSame(), "Same partition and links");
+    freeRefs();
+
+    testDiag("Refuse to save refs which don't match links");
+    {
+        size_t linkA = 0, linkB;
+        for(linkB=1; linkB<topo->nrefs; linkB++) {
+            if(topo->refs[linkB].lock!=topo->refs[0].lock)
+                break;
+        }
+        testOk1(dbxLockSnapshotSave("bad.snap", topoptrs, topo->nrefs,
+                                    &linkA, &linkB, 1)!=0);
+    }
+}
+
+static void testSplit(void)
+{
+    size_t i;
+
+    testDiag("Split every other link of loaded and joined");
+    allocRefs();
+
+    testOk1(dbxLockSnapshotLoad(SNAPFILE, ptrs, topo->nrefs,
+                                topo->linkA, topo->linkB, topo->nlinks, links)==0);
+    for(i=0; i<topo->nlinks; i+=2) {
+        splitLink(&refs[topo->linkA[i]], &refs[topo->linkB[i]], &links[i]);
+        splitLink(&topo->refs[topo->linkA[i]], &topo->refs[topo->linkB[i]], &topo->links[i]);
+    }
+    testOk(checkSame(), "Same partition and links after split");
+
+    freeRefs();
+}
+
+MAIN(testsnapshot)
+{
+    testPlan(14);
+    testSaveLoad();
+    testMismatch();
+    testSplit();
+    free(topoptrs);
+    dbxTopoFree(topo);
+    return testDone();
+}
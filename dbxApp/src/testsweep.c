@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testsweep.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+static void testMerge(void)
+{
+    dbxLockRef A, B, *refs[2] = {&A, &B};
+    dbxLocker *idle;
+    dbxLockLink *link;
+
+    testDiag("Lock merged away, but cached by an idle locker");
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+
+    idle = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(idle, 0);
+    dbxUnlockMany(idle);
+    testOk1(dbxLockSweep()==0);
+
+    link = join(&A, &B);
+    testOk1(A.lock==B.lock);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricStale]==1);
+    testOk1(counters[dbxMetricLocks]==2);
+
+    testOk1(dbxLockSweep()==1);
+    testOk1(idle->refs[0].lock==A.lock && idle->refs[1].lock==A.lock);
+    /* 2 refs, and 2 cache entries */
+    testOk1(A.lock->refcnt==4);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricStale]==0);
+    testOk1(counters[dbxMetricLocks]==1);
+    testOk1(counters[dbxMetricSweep]==1);
+
+    testDiag("Nothing more to sweep");
+    testOk1(dbxLockSweep()==0);
+
+    testDiag("Locker holding locks is skipped");
+    dbxLockMany(idle, 0);
+    dbxLockRefSplit(idle, link);
+    testOk1(A.lock!=B.lock);
+    testOk1(dbxLockSweep()==0);
+    dbxUnlockMany(idle);
+    /* new lock of B */
+    testOk1(dbxLockSweep()==1);
+
+    testOk1(dbxLockerFree(idle)==0);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricStale]==0 && counters[dbxMetricLocks]==0);
+}
+
+#define NREFS 16
+#define NLOOPS 1000
+
+static void testChurn(void)
+{
+    dbxLockRef refs[NREFS], *prefs[NREFS];
+    dbxLocker *idle;
+    size_t i, n, maxlocks = 0;
+
+    testDiag("Join/split churn w/ a long lived locker");
+
+    memset(refs, 0, sizeof(refs));
+    for(i=0; i<NREFS; i++) {
+        dbxLockRefInit(&refs[i], 0);
+        prefs[i] = &refs[i];
+    }
+    idle = dbxLockerAlloc(prefs, NREFS, 0);
+
+    for(n=0; n<NLOOPS; n++) {
+        dbxLockRef *A = &refs[n%NREFS], *B = &refs[(n*7+3)%NREFS];
+        dbxLockLink *link;
+
+        if(A==B)
+            continue;
+        link = join(A, B);
+        split(A, B, link);
+        dbxLockSweep();
+
+        readMetrics();
+        if(counters[dbxMetricLocks]>maxlocks)
+            maxlocks = counters[dbxMetricLocks];
+    }
+
+    testOk1(readMetrics()==0);
+    testOk(counters[dbxMetricStale]==0, "Stale %llu",
+           (unsigned long long)counters[dbxMetricStale]);
+    testOk(maxlocks<=NREFS+1, "max locks %lu <= %u",
+           (unsigned long)maxlocks, NREFS+1);
+
+    testOk1(dbxLockerFree(idle)==0);
+    for(i=0; i<NREFS; i++)
+        dbxLockRefClean(&refs[i]);
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricLocks]==0 && counters[dbxMetricRefs]==0);
+}
+
+MAIN(testsweep)
+{
+    testPlan(29);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testMerge();
+    testChurn();
+    return testDone();
+}
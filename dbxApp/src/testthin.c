@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testthin.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static void testThin(void)
+{
+    dbxLockRef ref;
+    dbxLock *L, *L2;
+
+    testDiag("Uncontended lock stays thin");
+
+    memset(&ref, 0, sizeof(ref));
+    testOk1(dbxLockRefInit(&ref, 0)==0);
+    testOk1(!ref.lock->inflated && ref.lock->word==DBXLOCK_FREE);
+
+    L = dbxLockOne(&ref, 0);
+    testOk1(L->word==DBXLOCK_THIN && L->holder==epicsThreadGetIdSelf());
+    L2 = dbxLockOne(&ref, 0);
+    testOk1(L2==L && L->depth==2);
+    testOk1(dbxlocktrylock(L) && L->depth==3);
+    DBXLOCK_UNLOCK(L);
+    dbxUnlockOne(L2);
+    dbxUnlockOne(L);
+    testOk1(L->word==DBXLOCK_FREE && L->holder==NULL);
+    testOk1(!L->inflated);
+    /* nor needs its rarely used state, unless biased */
+    testOk1(dbxbiasactive || DBXLOCK_EXT(L)==NULL);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricInflate]==0);
+
+    testOk1(dbxLockRefClean(&ref)==0);
+}
+
+typedef struct {
+    dbxLockRef *ref;
+    epicsEventId locked, release, done;
+} holder;
+
+static void holdTask(void *raw)
+{
+    holder *H = raw;
+    dbxLock *L = dbxLockOne(H->ref, 0);
+
+    epicsEventSignal(H->locked);
+    epicsEventMustWait(H->release);
+    dbxUnlockOne(L);
+    epicsEventSignal(H->done);
+}
+
+static void startHolder(holder *H, dbxLockRef *ref)
+{
+    H->ref = ref;
+    H->locked = epicsEventMustCreate(epicsEventEmpty);
+    H->release = epicsEventMustCreate(epicsEventEmpty);
+    H->done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("holder", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &holdTask, H);
+}
+
+static void stopHolder(holder *H)
+{
+    epicsEventSignal(H->release);
+    epicsEventMustWait(H->done);
+    epicsEventDestroy(H->locked);
+    epicsEventDestroy(H->release);
+    epicsEventDestroy(H->done);
+}
+
+static void testInflate(void)
+{
+    dbxLockRef ref;
+    dbxLock *L;
+    holder A, B;
+    int i;
+
+    testDiag("Contended lock inflates, then stays fat");
+
+    memset(&ref, 0, sizeof(ref));
+    testOk1(dbxLockRefInit(&ref, 0)==0);
+    L = ref.lock;
+
+    startHolder(&A, &ref);
+    epicsEventMustWait(A.locked);
+    testOk1(L->word==DBXLOCK_THIN);
+    testOk1(!dbxthintrylock(L));
+
+    /* B must wait, so inflates */
+    startHolder(&B, &ref);
+    for(i=0; i<500 && !epicsAtomicGetIntT(&L->inflated); i++)
+        epicsThreadSleep(0.01);
+    testOk1(L->inflated);
+    testOk1(L->word==DBXLOCK_THIN);
+    testOk1(epicsEventWaitWithTimeout(B.locked, 0.1)==epicsEventWaitTimeout);
+
+    stopHolder(&A);
+    epicsEventMustWait(B.locked);
+    testOk1(L->word==DBXLOCK_FAT);
+    testOk1(!dbxthintrylock(L));
+    stopHolder(&B);
+
+    testOk1(L->word==DBXLOCK_FAT);
+    testOk1(dbxLockOne(&ref, 0)==L);
+    testOk1(L->depth==1);
+    dbxUnlockOne(L);
+    testOk1(L->word==DBXLOCK_FAT && L->holder==NULL);
+
+    testOk1(readMetrics()==0);
+    testOk1(counters[dbxMetricInflate]==1);
+
+    testOk1(dbxLockRefClean(&ref)==0);
+}
+
+#define NTHREADS 4
+#define NLOOPS 10000
+
+typedef struct {
+    dbxLockRef *ref;
+    size_t *count;
+    epicsEventId start, done;
+} counter;
+
+static void countTask(void *raw)
+{
+    counter *C = raw;
+    int i;
+
+    epicsEventMustWait(C->start);
+    for(i=0; i<NLOOPS; i++) {
+        dbxLock *L = dbxLockOne(C->ref, 0);
+        /* not atomic.  Guarded by the lock */
+        (*C->count)++;
+        dbxUnlockOne(L);
+    }
+    epicsEventSignal(C->done);
+}
+
+static void testCount(void)
+{
+    dbxLockRef ref;
+    counter C[NTHREADS];
+    size_t count = 0;
+    int i;
+
+    testDiag("%d threads count through a thin lock as it inflates", NTHREADS);
+
+    memset(&ref, 0, sizeof(ref));
+    testOk1(dbxLockRefInit(&ref, 0)==0);
+
+    for(i=0; i<NTHREADS; i++) {
+        C[i].ref = &ref;
+        C[i].count = &count;
+        C[i].start = epicsEventMustCreate(epicsEventEmpty);
+        C[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("counter", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              &countTask, &C[i]);
+    }
+    for(i=0; i<NTHREADS; i++)
+        epicsEventSignal(C[i].start);
+    for(i=0; i<NTHREADS; i++) {
+        epicsEventMustWait(C[i].done);
+        epicsEventDestroy(C[i].start);
+        epicsEventDestroy(C[i].done);
+    }
+
+    testOk(count==NTHREADS*NLOOPS, "count %u == %u",
+           (unsigned)count, (unsigned)(NTHREADS*NLOOPS));
+    testOk1(ref.lock->word!=DBXLOCK_THIN && ref.lock->holder==NULL);
+
+    testOk1(dbxLockRefClean(&ref)==0);
+}
+
+MAIN(testthin)
+{
+    testPlan(30);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testThin();
+    testInflate();
+    testCount();
+    return testDone();
+}
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+#include "dbxtopo.h"
+
+/* union-find over ref indices */
+static
+size_t ufFind(size_t *parent, size_t i)
+{
+    while(parent[i]!=i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+/* check that locksets match the connected components of the remaining links */
+static
+int checkPartition(const dbxTopo *topo)
+{
+    size_t i, bad = 0;
+    size_t *parent = malloc(topo->nrefs*sizeof(*parent));
+    dbxLock **rootlock = calloc(topo->nrefs, sizeof(*rootlock));
+
+    if(!parent || !rootlock)
+        testAbort("Alloc fails");
+
+    for(i=0; i<topo->nrefs; i++)
+        parent[i] = i;
+    for(i=0; i<topo->nlinks; i++) {
+        if(topo->links[i])
+            parent[ufFind(parent, topo->linkA[i])] = ufFind(parent, topo->linkB[i]);
+    }
+
+    /* refs in one component share a lock */
+    for(i=0; i<topo->nrefs; i++) {
+        size_t root = ufFind(parent, i);
+        if(!rootlock[root])
+            rootlock[root] = topo->refs[i].lock;
+        else if(rootlock[root]!=topo->refs[i].lock)
+            bad++;
+    }
+    /* and no other refs */
+    for(i=0; i<topo->nrefs; i++) {
+        if(parent[i]==i && rootlock[i]) {
+            ELLNODE *cur;
+            ELL_FOREACH(&rootlock[i]->refsets, cur) {
+                dbxLockRef *ref = CONTAINER(cur, dbxLockRef, refsetsNode);
+                if(ufFind(parent, ref-topo->refs)!=i)
+                    bad++;
+            }
+        }
+    }
+
+    free(parent);
+    free(rootlock);
+    return bad==0;
+}
+
+static void testGenerate(void)
+{
+    dbxTopoConfig conf;
+    dbxTopo *topo;
+    size_t nsets, largest, nsingle = 0, i;
+
+    testDiag("Test topology generator");
+
+    dbxTopoDefaults(&conf, 5000);
+    topo = dbxTopoCreate(&conf);
+    testOk1(topo!=NULL);
+    if(!topo)
+        return;
+
+    dbxTopoCount(topo, &nsets, &largest);
+    for(i=0; i<topo->nrefs; i++) {
+        if(ellCount(&topo->refs[i].lock->refsets)==1)
+            nsingle++;
+    }
+    testDiag("%lu refs, %lu links, %lu locksets, largest %lu, %lu singletons",
+             (unsigned long)topo->nrefs, (unsigned long)topo->nlinks,
+             (unsigned long)nsets, (unsigned long)largest,
+             (unsigned long)nsingle);
+
+    testOk1(nsingle>=2500);
+    testOk1(largest>=250);
+    testOk1(nsets>nsingle);
+    testOk(checkPartition(topo), "Locksets match link graph");
+
+    dbxTopoFree(topo);
+}
+
+static void testSplitAll(void)
+{
+    dbxTopoConfig conf;
+    dbxTopo *topo;
+    size_t i, n;
+    unsigned int seed = 42;
+
+    testDiag("Test splitting a generated topology");
+
+    dbxTopoDefaults(&conf, 2000);
+    conf.extra = 0.2;
+    topo = dbxTopoCreate(&conf);
+    testOk1(topo!=NULL);
+    if(!topo)
+        return;
+
+    for(n=0; n<4; n++) {
+        /* remove a quarter of the original links, in random order */
+        for(i=0; i<topo->nlinks/4; i++) {
+            size_t j = rand_r(&seed)%topo->nlinks;
+            dbxLockRef *refs[2];
+            dbxLocker *locker;
+
+            if(!topo->links[j])
+                continue;
+            refs[0] = &topo->refs[topo->linkA[j]];
+            refs[1] = &topo->refs[topo->linkB[j]];
+            locker = dbxLockerAlloc(refs, 2, 0);
+            dbxLockMany(locker, 0);
+            dbxLockRefSplit(locker, topo->links[j]);
+            topo->links[j] = NULL;
+            dbxUnlockMany(locker);
+            dbxLockerFree(locker);
+        }
+        testOk(checkPartition(topo), "Locksets match link graph after round %u",
+               (unsigned)n);
+    }
+
+    dbxTopoFree(topo);
+}
+
+MAIN(testtopo)
+{
+    testPlan(10);
+    testGenerate();
+    testSplitAll();
+    return testDone();
+}
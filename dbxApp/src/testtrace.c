@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define TRACEFILE "testtrace.bin"
+
+static epicsEventId lockdone;
+
+static void testRecord(void)
+{
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLock *K;
+    dbxLockLink *link;
+    dbxTraceHeader head;
+    dbxTraceRecord recs[8];
+    size_t nrecs;
+    FILE *fp;
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+
+    testDiag("Test trace recording");
+
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+    testOk1((L=dbxLockerAlloc(refs, 2, 0))!=NULL);
+
+    /* not recorded */
+    K = dbxLockOne(&A, 0);
+    dbxUnlockOne(K);
+
+    testOk1(dbxLockTraceStart(TRACEFILE)==0);
+    testOk1(dbxLockTraceStart(TRACEFILE)!=0);
+
+    K = dbxLockOne(&A, 0);
+    dbxUnlockOne(K);
+
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1((link=dbxLockRefJoin(L, &A, &B))!=NULL);
+    testOk1(dbxLockRefSplit(L, link)==0);
+    testOk1(dbxUnlockMany(L)==0);
+
+    testOk1(dbxLockTraceStop()==0);
+
+    /* not recorded */
+    K = dbxLockOne(&A, 0);
+    dbxUnlockOne(K);
+
+    fp = fopen(TRACEFILE, "rb");
+    testOk1(fp!=NULL);
+    if(!fp) {
+        testAbort("Can't read trace");
+        return;
+    }
+    testOk1(fread(&head, sizeof(head), 1, fp)==1);
+    testOk1(memcmp(head.magic, DBXTRACE_MAGIC, 8)==0);
+    testOk1(head.version==DBXTRACE_VERSION);
+    testOk1(head.recsize==sizeof(dbxTraceRecord));
+    nrecs = fread(recs, sizeof(recs[0]), NELEMENTS(recs), fp);
+    fclose(fp);
+    remove(TRACEFILE);
+
+    /* lockOne, join, split, 2x lockMany */
+    testOk(nrecs==5, "nrecs==5 (%u)", (unsigned)nrecs);
+    if(nrecs!=5)
+        return;
+
+    testOk1(recs[0].op==dbxTraceLockOne);
+    testOk1(recs[0].ref==(size_t)&A);
+    testOk1(recs[0].count==1);
+
+    testOk1(recs[1].op==dbxTraceJoin);
+    testOk1(recs[1].ref==(size_t)&A);
+    testOk1(recs[1].ref2==(size_t)&B);
+
+    testOk1(recs[2].op==dbxTraceSplit);
+    testOk1(recs[2].ref==(size_t)&A);
+    testOk1(recs[2].ref2==(size_t)&B);
+
+    testOk1(recs[3].op==dbxTraceLockMany);
+    testOk1(recs[4].op==dbxTraceLockMany);
+    testOk1(recs[3].index==0 && recs[4].index==1);
+    testOk1(recs[3].count==2 && recs[4].count==2);
+    testOk1(recs[3].time==recs[4].time);
+    testOk1(recs[1].time>=recs[3].time+recs[3].wait);
+    testOk1(recs[0].thread==recs[3].thread);
+    testOk1(recs[0].thread==0);
+
+    testOk1(dbxLockerFree(L)==0);
+    testOk1(dbxLockRefClean(&A)==0);
+    testOk1(dbxLockRefClean(&B)==0);
+}
+
+static void lockTask(void *raw)
+{
+    dbxLockRef *A = raw;
+    dbxUnlockOne(dbxLockOne(A, 0));
+    epicsEventSignal(lockdone);
+}
+
+static void testThreadIds(void)
+{
+    dbxLockRef A;
+    dbxTraceRecord recs[4];
+    size_t nrecs = 0;
+    FILE *fp;
+
+    testDiag("Thread ids of each trace start from 0");
+
+    memset(&A, 0, sizeof(A));
+    dbxLockRefInit(&A, 0);
+    lockdone = epicsEventMustCreate(epicsEventEmpty);
+
+    /* the first record of this trace is from a thread not yet seen */
+    testOk1(dbxLockTraceStart(TRACEFILE)==0);
+    epicsThreadMustCreate("locker", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &lockTask, &A);
+    epicsEventMustWait(lockdone);
+    dbxUnlockOne(dbxLockOne(&A, 0));
+    testOk1(dbxLockTraceStop()==0);
+
+    fp = fopen(TRACEFILE, "rb");
+    if(fp && fseek(fp, sizeof(dbxTraceHeader), SEEK_SET)==0)
+        nrecs = fread(recs, sizeof(recs[0]), NELEMENTS(recs), fp);
+    if(fp)
+        fclose(fp);
+    remove(TRACEFILE);
+
+    testOk(nrecs==2, "nrecs==2 (%u)", (unsigned)nrecs);
+    if(nrecs==2) {
+        /* in file order by thread, not time */
+        dbxTraceRecord *first = recs[0].time<=recs[1].time ? &recs[0] : &recs[1],
+                       *second = first==&recs[0] ? &recs[1] : &recs[0];
+        testOk(first->thread==0 && second->thread==1, "threads %u, %u",
+               (unsigned)first->thread, (unsigned)second->thread);
+    } else {
+        testFail("missing records");
+    }
+
+    epicsEventDestroy(lockdone);
+    dbxLockRefClean(&A);
+}
+
+static size_t countRecords(void)
+{
+    dbxTraceRecord rec;
+    epicsUInt64 last = 0;
+    size_t nrecs = 0;
+    FILE *fp = fopen(TRACEFILE, "rb");
+
+    if(fp && fseek(fp, sizeof(dbxTraceHeader), SEEK_SET)==0) {
+        /* one thread, so in time order */
+        while(fread(&rec, sizeof(rec), 1, fp)==1 && rec.time>=last) {
+            last = rec.time;
+            nrecs++;
+        }
+    }
+    if(fp)
+        fclose(fp);
+    remove(TRACEFILE);
+    return nrecs;
+}
+
+static void testBlocks(void)
+{
+    dbxLockRef A;
+    size_t i, nrecs;
+
+    testDiag("Full blocks are written, and buffers re-used by the next trace");
+
+    memset(&A, 0, sizeof(A));
+    dbxLockRefInit(&A, 0);
+
+    testOk1(dbxLockTraceStart(TRACEFILE)==0);
+    for(i=0; i<3000; i++)
+        dbxUnlockOne(dbxLockOne(&A, 0));
+    testOk1(dbxLockTraceStop()==0);
+    nrecs = countRecords();
+    testOk(nrecs==3000, "nrecs==3000 (%u)", (unsigned)nrecs);
+
+    testOk1(dbxLockTraceStart(TRACEFILE)==0);
+    for(i=0; i<10; i++)
+        dbxUnlockOne(dbxLockOne(&A, 0));
+    testOk1(dbxLockTraceStop()==0);
+    nrecs = countRecords();
+    testOk(nrecs==10, "nrecs==10 (%u)", (unsigned)nrecs);
+
+    dbxLockRefClean(&A);
+}
+
+static void testNullRef(void)
+{
+    dbxLockRef A, *refs[] = {&A, NULL};
+    dbxLocker *L;
+    dbxTraceRecord rec;
+    size_t nrecs = 0;
+    FILE *fp;
+
+    testDiag("Unused locker entries are not recorded");
+
+    memset(&A, 0, sizeof(A));
+    dbxLockRefInit(&A, 0);
+    L = dbxLockerAlloc(refs, 2, 0);
+
+    testOk1(dbxLockTraceStart(TRACEFILE)==0);
+    dbxLockMany(L, 0);
+    dbxUnlockMany(L);
+    testOk1(dbxLockTraceStop()==0);
+
+    fp = fopen(TRACEFILE, "rb");
+    if(fp && fseek(fp, sizeof(dbxTraceHeader), SEEK_SET)==0) {
+        while(fread(&rec, sizeof(rec), 1, fp)==1) {
+            nrecs++;
+            testOk(rec.ref==(size_t)&A, "ref %p", (void*)(size_t)rec.ref);
+        }
+    }
+    if(fp)
+        fclose(fp);
+    remove(TRACEFILE);
+    testOk(nrecs==1, "nrecs==1 (%u)", (unsigned)nrecs);
+
+    dbxLockerFree(L);
+    dbxLockRefClean(&A);
+}
+
+#if defined(DBXLOCK_TRACEPOINTS) && !defined(DBXLOCK_USDT)
+static size_t nhits[dbxTPMax];
+
+static void countHit(dbxTracePoint point, const void *A, const void *B)
+{
+    nhits[point]++;
+}
+#endif
+
+static void testTracePoints(void)
+{
+#if defined(DBXLOCK_TRACEPOINTS) && !defined(DBXLOCK_USDT)
+    dbxLockRef A, B, *refs[] = {&A, &B};
+    dbxLocker *L;
+    dbxLockLink *link;
+    size_t base[dbxTPMax];
+    int i;
+
+    testDiag("Test tracepoint callbacks");
+
+    for(i=0; i<dbxTPMax; i++) {
+        base[i] = dbxLockTracePointCount(i);
+        testOk1(dbxLockTracePointSet(i, &countHit)==0);
+    }
+
+    memset(&A, 0, sizeof(A));
+    memset(&B, 0, sizeof(B));
+    testOk1(dbxLockRefInit(&A, 0)==0);
+    testOk1(dbxLockRefInit(&B, 0)==0);
+
+    L = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(L, 0);
+    link = dbxLockRefJoin(L, &A, &B);
+    dbxUnlockMany(L);
+    /* locker cache now stale */
+    dbxLockMany(L, 0);
+    dbxLockRefSplit(L, link);
+    dbxUnlockMany(L);
+    dbxLockerFree(L);
+
+    testOk1(nhits[dbxTPJoin]==1);
+    testOk1(nhits[dbxTPJoinMerge]==1);
+    testOk1(nhits[dbxTPSplit]==1);
+    testOk1(nhits[dbxTPSplitNew]==1);
+    testOk1(nhits[dbxTPUnlockMany]==2);
+    testOk1(nhits[dbxTPUpdateChanged]>=1);
+    testOk1(nhits[dbxTPLockManyContended]==0);
+    testOk1(dbxLockTracePointCount(dbxTPJoin)==base[dbxTPJoin]+1);
+
+    for(i=0; i<dbxTPMax; i++)
+        dbxLockTracePointSet(i, NULL);
+
+    dbxLockRefClean(&A);
+    dbxLockRefClean(&B);
+    testOk1(nhits[dbxTPJoin]==1);
+#else
+    testSkip(9+dbxTPMax, "Tracepoint callbacks not built");
+    testOk1(dbxLockTracePointSet(dbxTPJoin, NULL)!=0);
+    testOk1(dbxLockTracePointCount(dbxTPJoin)==0);
+#endif
+}
+
+MAIN(testtrace)
+{
+    testPlan(61+dbxTPMax);
+    testRecord();
+    testThreadIds();
+    testBlocks();
+    testNullRef();
+    testTracePoints();
+    return testDone();
+}
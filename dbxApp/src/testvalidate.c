@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "dbxlock_priv.h"
+
+#define METRICSFILE "testvalidate.bin"
+
+static epicsUInt64 counters[dbxMetricMax], hist[DBXMETRICS_NHIST];
+
+static int readMetrics(void)
+{
+    char buf[64*1024];
+    size_t len;
+    FILE *fp = fopen(METRICSFILE, "rb");
+    if(!fp)
+        return 1;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return dbxLockMetricsSum(buf, len, counters, hist);
+}
+
+static dbxLockLink* join(dbxLockRef *A, dbxLockRef *B)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+    dbxLockLink *link;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    link = dbxLockRefJoin(locker, A, B);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+    return link;
+}
+
+static void split(dbxLockRef *A, dbxLockRef *B, dbxLockLink *link)
+{
+    dbxLockRef *refs[2];
+    dbxLocker *locker;
+
+    refs[0] = A;
+    refs[1] = B;
+    locker = dbxLockerAlloc(refs, 2, 0);
+    dbxLockMany(locker, 0);
+    dbxLockRefSplit(locker, link);
+    dbxUnlockMany(locker);
+    dbxLockerFree(locker);
+}
+
+/* not a multiple of DBXVALIDATE_BATCH */
+#define NREFS 1000
+#define NGROUPS 10
+
+static dbxLockRef refs[NREFS], other[2];
+static dbxLockRef *prefs[NREFS];
+
+static int allOwned(dbxLocker *L)
+{
+    size_t i, n = 0;
+    for(i=0; i<NREFS; i++)
+        n += refs[i].lock->owner==L;
+    return n==NREFS;
+}
+
+static void testValidate(void)
+{
+    dbxLocker *L;
+    dbxLockLink *link;
+    size_t i;
+
+    testDiag("Validate %u refs in %u locksets after locking", NREFS, NGROUPS);
+
+    memset(refs, 0, sizeof(refs));
+    memset(other, 0, sizeof(other));
+    for(i=0; i<NREFS; i++)
+        prefs[i] = &refs[i];
+    testOk1(dbxLockRefInitMany(prefs, NREFS, 0)==0);
+    dbxLockRefInit(&other[0], 0);
+    dbxLockRefInit(&other[1], 0);
+    for(i=NGROUPS; i<NREFS; i++)
+        join(&refs[i%NGROUPS], &refs[i]);
+
+    L = dbxLockerAlloc(prefs, NREFS, 0);
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(allOwned(L));
+
+    testDiag("Unrelated join while locked is not a change");
+    link = join(&other[0], &other[1]);
+    testOk1(dbxupdaterefs(L, 0)==0);
+    testOk1(dbxupdaterefs(L, 1)==0);
+
+    testDiag("A changed gen is");
+    split(&other[0], &other[1], link);
+    L->refs[NREFS-1].gen ^= 2;
+    testOk1(dbxupdaterefs(L, 0)==1);
+    L->refs[NREFS-1].gen ^= 2;
+    testOk1(dbxupdaterefs(L, 0)==0);
+    testOk1(dbxUnlockMany(L)==0);
+
+    testDiag("Join within the set is found");
+    link = join(&refs[0], &refs[1]);
+    testOk1(dbxLockMany(L, 0)==0);
+    testOk1(allOwned(L));
+    testOk1(dbxUnlockMany(L)==0);
+    split(&refs[0], &refs[1], link);
+
+    testOk1(readMetrics()==0);
+    testOk(counters[dbxMetricRetry]==0, "Retry %llu",
+           (unsigned long long)counters[dbxMetricRetry]);
+
+    dbxLockerFree(L);
+}
+
+#define NLOOPS 200
+
+static int stop, nbad, nlocked;
+static epicsEventId done;
+
+static void workTask(void *raw)
+{
+    dbxLocker *L = dbxLockerAlloc(prefs, NREFS, 0);
+
+    while(!epicsAtomicGetIntT(&stop)) {
+        dbxLockMany(L, 0);
+        if(!allOwned(L))
+            epicsAtomicIncrIntT(&nbad);
+        dbxUnlockMany(L);
+        epicsAtomicIncrIntT(&nlocked);
+    }
+    dbxLockerFree(L);
+    epicsEventSignal(done);
+}
+
+static void testChurn(void)
+{
+    size_t n;
+
+    testDiag("Lock all while locksets are joined and split");
+
+    done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("worker", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          &workTask, NULL);
+
+    /* until both have looped enough */
+    for(n=0; n<NLOOPS || epicsAtomicGetIntT(&nlocked)<NLOOPS; n++) {
+        dbxLockRef *A = &refs[n%NGROUPS], *B = &refs[(n+1)%NGROUPS];
+        split(A, B, join(A, B));
+    }
+    epicsAtomicSetIntT(&stop, 1);
+    epicsEventMustWait(done);
+    epicsEventDestroy(done);
+    testDiag("%lu join/split, locked %d times", (unsigned long)n, nlocked);
+
+    testOk(nbad==0, "%d times not all locked", nbad);
+
+    testOk1(dbxLockRefCleanMany(prefs, NREFS)==0);
+    dbxLockRefClean(&other[0]);
+    dbxLockRefClean(&other[1]);
+}
+
+MAIN(testvalidate)
+{
+    testPlan(15);
+    if(dbxLockMetricsOpen(METRICSFILE))
+        testAbort("Can't open " METRICSFILE);
+    testValidate();
+    testChurn();
+    return testDone();
+}